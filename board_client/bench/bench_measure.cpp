@@ -0,0 +1,21 @@
+#include <stdlib.h>
+#include <new>
+
+#include "bench_measure.h"
+
+size_t g_allocations = 0;
+size_t g_allocated_bytes = 0;
+volatile size_t g_sink = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    g_allocated_bytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
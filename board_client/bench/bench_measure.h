@@ -0,0 +1,43 @@
+#ifndef BENCH_MEASURE_H
+#define BENCH_MEASURE_H
+
+#include <stddef.h>
+#include <chrono>
+
+// Timing and allocation counting shared by the microbenchmarks. bench_measure.cpp replaces
+// the global operator new, so every heap allocation of a program that links it is counted.
+
+extern size_t g_allocations;
+extern size_t g_allocated_bytes;
+
+// Keeps the compiler from dropping work whose result is not used otherwise
+extern volatile size_t g_sink;
+
+// Cost of one operation, averaged over the measured iterations.
+struct Measurement {
+    double us;
+    double allocations;
+    double allocated_kib;
+};
+
+// Runs operation once to warm up (reusable buffers reach their size there), then iterations
+// times measured. operation returns a size that goes to g_sink.
+template <class Operation>
+Measurement Measure(int iterations, Operation operation) {
+    g_sink += operation();
+
+    size_t allocations = g_allocations;
+    size_t allocated_bytes = g_allocated_bytes;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        g_sink += operation();
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    Measurement measurement;
+    measurement.us = us / iterations;
+    measurement.allocations = static_cast<double>(g_allocations - allocations) / iterations;
+    measurement.allocated_kib = (g_allocated_bytes - allocated_bytes) / 1024.0 / iterations;
+    return measurement;
+}
+
+#endif  // BENCH_MEASURE_H
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bench_measure.h"
+#include "json_path_extractor.h"
+#include "json_string.h"
+#include "legacy_codec.h"
+#include "llm_provider.h"
+#include "sse_decoder.h"
+
+// Microbenchmarks of the client's request encoding and response decoding, each run against the
+// code it replaced (see legacy_codec.h). Single threaded and without network, every row reports
+// the time and the heap allocations of one operation in the steady state. Run with --help.
+
+struct CodecOptions {
+    std::vector<std::string> benches = {"payload", "json", "provider"};
+    std::vector<std::string> providers = {"Qwen", "DeepSeek", "Gemini"};
+    int iterations = 2000;
+    int turns = 50;
+    int message_size = 300;  // Bytes per message
+    int reply_size = 4096;   // Bytes of reply text to escape, unescape and decode
+    int event_size = 64;     // Bytes of reply text per streamed event
+};
+
+static void Usage() {
+    printf(
+        "Usage: codec_bench [options]\n"
+        "  --bench=payload,json,provider     benchmarks to run\n"
+        "  --providers=Qwen,DeepSeek,Gemini  provider formats to run\n"
+        "  --iterations=2000                 measured operations per row, after one warm-up\n"
+        "  --turns=50                        messages per conversation\n"
+        "  --message-size=300                bytes per message\n"
+        "  --reply-size=4096                 bytes of reply text to escape, unescape and decode\n"
+        "  --event-size=64                   bytes of reply text per streamed event\n");
+}
+
+static std::vector<std::string> SplitList(const char* value) {
+    std::vector<std::string> items;
+    std::string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos)
+            comma = list.size();
+        if (comma > start)
+            items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+static bool ParseOptions(int argc, char* argv[], CodecOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        std::string name = eq ? std::string(arg, eq - arg) : std::string(arg);
+        const char* value = eq ? eq + 1 : "";
+
+        if (name == "--bench")
+            options.benches = SplitList(value);
+        else if (name == "--providers")
+            options.providers = SplitList(value);
+        else if (name == "--iterations")
+            options.iterations = std::max(1, atoi(value));
+        else if (name == "--turns")
+            options.turns = std::max(1, atoi(value));
+        else if (name == "--message-size")
+            options.message_size = std::max(1, atoi(value));
+        else if (name == "--reply-size")
+            options.reply_size = std::max(1, atoi(value));
+        else if (name == "--event-size")
+            options.event_size = std::max(1, atoi(value));
+        else
+            return false;
+    }
+    return true;
+}
+
+static const char* const kMixedPieces[] = {"今天天气怎么样？", "The \"quick\" brown fox ", "北京晴，气温二十五度。",
+                                           "jumps over the lazy dog.\n", "请用中文回答。\t"};
+static const char* const kAsciiPieces[] = {"The \"quick\" brown fox ", "jumps over the lazy dog.\n",
+                                           "Sunny in Beijing, 25 degrees. "};
+static const char* const kChinesePieces[] = {"北京今天晴，气温二十五度，", "适合户外活动。\n", "“注意防晒”，多喝水。"};
+
+// Text made of pieces with the quotes and line breaks a reply has, size bytes long without
+// splitting a character.
+template <size_t N>
+static std::string MakeText(const char* const (&pieces)[N], size_t size) {
+    std::string text;
+    for (size_t i = 0;; i++) {
+        const char* piece = pieces[i % N];
+        if (text.size() + strlen(piece) > size)
+            break;
+        text += piece;
+    }
+    text.append(size - text.size(), 'x');
+    return text;
+}
+
+static std::string JsonEscaped(const std::string& text) {
+    std::string escaped(JsonEscapedSize(text.data(), text.size()), '\0');
+    JsonEscape(text.data(), text.size(), &escaped[0]);
+    return escaped;
+}
+
+static std::vector<ConversationMessage> MakeConversation(int turns, int message_size) {
+    std::vector<ConversationMessage> conversation;
+    std::string text = MakeText(kMixedPieces, message_size);
+    for (int i = 0; i < turns; i++) {
+        bool user = (turns - 1 - i) % 2 == 0;
+        conversation.push_back({user ? "user" : "assistant", text, false});
+    }
+    return conversation;
+}
+
+static void PrintRow(const char* bench,
+                     const std::string& subject,
+                     const char* implementation,
+                     size_t bytes,
+                     const Measurement& measurement) {
+    printf("%-8s %-9s %-7s %9zu %10.2f %9.1f %10.1f %9.1f\n", bench, subject.c_str(), implementation, bytes,
+           measurement.us, bytes / measurement.us, measurement.allocations, measurement.allocated_kib);
+}
+
+// Request body of a whole conversation, as sent without the history cache. The old code also
+// copied the body behind the header into one string, the new one passes both as iovecs.
+static void BenchPayload(const CodecOptions& options) {
+    std::vector<ConversationMessage> conversation = MakeConversation(options.turns, options.message_size);
+    const std::string model_name = "bench-model";
+    const std::string header = "POST /v1/chat/completions HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n";
+
+    for (const std::string& name : options.providers) {
+        const ProviderOps* provider = FindProvider(name);
+        if (!provider) {
+            fprintf(stderr, "Unknown provider %s\n", name.c_str());
+            continue;
+        }
+
+        size_t legacy_size = LegacyGeneratePayload(name, model_name, conversation).size();
+        Measurement legacy = Measure(options.iterations, [&]() {
+            std::string payload = LegacyGeneratePayload(name, model_name, conversation);
+            std::string request = header + payload;
+            return request.size();
+        });
+        PrintRow("payload", name, "legacy", legacy_size, legacy);
+
+        // One body reused across requests, like LLM::body_
+        RequestBody body;
+        std::vector<struct iovec> buffers;
+        Measurement current = Measure(options.iterations, [&]() {
+            body.Clear();
+            WriteRequestBody(*provider, model_name, conversation, 0, false, body);
+            buffers.clear();
+            buffers.push_back({const_cast<char*>(header.data()), header.size()});
+            body.HeadBuffers(buffers);
+            return body.size() + buffers.size();
+        });
+        PrintRow("payload", name, "current", body.size(), current);
+    }
+}
+
+// The JSON string form of UTF-8 text with everything outside ASCII as \uXXXX escapes, as
+// some providers send it.
+static std::string EscapeNonAscii(const std::string& escaped) {
+    std::string out;
+    for (size_t i = 0; i < escaped.size();) {
+        unsigned char c = escaped[i];
+        if (c < 0x80) {
+            out += escaped[i++];
+            continue;
+        }
+        int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+        unsigned int code = c & (0x3f >> extra);
+        for (int k = 1; k <= extra; k++)
+            code = (code << 6) | (escaped[i + k] & 0x3f);
+        i += extra + 1;
+
+        char unit[16];
+        if (code >= 0x10000) {
+            code -= 0x10000;
+            snprintf(unit, sizeof(unit), "\\u%04x\\u%04x", 0xd800 + (code >> 10), 0xdc00 + (code & 0x3ff));
+        } else {
+            snprintf(unit, sizeof(unit), "\\u%04x", code);
+        }
+        out += unit;
+    }
+    return out;
+}
+
+// Escaping of request text and unescaping of reply text. The old unescape turned every
+// \uXXXX into '?', its rows on the "chinese\u" input are fast but wrong.
+static void BenchJson(const CodecOptions& options) {
+    struct Input {
+        const char* name;
+        std::string text;
+    };
+    const Input inputs[] = {
+        {"ascii", MakeText(kAsciiPieces, options.reply_size)},
+        {"chinese", MakeText(kChinesePieces, options.reply_size)},
+    };
+
+    for (const Input& input : inputs) {
+        const std::string& text = input.text;
+        Measurement legacy =
+            Measure(options.iterations, [&]() { return LegacyJsonEscapeString(text).size(); });
+        PrintRow("escape", input.name, "legacy", text.size(), legacy);
+
+        std::vector<char> out;
+        Measurement current = Measure(options.iterations, [&]() {
+            size_t size = JsonEscapedSize(text.data(), text.size());
+            if (out.size() < size)
+                out.resize(size);
+            return static_cast<size_t>(JsonEscape(text.data(), text.size(), out.data()) - out.data());
+        });
+        PrintRow("escape", input.name, "current", text.size(), current);
+    }
+
+    std::vector<Input> escaped_inputs;
+    for (const Input& input : inputs) {
+        std::string escaped = JsonEscaped(input.text);
+        escaped_inputs.push_back({input.name, escaped});
+        if (strcmp(input.name, "chinese") == 0)
+            escaped_inputs.push_back({"chinese\\u", EscapeNonAscii(escaped)});
+    }
+
+    for (const Input& input : escaped_inputs) {
+        const std::string& text = input.text;
+        Measurement legacy =
+            Measure(options.iterations, [&]() { return LegacyJsonUnescapeString(text).size(); });
+        PrintRow("unescape", input.name, "legacy", text.size(), legacy);
+
+        std::string out;
+        Measurement current = Measure(options.iterations, [&]() {
+            out.clear();
+            JsonUnescape(text.data(), text.size(), out);
+            return out.size();
+        });
+        PrintRow("unescape", input.name, "current", text.size(), current);
+    }
+}
+
+// Search keys the old client was configured with, "" for providers it did not know
+static std::string LegacySearchKey(const std::string& name) {
+    if (name == "Gemini")
+        return "\"text\": \"";
+    if (name == "Qwen" || name == "DeepSeek")
+        return "\"content\":\"";
+    return "";
+}
+
+// Reply to a request without streaming, laid out like the provider's: Gemini pretty prints,
+// the OpenAI format comes compact with the metadata around the text.
+static std::string MakeResponse(const std::string& name, const std::string& text) {
+    if (name == "Gemini")
+        return "{\n  \"candidates\": [\n    {\n      \"content\": {\n        \"parts\": [\n          {\n"
+               "            \"text\": \"" +
+               JsonEscaped(text) +
+               "\"\n          }\n        ],\n        \"role\": \"model\"\n      },\n"
+               "      \"finishReason\": \"STOP\",\n      \"index\": 0\n    }\n  ],\n"
+               "  \"usageMetadata\": {\n    \"promptTokenCount\": 12,\n    \"candidatesTokenCount\": 900,\n"
+               "    \"totalTokenCount\": 912\n  }\n}\n";
+    return "{\"id\":\"chatcmpl-bench\",\"object\":\"chat.completion\",\"created\":1700000000,"
+           "\"model\":\"bench-model\",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\","
+           "\"content\":\"" +
+           JsonEscaped(text) +
+           "\"},\"finish_reason\":\"stop\"}],\"usage\":{\"prompt_tokens\":12,\"completion_tokens\":900,"
+           "\"total_tokens\":912}}";
+}
+
+// The same reply as an event stream, event_size bytes of text per event without splitting a
+// character.
+static std::string MakeEventStream(const std::string& name, const std::string& text, size_t event_size) {
+    std::string stream;
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = std::min(pos + event_size, text.size());
+        while (end < text.size() && (text[end] & 0xC0) == 0x80)
+            end++;
+        std::string piece = JsonEscaped(text.substr(pos, end - pos));
+        pos = end;
+
+        if (name == "Gemini")
+            stream += "data: {\"candidates\": [{\"content\": {\"parts\": [{\"text\": \"" + piece +
+                      "\"}],\"role\": \"model\"},\"index\": 0}]}\r\n\r\n";
+        else
+            stream += "data: {\"id\":\"chatcmpl-bench\",\"object\":\"chat.completion.chunk\","
+                      "\"created\":1700000000,\"model\":\"bench-model\",\"choices\":[{\"index\":0,"
+                      "\"delta\":{\"content\":\"" +
+                      piece + "\"},\"finish_reason\":null}]}\n\n";
+    }
+    // Gemini's stream just ends
+    if (name != "Gemini")
+        stream += "data: [DONE]\n\n";
+    return stream;
+}
+
+static void CheckDecoded(const char* bench, const std::string& name, const std::string& text,
+                         const std::string& expected) {
+    if (text != expected)
+        fprintf(stderr, "%s %s: the decoded text differs from the reply\n", bench, name.c_str());
+}
+
+// Cost of one request through each provider adapter: encoding a single new turn (the whole
+// conversation is the payload benchmark), decoding the reply, and decoding it streamed. The
+// decoders are set up per request as in LLM::SendRequest/SendStreamRequest. The old client
+// had no streaming, so the stream rows have no legacy counterpart.
+static void BenchProvider(const CodecOptions& options) {
+    std::vector<ConversationMessage> turn = {{"user", MakeText(kMixedPieces, options.message_size), false}};
+    const std::string model_name = "bench-model";
+    const std::string reply = MakeText(kMixedPieces, options.reply_size);
+
+    for (const std::string& name : options.providers) {
+        const ProviderOps* provider = FindProvider(name);
+        if (!provider) {
+            fprintf(stderr, "Unknown provider %s\n", name.c_str());
+            continue;
+        }
+        const std::string search_key = LegacySearchKey(name);
+
+        if (!search_key.empty()) {
+            size_t legacy_size = LegacyGeneratePayload(name, model_name, turn).size();
+            Measurement legacy = Measure(options.iterations,
+                                         [&]() { return LegacyGeneratePayload(name, model_name, turn).size(); });
+            PrintRow("encode", name, "legacy", legacy_size, legacy);
+        }
+
+        RequestBody body;
+        Measurement encode = Measure(options.iterations, [&]() {
+            body.Clear();
+            WriteRequestBody(*provider, model_name, turn, 0, false, body);
+            return body.size();
+        });
+        PrintRow("encode", name, "current", body.size(), encode);
+
+        const std::string response = MakeResponse(name, reply);
+        if (!search_key.empty()) {
+            CheckDecoded("decode", name, LegacyParseResponse(response, search_key), reply);
+            Measurement legacy = Measure(options.iterations,
+                                         [&]() { return LegacyParseResponse(response, search_key).size(); });
+            PrintRow("decode", name, "legacy", response.size(), legacy);
+        }
+
+        std::string decoded;
+        Measurement decode = Measure(options.iterations, [&]() {
+            std::string text;
+            JsonPathExtractor extractor(provider->response_path(false),
+                                        [&](const char* data, size_t len) { text.append(data, len); });
+            extractor.Feed(response.data(), response.size());
+            decoded.swap(text);
+            return decoded.size();
+        });
+        CheckDecoded("decode", name, decoded, reply);
+        PrintRow("decode", name, "current", response.size(), decode);
+
+        const std::string stream = MakeEventStream(name, reply, options.event_size);
+        Measurement stream_decode = Measure(options.iterations, [&]() {
+            std::string text;
+            std::string delta;
+            JsonPathExtractor extractor(provider->response_path(true),
+                                        [&](const char* data, size_t len) { delta.append(data, len); });
+            SseDecoder sse([&](const std::string&, const std::string& data) {
+                if (provider->is_stream_end(data))
+                    return;
+                delta.clear();
+                extractor.Reset();
+                extractor.Feed(data.data(), data.size());
+                if (extractor.found())
+                    text += delta;
+            });
+            sse.Feed(stream.data(), stream.size());
+            sse.Finish();
+            decoded.swap(text);
+            return decoded.size();
+        });
+        CheckDecoded("stream", name, decoded, reply);
+        PrintRow("stream", name, "current", stream.size(), stream_decode);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    CodecOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        Usage();
+        return 2;
+    }
+
+    printf("%d turns of %d bytes, %d iterations\n", options.turns, options.message_size, options.iterations);
+    printf("%-8s %-9s %-7s %9s %10s %9s %10s %9s\n", "bench", "case", "impl", "bytes", "us/op", "MB/s",
+           "allocs/op", "alloc_kb");
+    for (const std::string& bench : options.benches) {
+        if (bench == "payload") {
+            BenchPayload(options);
+        } else if (bench == "json") {
+            BenchJson(options);
+        } else if (bench == "provider") {
+            BenchProvider(options);
+        } else {
+            fprintf(stderr, "Unknown benchmark %s\n", bench.c_str());
+            return 2;
+        }
+    }
+    return 0;
+}
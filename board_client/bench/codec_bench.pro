@@ -0,0 +1,36 @@
+# 请求体编码、JSON 转义和响应解码的微基准，与被替换的旧实现对比，不需要网络
+# 用法：qmake bench/codec_bench.pro && make && ./build/codec_bench --help
+
+TEMPLATE = app
+TARGET = codec_bench
+
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+# 与主程序一致，Cortex-A7 上启用 NEON
+contains(QT_ARCH, arm): QMAKE_CXXFLAGS += -mfpu=neon-vfpv4
+
+SOURCES += \
+    bench_measure.cpp \
+    codec_bench.cpp \
+    legacy_codec.cpp
+
+HEADERS += \
+    bench_measure.h \
+    legacy_codec.h
+
+# 被测的客户端源码
+SOURCES += \
+    $$PWD/../src/base64.cpp \
+    $$PWD/../src/json_path_extractor.cpp \
+    $$PWD/../src/json_string.cpp \
+    $$PWD/../src/llm_provider.cpp \
+    $$PWD/../src/payload_writer.cpp \
+    $$PWD/../src/sse_decoder.cpp
+
+# 包含目录设置
+INCLUDEPATH += $$PWD/../include
+
+# 构建目录设置
+DESTDIR = build
+OBJECTS_DIR = build/obj
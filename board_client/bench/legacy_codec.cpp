@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <iostream>
+
+#include "legacy_codec.h"
+
+std::string LegacyJsonEscapeString(const std::string& input) {
+    std::string output;
+    output.reserve(input.size() * 2);
+
+    for (unsigned char c : input) {
+        switch (c) {
+            case '\"':
+                output += "\\\"";
+                break;
+            case '\\':
+                output += "\\\\";
+                break;
+            case '\b':
+                output += "\\b";
+                break;
+            case '\f':
+                output += "\\f";
+                break;
+            case '\n':
+                output += "\\n";
+                break;
+            case '\r':
+                output += "\\r";
+                break;
+            case '\t':
+                output += "\\t";
+                break;
+            default:
+                if (c < ' ') {
+                    char buffer[7];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    output += buffer;
+                } else {
+                    output += static_cast<char>(c);
+                }
+                break;
+        }
+    }
+
+    return output;
+}
+
+std::string LegacyJsonUnescapeString(const std::string& input) {
+    std::string output;
+    size_t i = 0;
+    const size_t length = input.length();
+
+    while (i < length) {
+        if (input[i] == '\\' && (i + 1 < length)) {
+            const char esc_char = input[++i];
+            switch (esc_char) {
+                case 'n':
+                    output += '\n';
+                    break;
+                case 't':
+                    output += '\t';
+                    break;
+                case 'r':
+                    output += '\r';
+                    break;
+                case 'b':
+                    output += '\b';
+                    break;
+                case 'f':
+                    output += '\f';
+                    break;
+                case '"':
+                    output += '"';
+                    break;
+                case '\\':
+                    output += '\\';
+                    break;
+                case '/':
+                    output += '/';
+                    break;
+                case 'u':
+                    if (i + 4 < length) {
+                        output += '?';
+                        i += 4;
+                    } else {
+                        output += "\\u";
+                    }
+                    break;
+                default:
+                    output += '\\';
+                    output += esc_char;
+                    break;
+            }
+            i++;
+        } else {
+            output += input[i++];
+        }
+    }
+
+    return output;
+}
+
+std::string LegacyGeneratePayload(const std::string& name,
+                                  const std::string& model_name,
+                                  std::vector<ConversationMessage>& conversation_data) {
+    std::string payload;
+
+    if (name == "Gemini") {
+        payload = "{ \"contents\": [";
+
+        for (size_t i = 0; i < conversation_data.size(); i++) {
+            std::string escaped_content = LegacyJsonEscapeString(conversation_data[i].content);
+
+            if (i > 0)
+                payload += ", ";
+            payload += "{\"role\": \"" + std::string(conversation_data[i].role) +
+                       "\", \"parts\": [{\"text\": \"" + escaped_content + "\"}]}";
+        }
+
+        payload += "]}";
+    } else if (name == "DeepSeek") {
+        payload = "{\"model\": \"" + model_name + "\", \"messages\": [";
+
+        for (size_t i = 0; i < conversation_data.size(); i++) {
+            std::string escaped_content = LegacyJsonEscapeString(conversation_data[i].content);
+
+            if (i > 0)
+                payload += ", ";
+            payload += "{\"role\": \"" + std::string(conversation_data[i].role) + "\", \"content\": \"" +
+                       escaped_content + "\"}";
+        }
+
+        payload += "], \"stream\": false}";
+    } else if (name == "Qwen") {
+        payload = "{\"model\": \"" + model_name + "\", \"messages\": [";
+
+        for (size_t i = 0; i < conversation_data.size(); i++) {
+            std::string escaped_content = LegacyJsonEscapeString(conversation_data[i].content);
+
+            if (i > 0)
+                payload += ", ";
+            payload += "{\"role\": \"" + std::string(conversation_data[i].role) +
+                       "\", \"content\": [{\"type\": \"text\", \"text\": \"" + escaped_content + "\"}]}";
+        }
+
+        payload += "]}";
+    }
+
+    return payload;
+}
+
+std::string LegacyParseResponse(const std::string& response, const std::string& search_key) {
+    size_t start_pos = response.find(search_key);
+    if (start_pos == std::string::npos) {
+        std::cerr << "ERROR [Parse]: Could not find '" << search_key << "' in response body." << std::endl;
+        return "";
+    }
+
+    start_pos += search_key.length();
+
+    // Find the closing quote that's not escaped
+    size_t end_pos = start_pos;
+    while (true) {
+        end_pos = response.find('"', end_pos);
+        if (end_pos == std::string::npos) {
+            std::cerr << "ERROR [Parse]: Could not find closing quote for text field." << std::endl;
+            return "";
+        }
+
+        // Check if the quote is escaped
+        if (end_pos > 0 && response[end_pos - 1] != '\\') {
+            break;
+        }
+        end_pos++;  // Move past this quote to find the next one
+    }
+
+    std::string result = response.substr(start_pos, end_pos - start_pos);
+    return LegacyJsonUnescapeString(result);
+}
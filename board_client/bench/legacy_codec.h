@@ -0,0 +1,27 @@
+#ifndef LEGACY_CODEC_H
+#define LEGACY_CODEC_H
+
+#include <string>
+#include <vector>
+
+#include "llm_provider.h"
+
+// The string building JSON code of LLM before PayloadWriter and the provider adapters, kept
+// as the baseline codec_bench compares the current code against. Not used by the client.
+
+std::string LegacyJsonEscapeString(const std::string& input);
+
+// Replaces every \uXXXX escape with '?'.
+std::string LegacyJsonUnescapeString(const std::string& input);
+
+// GeneratePayload() as it was: one string grown message by message with operator+, the
+// provider picked by name. Images are left out, the benchmark does not attach one.
+std::string LegacyGeneratePayload(const std::string& name,
+                                  const std::string& model_name,
+                                  std::vector<ConversationMessage>& conversation_data);
+
+// ParseResponse() as it was: the text between the first search_key (e.g. "content":") and the
+// next unescaped quote, unescaped. Returns "" if either is missing.
+std::string LegacyParseResponse(const std::string& response, const std::string& search_key);
+
+#endif  // LEGACY_CODEC_H
@@ -0,0 +1,61 @@
+#include <string.h>
+#include <sstream>
+
+#include "legacy_request_head.h"
+
+size_t LegacyFindHeadEnd(std::vector<char>& buffer, size_t received) {
+    buffer[received] = '\0';
+    char* headers_end = strstr(&buffer[0], "\r\n\r\n");
+    if (!headers_end)
+        return 0;
+    return headers_end + 4 - &buffer[0];
+}
+
+int LegacyParseHeaders(const std::string& headers, LegacyRequestInfo& info) {
+    std::istringstream stream(headers);
+    std::string line;
+
+    // Parse request line
+    if (!std::getline(stream, line))
+        return -1;
+    if (line.back() == '\r')
+        line.pop_back();
+
+    size_t pos1 = line.find(' ');
+    if (pos1 == std::string::npos)
+        return -1;
+    info.method = line.substr(0, pos1);
+
+    size_t pos2 = line.find(' ', pos1 + 1);
+    if (pos2 == std::string::npos)
+        return -1;
+    info.uri = line.substr(pos1 + 1, pos2 - pos1 - 1);
+    info.version = line.substr(pos2 + 1);
+
+    if (info.method != "POST")
+        return -1;
+
+    // Parse headers
+    bool found_cl = false;
+    while (std::getline(stream, line)) {
+        if (line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            break;
+
+        if (line.find("Content-Length:") == 0) {
+            size_t colon = line.find(':');
+            size_t value_start = line.find_first_not_of(" \t", colon + 1);
+            if (value_start == std::string::npos)
+                return -1;
+
+            try {
+                info.content_length = std::stol(line.substr(value_start));
+                found_cl = true;
+            } catch (...) {
+                return -1;
+            }
+        }
+    }
+    return found_cl ? 0 : -1;
+}
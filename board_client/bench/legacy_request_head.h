@@ -0,0 +1,28 @@
+#ifndef LEGACY_REQUEST_HEAD_H
+#define LEGACY_REQUEST_HEAD_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// How ClientReceiver read a request head before HttpRequestParser, kept as the baseline
+// request_parser_bench compares the parser against. Not used by the client.
+
+struct LegacyRequestInfo {
+    std::string method;
+    std::string uri;
+    std::string version;
+    long content_length = 0;
+};
+
+// The step ReceiveHeaders() took after every recv(): NUL-terminates the received bytes and
+// searches all of them for the blank line. buffer needs a byte past received, the old code
+// wrote it even when the buffer was full. Returns the size of the head with the blank line,
+// 0 while it is incomplete.
+size_t LegacyFindHeadEnd(std::vector<char>& buffer, size_t received);
+
+// ParseHeaders() as it was, on a copy of the head: line by line through an istringstream.
+// Returns -1 unless the request is a POST with a Content-Length.
+int LegacyParseHeaders(const std::string& headers, LegacyRequestInfo& info);
+
+#endif  // LEGACY_REQUEST_HEAD_H
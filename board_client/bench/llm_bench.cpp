@@ -0,0 +1,269 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dns_resolver.h"
+#include "llm.h"
+#include "mock_llm_server.h"
+
+// Offline benchmark of the LLM client: requests go to a local MockLlmServer over TLS, for every
+// provider format over a matrix of conversation lengths and image sizes, and each cell reports
+// throughput, latency percentiles and the peak RSS of the process so far. Run with --help.
+
+struct BenchOptions {
+    std::vector<std::string> providers = {"Qwen", "DeepSeek", "Gemini"};
+    std::vector<int> streams = {0, 1};
+    std::vector<int> turns = {1, 8, 32};
+    std::vector<int> image_kib = {0, 64, 512};
+    int requests = 20;
+    int message_size = 200;  // Characters per message of the conversation
+    int compression = 0;
+    bool verbose = false;
+    MockLlmServer::Options server;
+};
+
+struct ProviderSetup {
+    const char* name;
+    const char* path;
+    const char* role;
+    bool images;  // Only Qwen's adapter sends the camera image
+};
+
+static const ProviderSetup kProviders[] = {
+    {"Qwen", "/compatible-mode/v1/chat/completions", "system", true},
+    {"DeepSeek", "/chat/completions", "system", false},
+    {"Gemini", "/v1beta/models/bench:generateContent", "user", false},
+};
+
+static void Usage() {
+    printf(
+        "Usage: llm_bench [options]\n"
+        "  --providers=Qwen,DeepSeek,Gemini  provider formats to run\n"
+        "  --stream=0,1           0 for SendRequest(), 1 for SendStreamRequest()\n"
+        "  --turns=1,8,32         messages per conversation\n"
+        "  --images=0,64,512      camera image sizes in KiB, for providers that send images\n"
+        "  --requests=20          measured requests per cell, after one warm-up request\n"
+        "  --message-size=200     characters per message\n"
+        "  --compression=0        request gzip level, see LLM::set_request_compression()\n"
+        "  --delay-ms=0           server delay before the response head\n"
+        "  --chunk-delay-ms=0     server delay between reply chunks\n"
+        "  --chunk-size=64        reply text per event, or bytes per write when not streaming\n"
+        "  --payload-size=2048    reply text size\n"
+        "  --verbose              keep the client's own log\n");
+}
+
+static std::vector<std::string> SplitList(const char* value) {
+    std::vector<std::string> items;
+    std::string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos)
+            comma = list.size();
+        if (comma > start)
+            items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+static std::vector<int> SplitInts(const char* value) {
+    std::vector<int> numbers;
+    for (const std::string& item : SplitList(value))
+        numbers.push_back(atoi(item.c_str()));
+    return numbers;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        std::string name = eq ? std::string(arg, eq - arg) : std::string(arg);
+        const char* value = eq ? eq + 1 : "";
+
+        if (name == "--providers")
+            options.providers = SplitList(value);
+        else if (name == "--stream")
+            options.streams = SplitInts(value);
+        else if (name == "--turns")
+            options.turns = SplitInts(value);
+        else if (name == "--images")
+            options.image_kib = SplitInts(value);
+        else if (name == "--requests")
+            options.requests = std::max(1, atoi(value));
+        else if (name == "--message-size")
+            options.message_size = std::max(1, atoi(value));
+        else if (name == "--compression")
+            options.compression = atoi(value);
+        else if (name == "--delay-ms")
+            options.server.delay_ms = atoi(value);
+        else if (name == "--chunk-delay-ms")
+            options.server.chunk_delay_ms = atoi(value);
+        else if (name == "--chunk-size")
+            options.server.chunk_size = std::max(1, atoi(value));
+        else if (name == "--payload-size")
+            options.server.payload_size = std::max(1, atoi(value));
+        else if (name == "--verbose")
+            options.verbose = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+// Nearest-rank percentile of sorted samples.
+static double Percentile(const std::vector<double>& sorted, double percent) {
+    size_t rank = static_cast<size_t>(percent / 100.0 * sorted.size() + 0.999999);
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static long PeakRssKib() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;  // KiB on Linux
+}
+
+static std::vector<ConversationMessage> MakeConversation(int turns, int message_size, bool image) {
+    std::vector<ConversationMessage> conversation;
+    std::string text;
+    for (int i = 0; text.size() < static_cast<size_t>(message_size); i++)
+        text += "word" + std::to_string(i) + (i % 12 == 11 ? ".\n" : " ");
+    text.resize(message_size);
+
+    // Ends with the user's question, which carries the image
+    for (int i = 0; i < turns; i++) {
+        bool user = (turns - 1 - i) % 2 == 0;
+        conversation.push_back({user ? "user" : "assistant", text, user && image && i == turns - 1});
+    }
+    return conversation;
+}
+
+static bool WriteImage(const std::string& path, int kib) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> block(1024);
+    unsigned int seed = 1;
+    for (int i = 0; i < kib; i++) {
+        for (char& c : block)
+            c = static_cast<char>(rand_r(&seed));
+        file.write(block.data(), block.size());
+    }
+    return static_cast<bool>(file);
+}
+
+static void RunCell(LLM& llm, const BenchOptions& options, int stream, int turns, int image_kib) {
+    std::vector<ConversationMessage> conversation = MakeConversation(turns, options.message_size, image_kib > 0);
+    auto send = [&]() {
+        return stream ? llm.SendStreamRequest(conversation, nullptr) : llm.SendRequest(conversation);
+    };
+
+    send();  // Opens the connection and warms the caches
+
+    std::vector<double> latencies;
+    int failures = 0;
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.requests; i++) {
+        std::chrono::steady_clock::time_point request_start = std::chrono::steady_clock::now();
+        std::string reply = send();
+        latencies.push_back(
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request_start).count());
+        if (reply.size() != options.server.payload_size) {
+            failures++;
+            continue;
+        }
+        bytes_sent += llm.last_transfer().request_sent;
+        bytes_received += llm.last_transfer().response_received;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-9s %6d %6d %8d %9.1f %8.2f %8.2f %8.2f %8.2f %9.2f %9.2f %10ld %5d\n", llm.name().c_str(), stream,
+           turns, image_kib, options.requests / seconds, Percentile(latencies, 50), Percentile(latencies, 90),
+           Percentile(latencies, 99), latencies.back(), bytes_sent / seconds / (1024 * 1024),
+           bytes_received / seconds / (1024 * 1024), PeakRssKib(), failures);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        Usage();
+        return 2;
+    }
+
+    // Client and mock server write to connections the other side may have closed
+    signal(SIGPIPE, SIG_IGN);
+
+    // Certificate, hosts file and camera image live in a scratch directory, the client reads
+    // the image from ./image.jpg
+    char dir_template[] = "/tmp/llm_bench.XXXXXX";
+    const char* dir = mkdtemp(dir_template);
+    if (!dir || chdir(dir) != 0) {
+        perror("Cannot create the scratch directory");
+        return 1;
+    }
+
+    MockLlmServer server(options.server);
+    if (!server.Start(dir))
+        return 1;
+    // Read by the TLS context, which is created with the first connection
+    setenv("SSL_CERT_FILE", server.cert_file().c_str(), 1);
+    std::ofstream("hosts") << "127.0.0.1 localhost\n";
+    DnsResolver::Instance().LoadHostsFile("hosts");
+
+    // The client logs every request, which would drown the table
+    std::streambuf* log = std::cout.rdbuf();
+    if (!options.verbose)
+        std::cout.rdbuf(nullptr);
+
+    printf("%-9s %6s %6s %8s %9s %8s %8s %8s %8s %9s %9s %10s %5s\n", "provider", "stream", "turns", "image_kb",
+           "req/s", "p50_ms", "p90_ms", "p99_ms", "max_ms", "up_MB/s", "down_MB/s", "peak_rss_kb", "fail");
+    for (const std::string& name : options.providers) {
+        const ProviderSetup* setup = nullptr;
+        for (const ProviderSetup& provider : kProviders) {
+            if (name == provider.name)
+                setup = &provider;
+        }
+        if (!setup) {
+            fprintf(stderr, "Unknown provider %s\n", name.c_str());
+            continue;
+        }
+
+        LLM llm(setup->name, "localhost", setup->path, "bench-key", "bench-model", setup->role, false);
+        llm.set_port(server.port());
+        llm.set_request_compression(options.compression);
+        for (int stream : options.streams) {
+            for (int turns : options.turns) {
+                for (int image_kib : options.image_kib) {
+                    if (image_kib > 0 && !setup->images)
+                        continue;
+                    if (image_kib > 0 && !WriteImage("image.jpg", image_kib)) {
+                        fprintf(stderr, "Cannot write the test image\n");
+                        continue;
+                    }
+                    RunCell(llm, options, stream, turns, image_kib);
+                    unlink("image.jpg");
+                }
+            }
+        }
+    }
+
+    std::cout.rdbuf(log);
+    server.Stop();
+    unlink("hosts");
+    unlink(server.cert_file().c_str());
+    rmdir(dir);
+    return 0;
+}
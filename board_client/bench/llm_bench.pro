@@ -0,0 +1,58 @@
+# LLM 客户端的离线基准测试：本地 HTTPS 模拟服务器，不消耗 API 额度
+# 用法：qmake bench/llm_bench.pro && make && ./build/llm_bench --help
+
+TEMPLATE = app
+TARGET = llm_bench
+
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+# 与主程序一致，Cortex-A7 上启用 NEON
+contains(QT_ARCH, arm): QMAKE_CXXFLAGS += -mfpu=neon-vfpv4
+
+SOURCES += \
+    llm_bench.cpp \
+    mock_llm_server.cpp
+
+HEADERS += \
+    mock_llm_server.h
+
+# 被测的客户端源码（不含界面、摄像头和数据库）
+SOURCES += \
+    $$PWD/../src/base64.cpp \
+    $$PWD/../src/compression.cpp \
+    $$PWD/../src/connection_pool.cpp \
+    $$PWD/../src/deadline.cpp \
+    $$PWD/../src/dns_resolver.cpp \
+    $$PWD/../src/http2_session.cpp \
+    $$PWD/../src/http_response_parser.cpp \
+    $$PWD/../src/https_connection.cpp \
+    $$PWD/../src/json_path_extractor.cpp \
+    $$PWD/../src/json_string.cpp \
+    $$PWD/../src/llm.cpp \
+    $$PWD/../src/llm_provider.cpp \
+    $$PWD/../src/payload_writer.cpp \
+    $$PWD/../src/request_metrics.cpp \
+    $$PWD/../src/sse_decoder.cpp \
+    $$PWD/../src/tls_context.cpp \
+    $$PWD/../src/tls_session_cache.cpp
+
+# 包含目录设置
+INCLUDEPATH += $$PWD/../include
+INCLUDEPATH += $$PWD/../extern/openssl-3.0.14/include
+INCLUDEPATH += $$PWD/../extern/nghttp2/lib/includes
+
+# 与主程序相同的库
+LIBS += -L$$PWD/../extern/openssl-3.0.14 \
+        -lssl \
+        -lcrypto
+
+LIBS += -lz
+
+LIBS += -L$$PWD/../extern/nghttp2/lib/.libs -lnghttp2
+
+unix:!macx: LIBS += -ldl -lpthread
+
+# 构建目录设置
+DESTDIR = build
+OBJECTS_DIR = build/obj
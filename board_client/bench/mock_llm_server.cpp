@@ -0,0 +1,296 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "mock_llm_server.h"
+
+static const char kReplyWords[] = "The quick brown fox jumps over the lazy dog. ";
+
+static bool WriteAll(SSL* ssl, const char* data, size_t len) {
+    while (len > 0) {
+        int n = SSL_write(ssl, data, static_cast<int>(std::min(len, static_cast<size_t>(1 << 20))));
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool WriteChunk(SSL* ssl, const std::string& data) {
+    char size_line[32];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+    return WriteAll(ssl, size_line, n) && WriteAll(ssl, data.data(), data.size()) && WriteAll(ssl, "\r\n", 2);
+}
+
+static void Sleep(int ms) {
+    if (ms > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+MockLlmServer::MockLlmServer(const Options& options)
+    : options_(options), ctx_(nullptr), listen_fd_(-1), port_(0), stopping_(false), requests_(0) {}
+
+MockLlmServer::~MockLlmServer() {
+    Stop();
+    if (ctx_)
+        SSL_CTX_free(ctx_);
+}
+
+bool MockLlmServer::CreateContext() {
+    // P-256 key and a certificate for localhost signed with it
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if (!key_ctx || EVP_PKEY_keygen_init(key_ctx) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(key_ctx, &key) <= 0) {
+        EVP_PKEY_CTX_free(key_ctx);
+        return false;
+    }
+    EVP_PKEY_CTX_free(key_ctx);
+
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1,
+                               -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    X509V3_CTX ext_ctx;
+    X509V3_set_ctx(&ext_ctx, cert, cert, nullptr, nullptr, 0);
+    X509_EXTENSION* san =
+        X509V3_EXT_conf_nid(nullptr, &ext_ctx, NID_subject_alt_name, const_cast<char*>("DNS:localhost,IP:127.0.0.1"));
+    X509_EXTENSION* ca = X509V3_EXT_conf_nid(nullptr, &ext_ctx, NID_basic_constraints, const_cast<char*>("CA:TRUE"));
+    bool ok = san && ca && X509_add_ext(cert, san, -1) && X509_add_ext(cert, ca, -1) &&
+              X509_sign(cert, key, EVP_sha256()) > 0;
+    X509_EXTENSION_free(san);
+    X509_EXTENSION_free(ca);
+
+    FILE* fp = ok ? fopen(cert_file_.c_str(), "w") : nullptr;
+    if (fp) {
+        ok = PEM_write_X509(fp, cert) == 1;
+        ok = fclose(fp) == 0 && ok;
+    } else {
+        ok = false;
+    }
+
+    if (ok) {
+        ctx_ = SSL_CTX_new(TLS_server_method());
+        ok = ctx_ && SSL_CTX_use_certificate(ctx_, cert) == 1 && SSL_CTX_use_PrivateKey(ctx_, key) == 1;
+    }
+    if (ok)
+        SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    if (!ok)
+        ERR_print_errors_fp(stderr);
+    return ok;
+}
+
+bool MockLlmServer::Start(const std::string& dir) {
+    cert_file_ = dir + "/mock_llm_cert.pem";
+    if (!CreateContext()) {
+        fprintf(stderr, "Cannot create the mock server certificate\n");
+        return false;
+    }
+
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        perror("socket() failed");
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;  // Any free port
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 16) < 0 ||
+        getsockname(listen_fd_, (struct sockaddr*)&addr, &addr_len) < 0) {
+        perror("Mock server listen failed");
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+
+    accept_thread_ = std::thread(&MockLlmServer::AcceptLoop, this);
+    return true;
+}
+
+void MockLlmServer::Stop() {
+    if (stopping_.exchange(true))
+        return;
+
+    if (accept_thread_.joinable())
+        accept_thread_.join();
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (int fd : connection_fds_)
+            shutdown(fd, SHUT_RDWR);
+    }
+    for (std::thread& thread : connection_threads_)
+        thread.join();
+    connection_threads_.clear();
+
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void MockLlmServer::AcceptLoop() {
+    while (!stopping_) {
+        // Wakes up now and then to notice Stop()
+        struct pollfd pfd = {listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        // Replies are written in pieces, which Nagle's algorithm would hold back
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connection_fds_.push_back(fd);
+        connection_threads_.push_back(std::thread(&MockLlmServer::Serve, this, fd));
+    }
+}
+
+void MockLlmServer::Serve(int fd) {
+    SSL* ssl = SSL_new(ctx_);
+    SSL_set_fd(ssl, fd);
+
+    if (SSL_accept(ssl) == 1) {
+        std::string pending;
+        char buf[16384];
+        bool open = true;
+        while (open && !stopping_) {
+            size_t head_end;
+            while ((head_end = pending.find("\r\n\r\n")) == std::string::npos) {
+                int n = SSL_read(ssl, buf, sizeof(buf));
+                if (n <= 0)
+                    break;
+                pending.append(buf, n);
+            }
+            if (head_end == std::string::npos)
+                break;
+
+            std::string head = pending.substr(0, head_end + 4);
+            pending.erase(0, head_end + 4);
+
+            long content_length = 0;
+            const char* length_header = strcasestr(head.c_str(), "\r\nContent-Length:");
+            if (length_header)
+                content_length = strtol(length_header + 17, nullptr, 10);
+
+            // The body is not looked at, the client asks for a stream in the head
+            long remaining = content_length;
+            while (remaining > 0) {
+                if (pending.empty()) {
+                    int n = SSL_read(ssl, buf, sizeof(buf));
+                    if (n <= 0)
+                        break;
+                    pending.assign(buf, n);
+                }
+                size_t take = std::min(pending.size(), static_cast<size_t>(remaining));
+                pending.erase(0, take);
+                remaining -= take;
+            }
+            if (remaining > 0)
+                break;
+
+            requests_++;
+            // Gemini streams from its own method, OpenAI style APIs take a flag in the body,
+            // which comes with an Accept header
+            size_t line_end = head.find("\r\n");
+            bool stream_method = head.find(":streamGenerateContent") < line_end;
+            bool gemini = stream_method || head.find(":generateContent") < line_end;
+            bool stream = gemini ? stream_method
+                                 : strcasestr(head.c_str(), "\r\nAccept: text/event-stream") != nullptr;
+            open = Respond(ssl, gemini, stream);
+        }
+    }
+
+    SSL_free(ssl);
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connection_fds_.erase(std::find(connection_fds_.begin(), connection_fds_.end(), fd));
+    }
+    close(fd);
+}
+
+std::string MockLlmServer::ReplyText() const {
+    std::string text;
+    text.reserve(options_.payload_size);
+    while (text.size() < options_.payload_size)
+        text.append(kReplyWords, std::min(sizeof(kReplyWords) - 1, options_.payload_size - text.size()));
+    return text;
+}
+
+bool MockLlmServer::Respond(SSL* ssl, bool gemini, bool stream) {
+    Sleep(options_.delay_ms);
+
+    const std::string text = ReplyText();
+    const size_t chunk_size = std::max<size_t>(options_.chunk_size, 1);
+    const char* text_prefix = gemini ? "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\""
+                                     : "{\"choices\":[{\"index\":0,\"delta\":{\"content\":\"";
+    const char* text_suffix = gemini ? "\"}],\"role\":\"model\"}}]}" : "\"}}]}";
+
+    if (stream) {
+        static const char kHead[] =
+            "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+        if (!WriteAll(ssl, kHead, sizeof(kHead) - 1))
+            return false;
+
+        for (size_t pos = 0; pos < text.size(); pos += chunk_size) {
+            if (pos > 0)
+                Sleep(options_.chunk_delay_ms);
+            std::string event = "data: ";
+            event.append(text_prefix).append(text, pos, chunk_size).append(text_suffix).append("\n\n");
+            if (!WriteChunk(ssl, event))
+                return false;
+        }
+        // Gemini's stream just ends
+        if (!gemini && !WriteChunk(ssl, "data: [DONE]\n\n"))
+            return false;
+        return WriteAll(ssl, "0\r\n\r\n", 5);
+    }
+
+    std::string body;
+    if (gemini)
+        body.append(text_prefix).append(text).append(text_suffix);
+    else
+        body.append("{\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"")
+            .append(text)
+            .append("\"}}]}");
+
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                       std::to_string(body.size()) + "\r\n\r\n";
+    if (!WriteAll(ssl, head.data(), head.size()))
+        return false;
+    for (size_t pos = 0; pos < body.size(); pos += chunk_size) {
+        if (pos > 0)
+            Sleep(options_.chunk_delay_ms);
+        if (!WriteAll(ssl, body.data() + pos, std::min(chunk_size, body.size() - pos)))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef MOCK_LLM_SERVER_H
+#define MOCK_LLM_SERVER_H
+
+#include <openssl/ssl.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Local HTTPS stand-in for the LLM providers, so the client can be measured without spending
+// API quota. It answers every request in the format its path asks for: Gemini for the
+// generateContent methods, the OpenAI chat completions format of Qwen and DeepSeek otherwise,
+// streamed as server-sent events when the request accepts them. Its certificate is self-signed
+// and made at start, clients trust it through cert_file(). Request bodies are read and
+// dropped.
+class MockLlmServer {
+   public:
+    struct Options {
+        int delay_ms = 0;            // Before the response head
+        int chunk_delay_ms = 0;      // Between two chunks of the reply
+        size_t chunk_size = 64;      // Reply text per streamed event, body bytes per write otherwise
+        size_t payload_size = 2048;  // Reply text
+    };
+
+    explicit MockLlmServer(const Options& options);
+    ~MockLlmServer();
+
+    MockLlmServer(const MockLlmServer&) = delete;
+    MockLlmServer& operator=(const MockLlmServer&) = delete;
+
+    // Writes the certificate into dir and listens on a free port of 127.0.0.1, valid for the
+    // name localhost. Returns false if the server cannot run.
+    bool Start(const std::string& dir);
+    void Stop();
+
+    int port() const { return port_; }
+    // PEM certificate to trust, e.g. through SSL_CERT_FILE.
+    const std::string& cert_file() const { return cert_file_; }
+    size_t requests() const { return requests_; }
+
+   private:
+    bool CreateContext();
+    void AcceptLoop();
+    void Serve(int fd);
+
+    // Answers a request in the Gemini or the OpenAI format. Returns false once the connection
+    // is lost.
+    bool Respond(SSL* ssl, bool gemini, bool stream);
+
+    std::string ReplyText() const;
+
+    Options options_;
+    SSL_CTX* ctx_;
+    int listen_fd_;
+    int port_;
+    std::string cert_file_;
+    std::atomic<bool> stopping_;
+    std::atomic<size_t> requests_;
+    std::thread accept_thread_;
+    std::mutex connections_mutex_;
+    std::vector<int> connection_fds_;  // Shut down by Stop()
+    std::vector<std::thread> connection_threads_;
+};
+
+#endif  // MOCK_LLM_SERVER_H
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bench_measure.h"
+#include "http_request_parser.h"
+#include "legacy_request_head.h"
+
+// Throughput of the callback server's request parsing: HttpRequestParser against the strstr and
+// istringstream code it replaced (see legacy_request_head.h), and the chunked body decoder.
+// Requests come from memory in reads of a given size, as recv() would hand them over, so the
+// rows show how each parser copes with a head split across reads. Run with --help.
+
+// ClientReceiver::MAX_HEADER_SIZE
+static const size_t kMaxHeaderSize = 8192;
+
+struct ParserOptions {
+    std::vector<std::string> benches = {"head", "body"};
+    std::vector<int> read_sizes = {8192, 256, 16};
+    int iterations = 2000;
+    int body_size = 65536;  // Bytes of chunked body
+    int chunk_size = 4096;  // Bytes of body per chunk
+};
+
+static void Usage() {
+    printf(
+        "Usage: request_parser_bench [options]\n"
+        "  --bench=head,body          benchmarks to run\n"
+        "  --read-sizes=8192,256,16   bytes per read\n"
+        "  --iterations=2000          measured requests per row, after one warm-up\n"
+        "  --body-size=65536          bytes of chunked body\n"
+        "  --chunk-size=4096          bytes of body per chunk\n");
+}
+
+static std::vector<std::string> SplitList(const char* value) {
+    std::vector<std::string> items;
+    std::string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos)
+            comma = list.size();
+        if (comma > start)
+            items.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+static bool ParseOptions(int argc, char* argv[], ParserOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        std::string name = eq ? std::string(arg, eq - arg) : std::string(arg);
+        const char* value = eq ? eq + 1 : "";
+
+        if (name == "--bench") {
+            options.benches = SplitList(value);
+        } else if (name == "--read-sizes") {
+            options.read_sizes.clear();
+            for (const std::string& item : SplitList(value))
+                options.read_sizes.push_back(std::max(1, atoi(item.c_str())));
+        } else if (name == "--iterations") {
+            options.iterations = std::max(1, atoi(value));
+        } else if (name == "--body-size") {
+            options.body_size = std::max(1, atoi(value));
+        } else if (name == "--chunk-size") {
+            options.chunk_size = std::max(1, atoi(value));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Head of an ASR text callback as the speech service sends it, followed by extra headers of
+// header_size bytes each (proxies and tracing add those) up to at least size bytes.
+static std::string MakeHead(size_t size, size_t header_size) {
+    std::string head =
+        "POST /upload/text HTTP/1.1\r\n"
+        "Host: 192.168.1.20:8080\r\n"
+        "User-Agent: asr-service/2.3\r\n"
+        "Accept: */*\r\n"
+        "Content-Type: text/plain; charset=utf-8\r\n";
+    for (int i = 0; head.size() + 40 < size; i++) {
+        std::string name = "X-Trace-" + std::to_string(i) + ": ";
+        head += name + std::string(std::max(header_size, name.size() + 3) - name.size() - 2, 'a') + "\r\n";
+    }
+    head += "Content-Length: 1024\r\n\r\n";
+    return head;
+}
+
+static void PrintRow(const char* bench,
+                     const std::string& subject,
+                     const char* implementation,
+                     size_t bytes,
+                     const Measurement& measurement) {
+    printf("%-6s %-12s %-7s %8zu %10.2f %9.1f %10.1f %9.1f\n", bench, subject.c_str(), implementation, bytes,
+           measurement.us, bytes / measurement.us, measurement.allocations, measurement.allocated_kib);
+}
+
+// Reading and parsing a head that arrives in reads of read_size bytes. The old code searched the
+// whole buffer after every read and parsed a copy of the head; the parser takes each line once
+// and points into the receive buffer.
+static void BenchHead(const ParserOptions& options) {
+    struct Input {
+        const char* name;
+        std::string head;
+    };
+    const Input inputs[] = {
+        {"small", MakeHead(0, 0)},
+        {"large", MakeHead(4096, 160)},
+    };
+
+    for (const Input& input : inputs) {
+        const std::string& head = input.head;
+        for (int read_size : options.read_sizes) {
+            const std::string subject = std::string(input.name) + "/" + std::to_string(read_size);
+
+            // Buffers live as long as the receiver, as receive_buffer_ and Connection::head did
+            std::vector<char> buffer(kMaxHeaderSize + 1);
+            Measurement legacy = Measure(options.iterations, [&]() {
+                size_t received = 0;
+                size_t head_size = 0;
+                while (received < head.size() && head_size == 0) {
+                    size_t n = std::min(static_cast<size_t>(read_size), head.size() - received);
+                    memcpy(&buffer[received], head.data() + received, n);
+                    received += n;
+                    head_size = LegacyFindHeadEnd(buffer, received);
+                }
+
+                std::string headers(buffer.begin(), buffer.begin() + head_size - 4);
+                LegacyRequestInfo info;
+                if (LegacyParseHeaders(headers, info) < 0)
+                    return static_cast<size_t>(0);
+                return head_size + info.content_length;
+            });
+            PrintRow("head", subject, "legacy", head.size(), legacy);
+
+            HttpRequestParser parser;
+            Measurement current = Measure(options.iterations, [&]() {
+                parser.Reset();
+                size_t received = 0;
+                long head_size = 0;
+                while (received < head.size() && head_size == 0) {
+                    size_t n = std::min(static_cast<size_t>(read_size), head.size() - received);
+                    memcpy(&buffer[received], head.data() + received, n);
+                    received += n;
+                    head_size = parser.ParseHead(buffer.data(), received);
+                }
+                if (head_size <= 0 || !parser.method().Equals("POST"))
+                    return static_cast<size_t>(0);
+                return static_cast<size_t>(head_size + parser.content_length());
+            });
+            PrintRow("head", subject, "current", head.size(), current);
+        }
+    }
+}
+
+// Chunked body framing of body_size bytes in chunk_size chunks, with an extension and a
+// trailer as curl may send them.
+static std::string MakeChunkedBody(size_t body_size, size_t chunk_size) {
+    std::string body;
+    for (size_t sent = 0; sent < body_size; sent += chunk_size) {
+        size_t n = std::min(chunk_size, body_size - sent);
+        char size_line[32];
+        snprintf(size_line, sizeof(size_line), "%zx;ext=1\r\n", n);
+        body += size_line;
+        body.append(n, 'b');
+        body += "\r\n";
+    }
+    body += "0\r\nX-Checksum: 0\r\n\r\n";
+    return body;
+}
+
+// Decoding a chunked body in reads of read_size bytes, as ClientReceiver::ReceiveBody does.
+// The old code had no chunked support, so there is no legacy row.
+static void BenchBody(const ParserOptions& options) {
+    const std::string head = "POST /upload/audio HTTP/1.1\r\nHost: 192.168.1.20:8080\r\n"
+                             "Transfer-Encoding: chunked\r\n\r\n";
+    const std::string body = MakeChunkedBody(options.body_size, options.chunk_size);
+
+    for (int read_size : options.read_sizes) {
+        HttpRequestParser parser;
+        Measurement current = Measure(options.iterations, [&]() {
+            parser.Reset();
+            if (parser.ParseHead(head.data(), head.size()) <= 0)
+                return static_cast<size_t>(0);
+
+            size_t content = 0;
+            for (size_t pos = 0; pos < body.size() && !parser.done(); pos += read_size) {
+                const char* data = body.data() + pos;
+                size_t len = std::min(static_cast<size_t>(read_size), body.size() - pos);
+                while (len > 0 && !parser.done()) {
+                    ByteView payload;
+                    long used = parser.DecodeBody(data, len, payload);
+                    if (used < 0)
+                        return static_cast<size_t>(0);
+                    content += payload.size;
+                    data += used;
+                    len -= used;
+                }
+            }
+            return parser.done() ? content : 0;
+        });
+        PrintRow("body", "chunked/" + std::to_string(read_size), "current", body.size(), current);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ParserOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        Usage();
+        return 2;
+    }
+
+    printf("%d iterations, case is input/bytes per read\n", options.iterations);
+    printf("%-6s %-12s %-7s %8s %10s %9s %10s %9s\n", "bench", "case", "impl", "bytes", "us/op", "MB/s",
+           "allocs/op", "alloc_kb");
+    for (const std::string& bench : options.benches) {
+        if (bench == "head") {
+            BenchHead(options);
+        } else if (bench == "body") {
+            BenchBody(options);
+        } else {
+            fprintf(stderr, "Unknown benchmark %s\n", bench.c_str());
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+# 回调服务器请求解析的微基准：HttpRequestParser 与旧的 strstr/istringstream 实现对比，不需要网络
+# 用法：qmake bench/request_parser_bench.pro && make && ./build/request_parser_bench --help
+
+TEMPLATE = app
+TARGET = request_parser_bench
+
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+# 与主程序一致，Cortex-A7 上启用 NEON
+contains(QT_ARCH, arm): QMAKE_CXXFLAGS += -mfpu=neon-vfpv4
+
+SOURCES += \
+    bench_measure.cpp \
+    legacy_request_head.cpp \
+    request_parser_bench.cpp
+
+HEADERS += \
+    bench_measure.h \
+    legacy_request_head.h
+
+# 被测的客户端源码
+SOURCES += \
+    $$PWD/../src/http_request_parser.cpp
+
+# 包含目录设置
+INCLUDEPATH += $$PWD/../include
+
+# 构建目录设置
+DESTDIR = build
+OBJECTS_DIR = build/obj
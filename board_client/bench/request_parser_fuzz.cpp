@@ -0,0 +1,195 @@
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "http_request_parser.h"
+
+// Fuzz target for HttpRequestParser::ParseHead/DecodeBody. An input is the bytes a client sends
+// on one connection. It is fed the way ClientReceiver does, once in a single read and once each
+// in reads of 1 and 7 bytes, and every run has to give the same head and body: splitting a
+// request differently must not change how it is parsed. Views and consumed sizes have to stay
+// inside the buffers they were handed, and the body decoder has to make progress. Any violation
+// aborts. Seeds are in fuzz_corpus/request_parser.
+//
+// Built with CONFIG+=libfuzzer this is a libFuzzer target; otherwise it has a main() that runs
+// the files and directories given on the command line once, which is how the corpus is checked
+// without clang.
+
+// ClientReceiver::MAX_HEADER_SIZE
+static const size_t kMaxHeaderSize = 8192;
+
+#define FUZZ_CHECK(condition)                                                               \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort();                                                                        \
+        }                                                                                   \
+    } while (0)
+
+// What a connection made of the input.
+struct ParseResult {
+    long head_size = 0;  // -1 for a malformed head, 0 if it never completed
+    int error_status = 0;
+    size_t header_count = 0;
+    long content_length = -1;
+    bool chunked = false;
+    bool body_failed = false;
+    bool done = false;
+    std::string body;
+
+    bool operator==(const ParseResult& other) const {
+        return head_size == other.head_size && error_status == other.error_status &&
+               header_count == other.header_count && content_length == other.content_length &&
+               chunked == other.chunked && body_failed == other.body_failed && done == other.done &&
+               body == other.body;
+    }
+};
+
+static bool Inside(const ByteView& view, const char* begin, const char* end) {
+    return view.size == 0 || (view.data >= begin && view.data + view.size <= end);
+}
+
+static void CheckHead(const HttpRequestParser& parser, const char* buf, long head_size) {
+    const char* end = buf + head_size;
+    FUZZ_CHECK(Inside(parser.method(), buf, end));
+    FUZZ_CHECK(Inside(parser.target(), buf, end));
+    FUZZ_CHECK(Inside(parser.version(), buf, end));
+    FUZZ_CHECK(parser.header_count() <= HttpRequestParser::MAX_HEADERS);
+    for (size_t i = 0; i < parser.header_count(); i++) {
+        FUZZ_CHECK(Inside(parser.headers()[i].name, buf, end));
+        FUZZ_CHECK(Inside(parser.headers()[i].value, buf, end));
+    }
+}
+
+// Feeds data[0, len) to ClientReceiver::ReceiveBody's loop. Returns false once decoding fails.
+static bool FeedBody(HttpRequestParser& parser, const char* data, size_t len, ParseResult& result) {
+    while (len > 0 && !parser.done()) {
+        const size_t body_bytes = parser.body_bytes();
+        ByteView payload;
+        long used = parser.DecodeBody(data, len, payload);
+        if (used < 0) {
+            FUZZ_CHECK(parser.failed());
+            return false;
+        }
+        FUZZ_CHECK(used > 0 || parser.done());
+        FUZZ_CHECK(static_cast<size_t>(used) <= len);
+        FUZZ_CHECK(Inside(payload, data, data + used));
+        FUZZ_CHECK(parser.body_bytes() == body_bytes + payload.size);
+        result.body.append(payload.data, payload.size);
+        data += used;
+        len -= used;
+    }
+    return true;
+}
+
+// Runs the input through one parser in reads of read_size bytes: the head into a buffer that
+// grows read by read, the bytes after it through DecodeBody.
+static ParseResult Parse(const char* data, size_t size, size_t read_size) {
+    ParseResult result;
+    HttpRequestParser parser;
+
+    // Like Connection::head, the buffer stays in place while the head comes in
+    std::vector<char> head(std::min(size, kMaxHeaderSize));
+    size_t received = 0;
+    while (received < head.size() && result.head_size == 0) {
+        size_t n = std::min(read_size, head.size() - received);
+        memcpy(&head[received], data + received, n);
+        received += n;
+        result.head_size = parser.ParseHead(head.data(), received);
+        FUZZ_CHECK(result.head_size <= static_cast<long>(received));
+    }
+    if (result.head_size < 0) {
+        FUZZ_CHECK(parser.failed() && parser.error_status() >= 400);
+        result.error_status = parser.error_status();
+        return result;
+    }
+    if (result.head_size == 0)
+        return result;
+
+    FUZZ_CHECK(parser.headers_complete());
+    CheckHead(parser, head.data(), result.head_size);
+    result.header_count = parser.header_count();
+    result.content_length = parser.content_length();
+    result.chunked = parser.chunked();
+
+    // The rest of the last read first, then reads straight from the input
+    size_t pos = result.head_size;
+    size_t end = received;
+    while (pos < size && !result.body_failed && !parser.done()) {
+        if (!FeedBody(parser, data + pos, end - pos, result))
+            result.body_failed = true;
+        pos = end;
+        end = std::min(size, pos + read_size);
+    }
+    result.done = parser.done();
+    // Without framing there is no body
+    if (result.done && !result.chunked)
+        FUZZ_CHECK(static_cast<long>(result.body.size()) == std::max(result.content_length, 0L));
+    return result;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    const char* input = reinterpret_cast<const char*>(data);
+    ParseResult whole = Parse(input, size, kMaxHeaderSize);
+    FUZZ_CHECK(Parse(input, size, 1) == whole);
+    FUZZ_CHECK(Parse(input, size, 7) == whole);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+static bool RunFile(const std::string& path) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string input = contents.str();
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: request_parser_fuzz FILE_OR_DIR...\n");
+        return 2;
+    }
+
+    int inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        struct stat path_stat;
+        if (stat(argv[i], &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+            DIR* dir = opendir(argv[i]);
+            if (!dir) {
+                perror("opendir() failed");
+                return 1;
+            }
+            while (struct dirent* entry = readdir(dir)) {
+                if (entry->d_name[0] == '.')
+                    continue;
+                if (!RunFile(std::string(argv[i]) + "/" + entry->d_name))
+                    return 1;
+                inputs++;
+            }
+            closedir(dir);
+        } else {
+            if (!RunFile(argv[i]))
+                return 1;
+            inputs++;
+        }
+    }
+    printf("%d inputs passed\n", inputs);
+    return 0;
+}
+
+#endif  // LIBFUZZER
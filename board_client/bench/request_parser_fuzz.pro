@@ -0,0 +1,37 @@
+# HttpRequestParser 的模糊测试目标，种子语料在 fuzz_corpus/request_parser
+# 用法：qmake bench/request_parser_fuzz.pro && make && ./build/request_parser_fuzz fuzz_corpus/request_parser
+# libFuzzer：qmake CONFIG+=libfuzzer bench/request_parser_fuzz.pro && make &&
+#            ./build/request_parser_fuzz -max_len=16384 corpus_dir fuzz_corpus/request_parser
+
+TEMPLATE = app
+TARGET = request_parser_fuzz
+
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+# 不带 libFuzzer 时也用 AddressSanitizer 检查越界
+QMAKE_CXXFLAGS += -g -fsanitize=address,undefined -fno-omit-frame-pointer
+QMAKE_LFLAGS += -fsanitize=address,undefined
+
+libfuzzer {
+    QMAKE_CC = clang
+    QMAKE_CXX = clang++
+    QMAKE_LINK = clang++
+    DEFINES += LIBFUZZER
+    QMAKE_CXXFLAGS += -fsanitize=fuzzer
+    QMAKE_LFLAGS += -fsanitize=fuzzer
+}
+
+SOURCES += \
+    request_parser_fuzz.cpp
+
+# 被测的客户端源码
+SOURCES += \
+    $$PWD/../src/http_request_parser.cpp
+
+# 包含目录设置
+INCLUDEPATH += $$PWD/../include
+
+# 构建目录设置
+DESTDIR = build
+OBJECTS_DIR = build/obj
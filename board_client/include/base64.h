@@ -0,0 +1,37 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <stddef.h>
+
+// Standard base64 (RFC 4648, with padding). The bulk of the input is encoded 48 bytes at a
+// time with NEON on ARM, everything else goes through a scalar loop.
+
+// Exact length of the encoding of len bytes.
+inline size_t Base64EncodedSize(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+// Encodes len bytes to out, which must hold Base64EncodedSize(len) bytes. No terminator is
+// written. Returns the number of characters written.
+size_t Base64Encode(const unsigned char* data, size_t len, char* out);
+
+// Encodes input that arrives in pieces of any size. Up to two bytes that do not complete a
+// group are carried into the next Update(); Finish() pads them out.
+class Base64Encoder {
+   public:
+    Base64Encoder() : carry_len_(0) {}
+
+    // Output space needed by Update(len).
+    static size_t MaxOutputSize(size_t len) { return Base64EncodedSize(len + 2); }
+
+    size_t Update(const unsigned char* data, size_t len, char* out);
+
+    // Writes at most 4 characters.
+    size_t Finish(char* out);
+
+   private:
+    unsigned char carry_[3];
+    size_t carry_len_;
+};
+
+#endif  // BASE64_H
@@ -1,3 +1,4 @@
+#include <functional>
 #include <string>
 
 #include "sqlite3.h"
@@ -9,6 +10,8 @@ class ChatRecordDB {
     sqlite3* db_;
     std::string db_path_;
 
+    static void NotifyChanged(int conversation_id);
+
    public:
     struct Message {
         uint id;
@@ -25,6 +28,12 @@ class ChatRecordDB {
         time_t updated_at;
     };
 
+    // Called with the id of a conversation whose stored messages were deleted. Listeners are
+    // process wide since the window and the conversation thread open the database separately.
+    typedef std::function<void(int conversation_id)> ChangeListener;
+
+    static void AddChangeListener(ChangeListener listener);
+
     ChatRecordDB() = default;
     ChatRecordDB(std::string db_path);
 
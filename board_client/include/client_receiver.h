@@ -1,52 +1,148 @@
 #ifndef CLIENT_SRECEIVER_H
 #define CLIENT_SRECEIVER_H
 
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "http_request_parser.h"
+#include "upload_sink.h"
+
+// HTTP server for the callbacks of the speech backend. One thread serves every connection
+// with epoll: requests are read as their bytes arrive and a completed one is dispatched to
+// the route registered for its path, so a slow or stray client does not hold up the others.
+// Buffers are bounded per connection, at most MAX_CONNECTIONS are open at a time (the rest
+// wait in the listen backlog) and connections idle for IDLE_TIMEOUT_SEC are closed. Every
+// response closes its connection.
 class ClientReceiver {
    public:
     static constexpr int MAX_PENDING_CONNECTIONS = 10;
+    static constexpr size_t MAX_CONNECTIONS = 16;
+    static constexpr int IDLE_TIMEOUT_SEC = 10;
     static constexpr size_t RECEIVE_BUFFER_SIZE = 16384;
+    static constexpr size_t SPLICE_CHUNK_SIZE = 65536;  // Default capacity of a pipe
     static constexpr size_t MAX_HEADER_SIZE = 8192;
     static constexpr size_t MAX_ERROR_MSG = 512;
     static constexpr long MAX_AUDIO_SIZE = 10 * 1024 * 1024;
     static constexpr long MAX_TEXT_SIZE = 1 * 1024 * 1024;
 
+    // Called on the server thread with the body of a memory route, the file of a file route
+    // or nothing for a sink route, once the request is complete. A request the route took that
+    // fails instead (refused by the sink, too large, malformed or cut short) gets ok false and
+    // nothing. It must not block for long.
+    typedef std::function<void(bool ok, const std::string& result)> RouteHandler;
+
     ClientReceiver() = default;
     ClientReceiver(int port);
     ~ClientReceiver();
 
-    std::string HandleRequest(const std::string& file_path);
+    ClientReceiver(const ClientReceiver&) = delete;
+    ClientReceiver& operator=(const ClientReceiver&) = delete;
+
+    // Routes have to be added before Start(). Bodies larger than max_size are refused with
+    // 413. AddRoute() collects the body in memory, AddFileRoute() writes it to file_path and
+    // refuses a second upload while one is in progress. A file upload with a Content-Length
+    // is preallocated and moved from the socket to the file with splice(), without passing
+    // through user space; its throughput and CPU time are printed when it is complete.
+    void AddRoute(const std::string& path, long max_size, RouteHandler handler);
+    void AddFileRoute(const std::string& path, const std::string& file_path, long max_size, RouteHandler handler);
+    // Delivers the body to sink as it arrives, which has to outlive the receiver. An upload
+    // the sink refuses gets 500, one it has no room for 413.
+    void AddSinkRoute(const std::string& path, UploadSink* sink, long max_size, RouteHandler handler);
+
+    // Starts serving on a thread of its own. Returns false if the server cannot run.
+    bool Start();
 
    private:
-    struct RequestInfo {
-        std::string method;
-        std::string uri;
-        std::string version;
-        long content_length = 0;
-        size_t header_len = 0;
-        size_t body_start_offset = 0;
-        size_t initial_body = 0;
+    struct Route {
+        std::string file_path;  // Empty for a memory route
+        UploadSink* sink;  // Set for a sink route
+        long max_size;
+        RouteHandler handler;
+        bool writing;  // A file route takes one upload at a time
     };
 
-    int SendAll(int sockfd, const char* buf, size_t len);
+    // Per-connection state, a connection moves from reading the head to reading the body to
+    // writing the response. After that, what the client still sends is read and dropped until
+    // it closes: closing with unread data would reset the connection and lose the response.
+    struct Connection {
+        enum State { READING_HEAD, READING_BODY, WRITING_RESPONSE, DRAINING };
+
+        int fd = -1;
+        State state = READING_HEAD;
+        std::vector<char> head;  // Up to MAX_HEADER_SIZE bytes, the parser points into it
+        size_t head_len = 0;
+        HttpRequestParser parser;
+        Route* route = nullptr;
+        std::string body;  // Memory routes
+        UploadSink* sink = nullptr;  // Sink routes, until the sink has the whole body
+        int file_fd = -1;  // File routes
+        int pipe_fds[2] = {-1, -1};  // Open while the body is spliced into the file
+        std::chrono::steady_clock::time_point upload_start;
+        int64_t upload_cpu_start_us = 0;
+        size_t spliced = 0;
+        std::string response;
+        size_t response_sent = 0;
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    static std::string ErrorResponse(int code, const std::string& message);
+
+    void Loop();
+
+    void Accept();
+
+    // Handles readiness of a connection. Returns false once it can be closed.
+    bool OnReadable(Connection& conn);
+    bool OnWritable(Connection& conn);
+
+    // Picks the route for the parsed head of conn, whose first head_size bytes it took.
+    void StartRequest(Connection& conn, size_t head_size);
+
+    // Opens the file of a file route, sized for the body when its length is known.
+    bool OpenUploadFile(Connection& conn);
+
+    // Takes body bytes as received, dispatches the request once the body is complete.
+    void ReceiveBody(Connection& conn, const char* data, size_t len);
+
+    // Moves what the socket has of the body into the file through the pipe. Returns false
+    // once the connection can be closed.
+    bool SpliceBody(Connection& conn);
+
+    // Writes the n bytes in the pipe to the file.
+    bool FlushPipe(Connection& conn, size_t n);
+
+    void FinishRequest(Connection& conn);
 
-    void SendErrorResponse(int sockfd, int code, const std::string& message);
+    // Hands decoded body content to the route. Returns false once the request failed.
+    bool StoreBody(Connection& conn, const ByteView& payload);
 
-    int ParseHeaders(const std::string& headers, RequestInfo& info);
+    // Queues response on conn, written once the socket takes it. A request still in progress
+    // failed and is discarded.
+    void Respond(Connection& conn, const std::string& response);
 
-    int ReceiveHeaders(int sockfd_, RequestInfo& info);
+    // Ends a request its route took that did not complete: closes and removes the file or
+    // aborts the sink, so the route takes the next upload, and tells the route's handler.
+    void DiscardUpload(Connection& conn);
 
-    void HandleAudioUpload(int sockfd,
-                           const RequestInfo& info,
-                           const std::string& file_path,
-                           long long max_size);
+    void CloseConnection(int fd);
 
-    std::string HandleTextRequest(int sockfd, RequestInfo& info, size_t max_size);
+    // Stops reading the listen socket while all connections are taken, resumes after.
+    void UpdateListening();
 
-    int listen_socket_;
-    std::vector<char> receive_buffer_;
+    int listen_socket_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;  // eventfd that stops the loop
+    bool listening_ = false;
+    std::map<std::string, Route> routes_;
+    std::map<int, std::unique_ptr<Connection>> connections_;
+    std::vector<char> receive_buffer_;  // Shared by all connections, the loop reads one at a time
+    std::thread thread_;
 };
 
 #endif  // CLIENT_SRECEIVER_H
@@ -1,18 +1,41 @@
 #ifndef CLIENT_SENDER_H
 #define CLIENT_SENDER_H
 
+#include <time.h>
 #include <string>
 
 class ClientSender {
    private:
     static const size_t SEND_BUFFER_SIZE = 8192;
+    static constexpr int WARM_TIMEOUT_SEC = 30;  // An unused pre-opened connection is dropped after this
+    static constexpr int WARM_CONNECT_WAIT_MS = 1000;  // Then a connect still in flight is given up
 
     std::string ip_address_;
     int port_;
+    int warm_fd_ = -1;  // Connection opened by Prewarm(), maybe still connecting
+    time_t warm_since_ = 0;
+
+    // Returns the pre-opened connection if it is still usable, otherwise connects. -1 on error.
+    int Connect();
+
+    void CloseWarm();
 
    public:
     ClientSender() = default;
     ClientSender(const std::string& ip_address, int port);
+    ~ClientSender();
+
+    ClientSender(const ClientSender&) = delete;
+    ClientSender& operator=(const ClientSender&) = delete;
+
+    // Starts connecting to the server without waiting for it, so that the next send finds the
+    // TCP handshake done. Each send uses up one connection.
+    void Prewarm();
+
+    // Closes the pre-opened connection once it is WARM_TIMEOUT_SEC old. Returns the
+    // milliseconds until that is due, or -1 when there is none, as a poll() timeout for the
+    // caller's loop.
+    int CloseExpired();
 
     int AudioSend(const std::string& wav_file_path, const std::string& request_path);
     int LlmReponseSend(const std::string& text_to_send, const std::string& request_path);
@@ -0,0 +1,72 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <zlib.h>
+#include <functional>
+#include <string>
+
+// Gzip compresses a body into a buffer that is reused across bodies. The zlib state is kept
+// as well, a new body only resets it.
+class GzipCompressor {
+   public:
+    GzipCompressor() : initialized_(false), level_(0) {}
+    ~GzipCompressor();
+
+    GzipCompressor(const GzipCompressor&) = delete;
+    GzipCompressor& operator=(const GzipCompressor&) = delete;
+
+    // Starts a new body at zlib level 1 (fastest) to 9 (smallest). Returns false if zlib
+    // cannot be initialized.
+    bool Reset(int level);
+
+    void Update(const char* data, size_t len);
+
+    void Finish();
+
+    const std::string& output() const { return output_; }
+
+   private:
+    void Deflate(const char* data, size_t len, int flush);
+
+    z_stream stream_;
+    bool initialized_;
+    int level_;
+    std::string output_;
+};
+
+// Streaming decoder of a gzip or deflate Content-Encoding. Output is passed on as soon as zlib
+// produces it, so compressed event streams are not held back.
+class Inflater {
+   public:
+    enum Format {
+        FORMAT_GZIP,
+        FORMAT_DEFLATE  // zlib wrapped, or raw deflate as sent by some servers
+    };
+
+    typedef std::function<void(const char* data, size_t len)> OutputCallback;
+
+    explicit Inflater(OutputCallback output) : output_(output), initialized_(false) {}
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    // Starts a new stream. Returns false if zlib cannot be initialized.
+    bool Reset(Format format);
+
+    // Returns false on corrupt data. Input after the end of the stream is ignored.
+    bool Feed(const char* data, size_t len);
+
+    bool finished() const { return finished_; }
+
+   private:
+    static constexpr size_t OUTPUT_CHUNK_SIZE = 16 * 1024;
+
+    OutputCallback output_;
+    z_stream stream_;
+    bool initialized_;
+    bool finished_;
+    bool raw_fallback_;  // Deflate may still turn out to be raw, without the zlib header
+};
+
+#endif  // COMPRESSION_H
@@ -0,0 +1,173 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "deadline.h"
+#include "dns_resolver.h"
+#include "https_connection.h"
+#include "tls_session_cache.h"
+
+// Keeps established HTTPS connections (and proxy tunnels) open between requests so that
+// the TCP connect, proxy CONNECT and TLS handshake are only paid once per host. A tunnel lives
+// as long as the TLS connection inside it; one the proxy or the server closed is noticed by
+// HttpsConnection::IsAlive() and replaced on the next Acquire().
+//
+// An HTTP/1.1 connection serves one caller at a time and waits on the idle list in between.
+// An HTTP/2 one is shared instead: every caller for its host gets the same connection and
+// runs its request as another stream of the session, as long as the server takes more.
+class ConnectionPool {
+   public:
+    static constexpr int DEFAULT_IDLE_TIMEOUT_SEC = 30;
+    static constexpr size_t MAX_IDLE_PER_KEY = 2;
+    static constexpr int CONNECT_STAGGER_MS = 250;  // Delay before racing the next address
+    static constexpr size_t MAX_PROXY_RESPONSE_SIZE = 8192;
+    static constexpr int CANCEL_POLL_MS = 100;  // While waiting for another caller's connection
+
+    explicit ConnectionPool(int idle_timeout_sec = DEFAULT_IDLE_TIMEOUT_SEC);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Returns the shared HTTP/2 connection or a live idle one for host:port if there is one,
+    // otherwise opens a new one. With HTTP/2 on, callers that come while another one opens a
+    // connection to the host wait for it, and share it if the server took HTTP/2.
+    // Throws LlmError when a new connection cannot be established, at the latest by deadline
+    // or by the connect and handshake timeouts.
+    // When early data is enabled and a new connection resumes a session that allows it, the
+    // start of the request buffers is sent as TLS 1.3 early data; see HttpsConnection::early_data().
+    // Cancelling cancel_fd (see IsCancelled()) interrupts the DNS lookup, connect, proxy CONNECT
+    // and handshake of a new connection with LlmError::CANCELLED.
+    std::shared_ptr<HttpsConnection> Acquire(const std::string& host,
+                                             int port,
+                                             bool use_proxy,
+                                             const std::vector<struct iovec>* request = nullptr,
+                                             Deadline deadline = Deadline::max(),
+                                             int cancel_fd = -1);
+
+    // Always opens a new connection, bypassing the idle list and the shared connection. A new
+    // HTTP/2 connection becomes the shared one of its host unless that is still usable.
+    std::shared_ptr<HttpsConnection> Connect(const std::string& host,
+                                             int port,
+                                             bool use_proxy,
+                                             const std::vector<struct iovec>* request = nullptr,
+                                             Deadline deadline = Deadline::max(),
+                                             int cancel_fd = -1);
+
+    // Opens a connection to host:port and leaves it idle (or shared) for the next Acquire(),
+    // unless there is one already. It does not count as reused: the first request on it
+    // reports its setup timings and is not replayed. An unused one is evicted with the other
+    // idle connections.
+    // Returns whether it opened one, throws like Connect().
+    bool Prewarm(const std::string& host, int port, bool use_proxy);
+
+    // Hands a connection whose last response was fully read back to the pool. An HTTP/2 one
+    // stays shared while usable, whoever else still has streams on it; one that is not is
+    // dropped once the last of them is done.
+    void Release(std::shared_ptr<HttpsConnection> conn);
+
+    // Closes idle connections, and shared ones without streams, older than the idle timeout.
+    void EvictIdle();
+
+    void Clear();
+
+    TlsSessionCache& session_cache() { return session_cache_; }
+
+    // Early data can be replayed by an attacker, only enable it for requests where a
+    // duplicate costs nothing more than tokens.
+    void set_early_data(bool enabled) { early_data_enabled_ = enabled; }
+
+    // Offers HTTP/2 through ALPN. Connections the server accepts it on get an Http2Session,
+    // the others stay HTTP/1.1.
+    void set_http2(bool enabled) { http2_enabled_ = enabled; }
+
+    // Only connect_ms and handshake_ms are used here.
+    void set_timeouts(const RequestTimeouts& timeouts) { timeouts_ = timeouts; }
+
+    size_t handshake_count() const { return full_handshake_count_ + resumed_handshake_count_; }
+    size_t full_handshake_count() const { return full_handshake_count_; }
+    size_t resumed_handshake_count() const { return resumed_handshake_count_; }
+    size_t early_data_count() const { return early_data_count_; }
+    size_t reuse_count() const { return reuse_count_; }
+    size_t prewarm_count() const { return prewarm_count_; }
+    // CONNECT exchanges with the proxy, and requests that reused an open tunnel instead.
+    size_t tunnel_count() const { return tunnel_count_; }
+    size_t tunnel_reuse_count() const { return tunnel_reuse_count_; }
+    // CPU time the handshakes took, without the time spent waiting for the server.
+    double handshake_cpu_ms() const { return handshake_cpu_us_ / 1000.0; }
+
+   private:
+    static std::string MakeKey(const std::string& host, int port, bool use_proxy);
+
+    // Puts conn on the idle list of its key.
+    void AddIdle(std::shared_ptr<HttpsConnection> conn);
+
+    // Makes the HTTP/2 connection conn the shared one of its key if there is no usable one.
+    void ShareLocked(const std::shared_ptr<HttpsConnection>& conn);
+
+    // The shared connection of key, or else a live idle one, or nullptr.
+    std::shared_ptr<HttpsConnection> TakeLocked(const std::string& key, bool use_proxy);
+
+    // Connect() for a key the caller added to connecting_, which wakes the callers waiting
+    // for it however it ends.
+    std::shared_ptr<HttpsConnection> ConnectAnnounced(const std::string& key,
+                                                      const std::string& host,
+                                                      int port,
+                                                      bool use_proxy,
+                                                      const std::vector<struct iovec>* request,
+                                                      Deadline deadline,
+                                                      int cancel_fd);
+
+    // Both fill in the DNS, connect and proxy phases of timings.
+    int ConnectDirect(const std::string& host, int port, Deadline deadline, int cancel_fd, RequestTimings& timings);
+
+    int ConnectViaProxy(const std::string& host, int port, Deadline deadline, int cancel_fd, RequestTimings& timings);
+
+    // Asks the proxy for a tunnel to host:port over sockfd. Throws LlmError if it refuses.
+    static void OpenTunnel(int sockfd, const std::string& host, int port, Deadline deadline, int cancel_fd);
+
+    // Connects to the first address that answers, starting a new attempt every
+    // CONNECT_STAGGER_MS (or as soon as one fails). Returns a non-blocking socket, or -1 with
+    // timed_out telling whether the deadline passed. Gives up as well once cancel_fd is
+    // cancelled.
+    static int ConnectRacing(const std::vector<ResolvedAddress>& addresses,
+                             int port,
+                             Deadline deadline,
+                             int cancel_fd,
+                             std::string& error,
+                             bool& timed_out);
+
+    void EvictIdleLocked(time_t now);
+
+    TlsSessionCache session_cache_;
+    bool early_data_enabled_ = false;
+    bool http2_enabled_ = false;
+    RequestTimeouts timeouts_;
+    int idle_timeout_sec_;
+    std::map<std::string, std::vector<std::shared_ptr<HttpsConnection>>> idle_;  // HTTP/1.1
+    std::map<std::string, std::shared_ptr<HttpsConnection>> shared_;             // HTTP/2
+    std::set<std::string> connecting_;  // Keys a connection that may become shared is opened for
+    std::condition_variable connected_;
+    std::mutex mutex_;
+
+    std::atomic<size_t> full_handshake_count_;
+    std::atomic<size_t> resumed_handshake_count_;
+    std::atomic<size_t> early_data_count_;
+    std::atomic<size_t> reuse_count_;
+    std::atomic<size_t> prewarm_count_;
+    std::atomic<size_t> tunnel_count_;
+    std::atomic<size_t> tunnel_reuse_count_;
+    std::atomic<int64_t> handshake_cpu_us_;
+};
+
+#endif  // CONNECTION_POOL_H
@@ -1,11 +1,17 @@
 #include <QObject>
 #include <QThread>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
 
 #include "chat_record.h"
 #include "client_receiver.h"
 #include "client_sender.h"
 #include "llm.h"
+#include "llm_router.h"
+#include "response_cache.h"
 
 #ifndef CONVERSATION_HANDLER_H
 #define CONVERSATION_HANDLER_H
@@ -13,15 +19,45 @@
 class ConversationHandler : public QThread {
     Q_OBJECT
 
+    static constexpr int KEY_POLL_MS = 50;  // How often the key is checked while waiting for a reply
+    static constexpr int CALLBACK_TIMEOUT_SEC = 60;  // Longest wait for the speech backend
+
     int key_fd_;
-    LLM* llm_;
+    LlmRouter* router_;
     ClientSender* sender_;
     ClientReceiver* receiver_;
+    BufferSink* tts_audio_;  // The synthesized reply, kept in memory for playback
     ChatRecordDB* chat_record_db_;
+    ResponseCache* response_cache_;
     int current_conversation_id_ = -1;
 
     bool has_image_ = false;
 
+    struct Callback {
+        bool ok;
+        std::string result;
+    };
+
+    // Results of the backend's callbacks by path, filled on the receiver thread
+    std::map<std::string, std::deque<Callback>> callbacks_;
+    std::mutex callbacks_mutex_;
+    std::condition_variable callbacks_cv_;
+
+    void PostCallback(const std::string& path, bool ok, const std::string& result);
+    // Drops what a turn that was cut short left for path.
+    void ClearCallbacks(const std::string& path);
+    // Blocks until the backend has called path and stores what it delivered in result.
+    // Returns false if that request failed, if the backend did not call within
+    // CALLBACK_TIMEOUT_SEC, or as soon as the key is pressed to ask again, which sets
+    // key_pressed.
+    bool WaitForCallback(const std::string& path, std::string& result, bool& key_pressed);
+
+    // Connects to the speech backend and the conversation's LLM while the question is recorded.
+    void Prewarm();
+
+    // Records the next question until the key is released.
+    void StartRecording(FILE*& arecord_pipe);
+
    public:
     ConversationHandler(std::string db_path);
     ~ConversationHandler();
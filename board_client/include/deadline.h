@@ -0,0 +1,30 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <chrono>
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Time budgets, in milliseconds, of the phases of a request. Every phase is also cut short by
+// the deadline of the whole request.
+struct RequestTimeouts {
+    int connect_ms = 5000;      // TCP connect, including the CONNECT through the proxy
+    int handshake_ms = 5000;    // TLS handshake
+    int first_byte_ms = 60000;  // From sending the request to the first byte of the response
+    int body_ms = 30000;        // Longest silence while the rest of the response is read
+    int total_ms = 180000;
+};
+
+// Returns now + ms, or limit if that is earlier.
+Deadline DeadlineIn(int ms, Deadline limit = Deadline::max());
+
+// Waits until the non-blocking socket fd is ready for events. Returns false once deadline has
+// passed, or as soon as cancel_fd is cancelled. Errors and hang-ups count as ready, the
+// following read or write reports them.
+bool WaitForSocket(int fd, short events, Deadline deadline, int cancel_fd = -1);
+
+// Whether cancel_fd, an eventfd that becomes readable to cancel a request, was signalled.
+// Always false for -1.
+bool IsCancelled(int cancel_fd);
+
+#endif  // DEADLINE_H
@@ -0,0 +1,94 @@
+#ifndef DNS_RESOLVER_H
+#define DNS_RESOLVER_H
+
+#include <sys/socket.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "deadline.h"
+
+struct ResolvedAddress {
+    struct sockaddr_storage addr;  // Port is left at 0, the caller fills it in
+    socklen_t addr_len;
+    int family;
+};
+
+// Thread-safe getaddrinfo based resolver shared by the whole process. Results are cached for
+// a fixed TTL (getaddrinfo does not expose record TTLs) and refreshed by a background worker
+// shortly before they expire, so the conversation thread normally never waits on DNS.
+// Entries from a hosts-format file take precedence over the system resolver.
+class DnsResolver {
+   public:
+    static constexpr int DEFAULT_TTL_SEC = 300;
+    static constexpr int NEGATIVE_TTL_SEC = 10;
+    static constexpr int REFRESH_AHEAD_SEC = 60;  // Refresh this long before an entry expires
+
+    static DnsResolver& Instance();
+
+    ~DnsResolver();
+
+    DnsResolver(const DnsResolver&) = delete;
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+    // Returns the addresses of host ordered for connection racing (IPv6 and IPv4 interleaved),
+    // or an empty vector if it cannot be resolved. Only blocks on a cold cache, and returns an
+    // empty vector early once deadline passes, which sets timed_out, or once cancel_fd is
+    // cancelled (see IsCancelled()); the lookup itself goes on and fills the cache.
+    std::vector<ResolvedAddress> Resolve(const std::string& host,
+                                         Deadline deadline,
+                                         bool& timed_out,
+                                         int cancel_fd = -1);
+
+    // Wakes the Resolve() calls waiting for a lookup, so that a cancelled one returns. Call it
+    // after signalling the cancel_fd.
+    void Interrupt();
+
+    // Starts resolving host in the background so that a later Resolve() hits the cache.
+    void Prefetch(const std::string& host);
+
+    // Loads static "address name [aliases...]" entries, replacing previously loaded ones.
+    // Returns the number of names loaded or -1 if the file cannot be read.
+    int LoadHostsFile(const std::string& path);
+
+    void set_ttl(int ttl_sec) { ttl_sec_ = ttl_sec; }
+
+   private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct CacheEntry {
+        std::vector<ResolvedAddress> addresses;
+        Clock::time_point expires_at;
+        bool resolving = false;  // A lookup for this host is in flight
+    };
+
+    DnsResolver();
+
+    static std::vector<ResolvedAddress> Lookup(const std::string& host);
+    static std::vector<ResolvedAddress> Interleave(const std::vector<ResolvedAddress>& addresses);
+
+    // Runs getaddrinfo for host and publishes the result to the cache.
+    void ResolveAndStore(const std::string& host);
+    // ResolveAndStore() on a thread of its own for a cold cache, counted in lookups_.
+    void LookupDetached(const std::string& host);
+    void QueueLocked(const std::string& host);
+    void WorkerLoop();
+
+    std::map<std::string, CacheEntry> cache_;
+    std::map<std::string, std::vector<ResolvedAddress>> hosts_;  // From LoadHostsFile
+    std::deque<std::string> queue_;
+    int ttl_sec_;
+    bool stop_;
+    int lookups_;  // Running LookupDetached() threads, waited for on destruction
+    std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable resolved_cv_;
+    std::thread worker_;
+};
+
+#endif  // DNS_RESOLVER_H
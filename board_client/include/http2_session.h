@@ -0,0 +1,144 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <nghttp2/nghttp2.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "deadline.h"
+
+class HttpsConnection;
+
+// Client side of an HTTP/2 connection (ALPN "h2") on top of nghttp2. Several threads can run
+// requests over it at once, each one a stream: a request is given as the HTTP/1.1 head LLM
+// builds plus its body buffers, and its response is read back as an HTTP/1.1 style head
+// followed by the body, so decoding and streaming work the same on both protocols. HPACK
+// tables and flow-control windows persist across the requests of the connection.
+//
+// Whichever caller waits for its stream reads the socket for all of them and buffers what
+// arrives per stream; the others wait until it has something for them or hands the reading
+// over. All nghttp2 and SSL calls happen under one mutex.
+class Http2Session {
+   public:
+    static constexpr int32_t LOCAL_WINDOW_SIZE = 1 << 20;  // Fewer WINDOW_UPDATEs on long streams
+    static constexpr size_t READ_BUFFER_SIZE = 16384;
+    static constexpr int RESET_FLUSH_MS = 1000;  // Longest CloseStream() waits to send a reset
+
+    // Produces the part of a body that is not in memory as nghttp2 asks for it: writes up to
+    // len bytes to buf and returns how many, 0 once the body is complete or -1 on failure.
+    // It may be called from the thread of another stream.
+    typedef std::function<ssize_t(char* buf, size_t len)> BodySource;
+
+    explicit Http2Session(HttpsConnection& conn);
+    ~Http2Session();
+
+    Http2Session(const Http2Session&) = delete;
+    Http2Session& operator=(const Http2Session&) = delete;
+
+    // Queues the connection preface and settings, they go out with the first request.
+    bool Init();
+
+    // Opens a stream for the request and writes as much of it as flow control allows; the
+    // rest goes out as responses are read. The body is the buffers followed by whatever
+    // body_source produces, if set. The buffers and body_source must stay valid until the
+    // stream is closed with CloseStream(). Returns the stream id, or -1 if none was opened.
+    // error is set to 0, HttpsConnection::TIMED_OUT or -1 as writing went; a stream whose
+    // request could not be written still has to be closed.
+    int32_t SubmitRequest(const std::string& head,
+                          const std::vector<struct iovec>& body,
+                          const BodySource& body_source,
+                          Deadline deadline,
+                          int& error);
+
+    // Reads response bytes of the stream, the head first. Returns their number, 0 once the
+    // stream ended, HttpsConnection::TIMED_OUT, or -1 if it was reset or cancelled, ended
+    // without a response, or the connection failed.
+    int Read(int32_t stream_id, char* buf, size_t len, Deadline deadline);
+
+    // Forgets the stream, resetting it if the response is not complete. Call it once for
+    // every stream SubmitRequest() opened.
+    void CloseStream(int32_t stream_id);
+
+    // Makes Read() on the stream return -1, from any thread, without waiting for the session.
+    void CancelStream(int32_t stream_id);
+
+    // Whether the connection can take another stream: no GOAWAY and no protocol error.
+    bool usable() const;
+
+    // usable(), and for a session without open streams that the server has not closed it.
+    bool IsAlive() const;
+
+    // Streams submitted and not closed yet.
+    size_t open_streams() const;
+
+   private:
+    struct Stream {
+        std::string head;        // Response head collected from the HEADERS frame
+        bool head_sent = false;  // head went to received, later HEADERS are trailers
+        std::string received;    // Response bytes not read yet
+        size_t read_offset = 0;
+        bool closed = false;
+        bool reset = false;  // Closed with an error or before a response
+        std::vector<struct iovec> body;
+        size_t body_index = 0;
+        size_t body_offset = 0;
+        BodySource body_source;
+    };
+
+    static int OnHeader(nghttp2_session* session,
+                        const nghttp2_frame* frame,
+                        const uint8_t* name,
+                        size_t namelen,
+                        const uint8_t* value,
+                        size_t valuelen,
+                        uint8_t flags,
+                        void* user_data);
+    static int OnFrameRecv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data);
+    static int OnDataChunkRecv(nghttp2_session* session,
+                               uint8_t flags,
+                               int32_t stream_id,
+                               const uint8_t* data,
+                               size_t len,
+                               void* user_data);
+    static int OnStreamClose(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data);
+    static ssize_t ReadBody(nghttp2_session* session,
+                            int32_t stream_id,
+                            uint8_t* buf,
+                            size_t length,
+                            uint32_t* data_flags,
+                            nghttp2_data_source* source,
+                            void* user_data);
+
+    // Returns the open stream stream_id, nullptr for one that is unknown or cancelled.
+    Stream* FindStream(int32_t stream_id);
+
+    // Reads what the connection has, waiting for it without the lock, and processes it.
+    // Returns 0, HttpsConnection::TIMED_OUT or -1. Also returns 0 early when woken by
+    // CancelStream().
+    int Pump(std::unique_lock<std::mutex>& lock, Deadline deadline);
+
+    // Writes out everything nghttp2 has queued.
+    int Flush(Deadline deadline);
+
+    HttpsConnection& conn_;
+    nghttp2_session* session_;
+    bool failed_;
+
+    mutable std::mutex mutex_;    // Guards everything below and every use of session_ and conn_
+    std::condition_variable cv_;  // Stream data arrived, or the reader stopped reading
+    bool reading_;                // A caller is reading the connection for all streams
+    std::vector<char> read_buffer_;
+    std::map<int32_t, Stream> streams_;
+
+    int wake_fd_;  // eventfd that interrupts the reader's wait
+    std::mutex cancel_mutex_;
+    std::vector<int32_t> cancelled_;  // Streams of CancelStream(), until they are closed
+};
+
+#endif  // HTTP2_SESSION_H
@@ -0,0 +1,116 @@
+#ifndef HTTP_REQUEST_PARSER_H
+#define HTTP_REQUEST_PARSER_H
+
+#include <stddef.h>
+#include <string>
+
+// Bytes in a buffer someone else owns, valid as long as the buffer is. The project builds as
+// C++11, which has no std::string_view.
+struct ByteView {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+    bool Equals(const char* text) const;
+    bool EqualsIgnoreCase(const char* text) const;
+    std::string ToString() const { return std::string(data, size); }
+};
+
+// Incremental HTTP/1.1 request parser that allocates nothing. The head is parsed in the buffer
+// the connection reads it into: lines are taken as they complete, so every byte is looked at
+// once however the head is split across reads, and the method, target and header fields are
+// views into that buffer. The body is then decoded in place, with Content-Length or chunked
+// framing.
+class HttpRequestParser {
+   public:
+    enum State {
+        STATE_REQUEST_LINE,
+        STATE_HEADERS,
+        STATE_BODY_LENGTH,     // Body delimited by Content-Length
+        STATE_CHUNK_SIZE,      // Hex digits of the chunk size
+        STATE_CHUNK_EXTENSION,  // Rest of the chunk size line
+        STATE_CHUNK_DATA,
+        STATE_CHUNK_DATA_END,  // CRLF after the chunk data
+        STATE_TRAILERS,
+        STATE_DONE,
+        STATE_ERROR
+    };
+
+    struct Header {
+        ByteView name;
+        ByteView value;
+    };
+
+    static constexpr size_t MAX_HEADERS = 32;
+    static constexpr size_t MAX_TRAILER_SIZE = 4096;
+
+    HttpRequestParser();
+
+    void Reset();
+
+    // Parses the head out of buf[0, len), everything received on the connection so far. buf
+    // must stay in place and only grow between calls. Returns the size of the head once it is
+    // complete, 0 while more is needed, or -1 on a malformed head.
+    long ParseHead(const char* buf, size_t len);
+
+    // Decodes body bytes as they come. Consumes a prefix of data[0, len) and points payload at
+    // the body content in it, without chunk framing; call again with the rest. Returns the
+    // number of bytes consumed, or -1 on malformed framing.
+    long DecodeBody(const char* data, size_t len, ByteView& payload);
+
+    // Accounts for n bytes of a Content-Length body that were moved without being decoded, at
+    // most body_remaining().
+    void SkipBody(size_t n);
+
+    State state() const { return state_; }
+    bool headers_complete() const { return state_ > STATE_HEADERS; }
+    bool done() const { return state_ == STATE_DONE; }
+    bool failed() const { return state_ == STATE_ERROR; }
+
+    // Status to answer a failed request with.
+    int error_status() const { return error_status_; }
+
+    ByteView method() const { return method_; }
+    ByteView target() const { return target_; }
+    ByteView version() const { return version_; }
+
+    // Case-insensitive lookup of the first header named name, empty if there is none.
+    ByteView header(const char* name) const;
+    const Header* headers() const { return headers_; }
+    size_t header_count() const { return header_count_; }
+
+    // -1 without a Content-Length header.
+    long content_length() const { return content_length_; }
+    bool chunked() const { return chunked_; }
+    // The client waits for "100 Continue" before it sends the body.
+    bool expect_continue() const { return expect_continue_; }
+    // Body content decoded so far.
+    size_t body_bytes() const { return body_bytes_; }
+    // Bytes of a Content-Length body still to come.
+    long body_remaining() const { return state_ == STATE_BODY_LENGTH ? remaining_ : 0; }
+
+   private:
+    bool ParseRequestLine(const char* line, size_t len);
+    bool ParseHeaderLine(const char* line, size_t len);
+    void StartBody();
+    long Fail(int status);
+
+    State state_;
+    int error_status_;
+    size_t line_start_;  // Offset of the first line of the head not parsed yet
+    ByteView method_;
+    ByteView target_;
+    ByteView version_;
+    Header headers_[MAX_HEADERS];
+    size_t header_count_;
+    long content_length_;
+    bool chunked_;
+    bool expect_continue_;
+    long remaining_;  // Bytes left in the current chunk or Content-Length body
+    bool chunk_digits_;  // The chunk size line has a digit
+    bool trailer_line_empty_;
+    size_t trailer_bytes_;
+    size_t body_bytes_;
+};
+
+#endif  // HTTP_REQUEST_PARSER_H
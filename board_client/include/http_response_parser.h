@@ -0,0 +1,97 @@
+#ifndef HTTP_RESPONSE_PARSER_H
+#define HTTP_RESPONSE_PARSER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "compression.h"
+
+// Incremental HTTP/1.1 response parser. Bytes can be fed as they come off the socket;
+// the body is delivered through the body callback with chunked framing already removed and a
+// gzip or deflate Content-Encoding decoded.
+class HttpResponseParser {
+   public:
+    enum State {
+        STATE_STATUS_LINE,
+        STATE_HEADERS,
+        STATE_BODY_LENGTH,  // Body delimited by Content-Length
+        STATE_CHUNK_SIZE,
+        STATE_CHUNK_DATA,
+        STATE_CHUNK_DATA_END,
+        STATE_TRAILERS,
+        STATE_BODY_EOF,  // Body delimited by connection close
+        STATE_DONE,
+        STATE_ERROR
+    };
+
+    typedef std::function<void(const char* data, size_t len)> BodyCallback;
+
+    static constexpr size_t MAX_LINE_SIZE = 8192;
+
+    HttpResponseParser();
+
+    void Reset();
+
+    // Replaces the default behaviour of collecting the body into body().
+    void set_body_callback(BodyCallback callback) { body_callback_ = callback; }
+
+    // Returns the number of bytes consumed, which is less than len once the response is
+    // complete, or -1 on a malformed response.
+    long Feed(const char* data, size_t len);
+
+    // Signals that the peer closed the connection.
+    void FeedEof();
+
+    bool done() const { return state_ == STATE_DONE; }
+    bool failed() const { return state_ == STATE_ERROR; }
+    bool headers_complete() const { return state_ > STATE_HEADERS; }
+
+    int status_code() const { return status_code_; }
+    long content_length() const { return content_length_; }
+    bool chunked() const { return chunked_; }
+
+    // Body bytes as received, still compressed, and as delivered after decoding.
+    size_t body_bytes() const { return body_bytes_; }
+    size_t decoded_body_bytes() const { return decoded_body_bytes_; }
+
+    // Whether the connection can carry another request once this response is done. Not if
+    // bytes followed the response.
+    bool keep_alive() const { return keep_alive_ && state_ == STATE_DONE && !close_delimited_ && !trailing_data_; }
+
+    // Case-insensitive header lookup, returns an empty string if absent.
+    std::string Header(const std::string& name) const;
+
+    const std::string& body() const { return body_; }
+
+   private:
+    bool ParseStatusLine(const std::string& line);
+    bool ParseHeaderLine(const std::string& line);
+    void StartBody();
+    void EmitBody(const char* data, size_t len);
+    // The framed body is complete. A compressed one is only if the stream ended as well.
+    void EndBody();
+    void DeliverBody(const char* data, size_t len);
+
+    State state_;
+    std::string line_;  // Partial line carried over between Feed() calls
+    int status_code_;
+    long content_length_;
+    long remaining_;  // Bytes left in the current chunk or Content-Length body
+    bool chunked_;
+    bool keep_alive_;
+    bool close_delimited_;
+    bool trailing_data_;  // Bytes came after the end of the response
+    std::string content_encoding_;  // Lower-cased, empty for identity
+    bool decoding_;
+    size_t body_bytes_;
+    size_t decoded_body_bytes_;
+    std::unique_ptr<Inflater> inflater_;  // Created on the first compressed body, then reused
+    std::vector<std::pair<std::string, std::string>> headers_;  // Names are lower-cased
+    std::string body_;
+    BodyCallback body_callback_;
+};
+
+#endif  // HTTP_RESPONSE_PARSER_H
@@ -0,0 +1,71 @@
+#ifndef HTTPS_CONNECTION_H
+#define HTTPS_CONNECTION_H
+
+#include <openssl/ssl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "deadline.h"
+#include "request_metrics.h"
+
+class Http2Session;
+
+// A TLS connection (direct or tunnelled through the proxy) that can serve several
+// HTTP/1.1 requests one after the other, or HTTP/2 ones at once through its session when ALPN
+// picked "h2". Owns both the socket and the SSL object. The socket is non-blocking, reads and
+// writes wait for it with poll() until their deadline. Over HTTP/2 only the session reads and
+// writes, under its lock.
+class HttpsConnection {
+    int sockfd_;
+    SSL* ssl_;
+    std::string key_;       // Pool key, e.g. "dashscope.aliyuncs.com:443"
+    time_t last_used_;      // Time the connection last finished a request
+    std::atomic<int> requests_started_;  // Requests sent on this connection, possibly in parallel
+    size_t early_data_;     // Request bytes the server accepted as TLS 1.3 early data
+    RequestTimings setup_;  // DNS, connect, proxy and handshake phases of opening it
+    std::unique_ptr<Http2Session> http2_;  // Only on HTTP/2 connections
+
+   public:
+    static constexpr int TIMED_OUT = -2;
+
+    HttpsConnection(int sockfd, SSL* ssl, const std::string& key);
+    ~HttpsConnection();
+
+    HttpsConnection(const HttpsConnection&) = delete;
+    HttpsConnection& operator=(const HttpsConnection&) = delete;
+
+    // Writes the whole buffer, returns 0 on success, TIMED_OUT, or the SSL error code otherwise.
+    int WriteAll(const char* data, size_t len, Deadline deadline);
+
+    // Writes the buffers back to back, skipping the first `skip` bytes. The socket is corked
+    // meanwhile so a small header and the body leave in full-sized segments.
+    int WriteV(const struct iovec* iov, int iovcnt, Deadline deadline, size_t skip = 0);
+
+    // Returns the number of bytes read, 0 on clean close, -1 on error, or TIMED_OUT.
+    int Read(char* buf, size_t len, Deadline deadline);
+
+    // Checks, without blocking, that the peer has not closed the idle connection.
+    bool IsAlive() const;
+
+    // Counts a request about to be sent, returns whether an earlier one was.
+    bool StartRequest() { return requests_started_++ > 0; }
+
+    void MarkIdle();
+
+    const std::string& key() const { return key_; }
+    time_t last_used() const { return last_used_; }
+    bool reused() const { return requests_started_ > 0; }
+    size_t early_data() const { return early_data_; }
+    void set_early_data(size_t len) { early_data_ = len; }
+    const RequestTimings& setup_timings() const { return setup_; }
+    void set_setup_timings(const RequestTimings& timings) { setup_ = timings; }
+    Http2Session* http2() const { return http2_.get(); }
+    void set_http2(std::unique_ptr<Http2Session> session);
+    SSL* ssl() const { return ssl_; }
+    int fd() const { return sockfd_; }
+};
+
+#endif  // HTTPS_CONNECTION_H
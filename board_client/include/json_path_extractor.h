@@ -0,0 +1,89 @@
+#ifndef JSON_PATH_EXTRACTOR_H
+#define JSON_PATH_EXTRACTOR_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Streaming JSON tokenizer that pulls one string value out of a document without building
+// a DOM, e.g. choices[0].message.content. The document can be fed in arbitrary pieces as it
+// comes off the socket. Unescaped runs of the target string are passed to the callback as
+// pointers into the fed buffer; runs with escape sequences are decoded through a scratch.
+class JsonPathExtractor {
+   public:
+    struct PathElement {
+        std::string key;  // Object member name, used when index < 0
+        int index;        // Array index
+
+        PathElement(const char* member) : key(member), index(-1) {}
+        PathElement(int array_index) : index(array_index) {}
+    };
+
+    typedef std::function<void(const char* data, size_t len)> TextCallback;
+
+    static constexpr size_t MAX_DEPTH = 64;
+    static constexpr size_t MAX_KEY_SIZE = 256;
+
+    JsonPathExtractor(const std::vector<PathElement>& path, TextCallback on_text);
+
+    void Reset();
+
+    // Returns false once the input is not valid JSON.
+    bool Feed(const char* data, size_t len);
+
+    // The target value was a string and has been delivered completely.
+    bool found() const { return found_; }
+    bool failed() const { return state_ == STATE_ERROR; }
+
+    // Human-readable form of the path, e.g. "choices[0].message.content".
+    std::string PathString() const;
+
+   private:
+    enum State {
+        STATE_VALUE,          // Expecting a value
+        STATE_VALUE_OR_END,   // After '['
+        STATE_KEY_OR_END,     // After '{'
+        STATE_KEY,            // Expecting a key after ','
+        STATE_COLON,
+        STATE_COMMA_OR_END,   // After a value inside a container
+        STATE_KEY_STRING,
+        STATE_VALUE_STRING,   // Inside a string value that is not the target
+        STATE_TARGET_STRING,  // Inside the target string value
+        STATE_SKIP_ESCAPE,    // After a backslash in a skipped string
+        STATE_TARGET_ESCAPE,  // Collecting an escape sequence of the target string
+        STATE_LITERAL,        // Inside a number, true, false or null
+        STATE_DONE,           // Root value complete
+        STATE_ERROR
+    };
+
+    struct Frame {
+        bool is_object;
+        bool on_path;  // The container itself sits on the path prefix of its depth
+        int index;     // Current element index for arrays
+    };
+
+    enum Match {
+        MATCH_NONE,
+        MATCH_PREFIX,  // Container on the way to the target
+        MATCH_TARGET
+    };
+
+    // Where the value about to start sits relative to the path.
+    Match MatchValue() const;
+    bool BeginValue(char c);
+    void EndValue();
+    void FinishTargetEscape();
+
+    std::vector<PathElement> path_;
+    TextCallback on_text_;
+    State state_;
+    std::vector<Frame> stack_;
+    std::string key_;  // Member name of the value about to start
+    bool key_too_long_;
+    bool key_escape_;      // Previous key byte was an unpaired backslash
+    std::string escape_;   // Partial escape sequence of the target string
+    std::string scratch_;  // Decoded escape sequence
+    bool found_;
+};
+
+#endif  // JSON_PATH_EXTRACTOR_H
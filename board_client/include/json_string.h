@@ -0,0 +1,25 @@
+#ifndef JSON_STRING_H
+#define JSON_STRING_H
+
+#include <stddef.h>
+#include <string>
+
+// JSON string escaping and unescaping. Runs of bytes that need no work are found 16 or 32
+// bytes at a time with NEON (ARM), SSE2 or AVX2 (x86), with a scalar fallback elsewhere.
+
+// Number of leading bytes of data that can be copied into a JSON string unescaped.
+size_t JsonPlainPrefix(const char* data, size_t len);
+
+// Exact length of data once escaped.
+size_t JsonEscapedSize(const char* data, size_t len);
+
+// Writes the escaped form of data to out, which must hold JsonEscapedSize(data, len) bytes.
+// Returns the end of the written output.
+char* JsonEscape(const char* data, size_t len, char* out);
+
+// Appends the unescaped contents of a JSON string literal (without the quotes) to out,
+// decoding \uXXXX escapes and surrogate pairs to UTF-8. Lone surrogates become U+FFFD;
+// malformed escapes are copied through unchanged.
+void JsonUnescape(const char* data, size_t len, std::string& out);
+
+#endif  // JSON_STRING_H
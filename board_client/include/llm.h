@@ -1,8 +1,21 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "compression.h"
+#include "connection_pool.h"
+#include "deadline.h"
+#include "http_response_parser.h"
+#include "llm_error.h"
+#include "llm_provider.h"
+#include "request_metrics.h"
+
 #ifndef LLM_HPP
 #define LLM_HPP
 
@@ -16,38 +29,111 @@
 #define DEEPSEEK_API_KEY "test"
 #define QWEN_API_KEY "test"
 
-struct ConversationMessage {
-    const std::string role;
-    const std::string content;
-    bool has_image;
-};
-
-enum ApiAuthMethod {
-    AUTH_METHOD_NONE,
-    AUTH_METHOD_URL_PARAM,     // e.g., ?key=API_KEY
-    AUTH_METHOD_BEARER_HEADER  // e.g., Authorization: Bearer API_KEY
-};
+class Http2Session;
 
 class LLM {
+   public:
+    // Body sizes of a request and its response, as sent and received and before compression
+    // or after decoding.
+    struct TransferStats {
+        size_t request_raw;
+        size_t request_sent;
+        size_t response_received;
+        size_t response_decoded;
+    };
+
+   private:
     std::string name_;           // Human-readable name
     std::string host_;           // Target hostname (e.g., "api.example.com")
+    int port_;                   // TARGET_PORT unless pointed at a local server
     std::string path_base_;      // Base API path (e.g., "/v1/chat")
     std::string api_key_;        // The actual API key string
-    ApiAuthMethod auth_method_;  // How the API key is used
     std::string model_name_;     // Optional: Model identifier (e.g., "gemini-pro")
-    std::string response_search_key_;
     std::string role_;
     bool use_proxy_;
+    std::shared_ptr<ConnectionPool> pool_ = std::make_shared<ConnectionPool>();  // Reused across turns
+    const ProviderOps* provider_;  // Request and response format of the API
+    RequestBody body_;             // Its buffer is reused across requests
+    RequestTimeouts timeouts_;
+    LlmError::Kind last_error_;
+
+    int compression_level_;      // zlib level of request bodies, 0 to send them as they are
+    bool accept_compressed_;     // Whether responses may be gzip or deflate encoded
+    GzipCompressor compressor_;  // Holds the compressed body_
+    bool body_compressed_;
+    TransferStats last_transfer_;
+
+    std::atomic<bool> cancelled_;
+    int cancel_fd_ = -1;  // eventfd signalled by Cancel(), interrupts opening a connection
+    std::mutex active_mutex_;
+    int active_fd_;  // Socket of the HTTP/1.1 request in flight, shut down by Cancel()
+    Http2Session* active_http2_ = nullptr;  // Or the session and stream of the HTTP/2 one, which
+    int32_t active_stream_ = -1;            // Cancel() resets without touching the connection
+
+    // Escaped JSON of the messages of a conversation that were already sent, as written by
+    // this provider's adapter, so that a request only escapes its new turn.
+    struct HistoryPrefix {
+        std::shared_ptr<std::string> json;
+        size_t messages;   // Number of messages in json
+        size_t last_size;  // Content size of the last of them, to notice a different history
+        uint64_t last_used;
+    };
+
+    static constexpr size_t MAX_HISTORY_CONVERSATIONS = 8;
+
+    std::mutex history_mutex_;
+    std::map<int, HistoryPrefix> history_;
+    uint64_t history_clock_;
+    RequestBody history_scratch_;  // New history messages are escaped here before being cached
+
+    // Writes the JSON request body into body_. With conversation_id >= 0 all messages but the
+    // latest come from the history cache.
+    void GeneratePayload(std::vector<ConversationMessage>& conversation_data, bool stream, int conversation_id);
+
+    // Returns the cached JSON of all messages but the latest, extended by the ones not cached yet.
+    std::shared_ptr<const std::string> CachedHistory(int conversation_id,
+                                                     const std::vector<ConversationMessage>& conversation_data);
+
+    // Generates the payload and returns the matching request header.
+    std::string BuildRequest(std::vector<ConversationMessage>& conversation_data, bool stream, int conversation_id);
+
+    // Gzip compresses body_ into compressor_ if the provider accepts it and it pays off.
+    bool CompressBody();
+
+    // Reads and base64 encodes the image of body_ one chunk at a time, passing each encoded
+    // chunk to sink. Returns false as soon as sink does.
+    bool EncodeImage(const std::function<bool(const char* data, size_t len)>& sink);
+
+    // Sends header and body_ over a pooled connection and reads the complete response into
+    // parser, within the phase timeouts. Throws LlmError on failure.
+    void Transact(const std::string& header, HttpResponseParser& parser);
+
+    // Sends the request head and body. On an HTTP/2 connection it opens a stream, stream_id is
+    // set to it or -1. Returns 0, HttpsConnection::TIMED_OUT or the SSL error of the failed
+    // write.
+    int WriteRequest(HttpsConnection& conn,
+                     const std::vector<struct iovec>& request,
+                     int32_t& stream_id,
+                     Deadline deadline);
+
+    // Publishes the socket, or the HTTP/2 session and stream, of the request in flight to
+    // Cancel(); -1 when done.
+    void SetActiveConnection(int fd, Http2Session* http2 = nullptr, int32_t stream_id = -1);
+
+    // Reads until the response is complete, over HTTP/2 the response of stream_id. Returns false
+    // if the connection (or stream) closed before the first byte, throws LlmError when the first
+    // byte or a later one does not arrive in time. Fills in the first byte, body and parse
+    // phases of timings and the bytes received.
+    bool ReadResponse(HttpsConnection& conn,
+                      int32_t stream_id,
+                      HttpResponseParser& parser,
+                      Deadline first_byte,
+                      Deadline deadline,
+                      RequestTimings& timings);
+
+    // Logs a failed request and records its kind for last_error().
+    void RecordError(const char* function, const std::exception& e);
 
-    char* Base64Encode(const unsigned char* input, int length);
-
-    std::string GeneratePayload(std::vector<ConversationMessage>& conversation_data);
-
-    std::string ParseResponse(const std::string& response);
-
-    std::string JsonEscapeString(const std::string& input);
-
-    std::string JsonUnescapeString(const std::string& input);
 
    public:
     LLM() = default;
@@ -55,17 +141,95 @@ class LLM {
         std::string host,
         std::string path_base,
         std::string api_key,
-        ApiAuthMethod auth_method,
         std::string model_name,
-        std::string response_search_key,
         std::string role,
         bool use_proxy);
     ~LLM();
 
-    std::string SendRequest(std::vector<ConversationMessage>& conversation_data);
+    typedef std::function<void(const std::string& delta)> TokenCallback;
+
+    // conversation_id identifies the stored conversation the messages come from, it enables the
+    // history cache. The messages of a conversation may only grow by appending between requests;
+    // call InvalidateHistory() when stored messages are deleted.
+    std::string SendRequest(std::vector<ConversationMessage>& conversation_data, int conversation_id = -1);
+
+    // Requests a streamed (server-sent events) completion, calling on_token with every text
+    // delta as it arrives. Returns the full reply, or an empty string on error.
+    std::string SendStreamRequest(std::vector<ConversationMessage>& conversation_data,
+                                  TokenCallback on_token,
+                                  int conversation_id = -1);
+
+    // Drops the cached history of a conversation.
+    void InvalidateHistory(int conversation_id);
+
+    // Aborts the request running in another thread by shutting down its socket (resetting its
+    // stream over HTTP/2, where others share the connection), or while the connection is being
+    // opened, at whichever step that is; the request then returns an empty reply. Stays in
+    // effect until ResetCancel().
+    void Cancel();
+    void ResetCancel();
+    bool cancelled() const { return cancelled_; }
 
     std::string role();
 
     std::string name();
+
+    std::string model_name();
+
+    // Persists TLS sessions to path so that connections after a restart can resume.
+    void set_session_cache_file(const std::string& path);
+    // Writes sessions that changed to that file. Not done during handshakes, call it once a
+    // request is over.
+    void FlushSessionCache();
+
+    // Opens a connection to the provider ahead of the next request unless an idle one is
+    // waiting, see ConnectionPool::Prewarm(). Returns false if it cannot be reached.
+    bool Prewarm();
+
+    // Sends requests over the connection pool of other, which has to reach the same host the
+    // same way, so that over HTTP/2 requests of both running at the same time are streams of one
+    // connection. Early data, HTTP/2, timeouts, the session cache and the connection counters
+    // below are then those of the shared pool. Call it before the first request.
+    void ShareConnections(const LLM& other);
+
+    // Sends the start of the request as TLS 1.3 early data on resumed connections.
+    void set_early_data(bool enabled);
+
+    // Offers HTTP/2 when connecting and uses it where the server agrees, HTTP/1.1 otherwise.
+    void set_http2(bool enabled);
+
+    // Gzip compresses the request bodies of providers that accept it, at zlib level 1 (fastest)
+    // to 9 (smallest). 0, the default, turns it off.
+    void set_request_compression(int level);
+
+    // Asks for gzip or deflate compressed responses, which are decoded as they arrive.
+    void set_accept_compressed(bool enabled) { accept_compressed_ = enabled; }
+
+    // Transfer sizes of the last request that got a response.
+    const TransferStats& last_transfer() const { return last_transfer_; }
+
+    void set_timeouts(const RequestTimeouts& timeouts);
+    const RequestTimeouts& timeouts() const { return timeouts_; }
+
+    // Sends requests to another port of host than TARGET_PORT, e.g. of a local stand-in server.
+    void set_port(int port) { port_ = port; }
+
+    // Why the last request returned an empty reply, NONE if it succeeded.
+    LlmError::Kind last_error() const { return last_error_; }
+
+    // Number of TLS handshakes performed so far, one per new connection.
+    size_t handshake_count() const;
+    size_t full_handshake_count() const;
+    size_t resumed_handshake_count() const;
+
+    // Proxy tunnels opened so far, and requests that reused one instead.
+    size_t tunnel_count() const;
+    size_t tunnel_reuse_count() const;
+
+    // CPU time spent in TLS handshakes so far.
+    double handshake_cpu_ms() const;
+
+    // Connections opened by Prewarm() so far.
+    size_t prewarm_count() const;
 };
 #endif
@@ -0,0 +1,39 @@
+#ifndef LLM_ERROR_H
+#define LLM_ERROR_H
+
+#include <stdexcept>
+#include <string>
+
+// Failure of an LLM request. kind() tells which phase failed and whether it ran out of time.
+class LlmError : public std::runtime_error {
+   public:
+    enum Kind {
+        NONE,
+        CONNECT_FAILED,
+        CONNECT_TIMEOUT,
+        HANDSHAKE_FAILED,
+        HANDSHAKE_TIMEOUT,
+        SEND_FAILED,
+        FIRST_BYTE_TIMEOUT,  // Also covers sending the request
+        BODY_TIMEOUT,
+        CONNECTION_CLOSED,
+        BAD_RESPONSE,
+        HTTP_ERROR,
+        CANCELLED,
+        OTHER
+    };
+
+    LlmError(Kind kind, const std::string& what) : std::runtime_error(what), kind_(kind) {}
+
+    Kind kind() const { return kind_; }
+
+    bool timed_out() const {
+        return kind_ == CONNECT_TIMEOUT || kind_ == HANDSHAKE_TIMEOUT || kind_ == FIRST_BYTE_TIMEOUT ||
+               kind_ == BODY_TIMEOUT;
+    }
+
+   private:
+    Kind kind_;
+};
+
+#endif  // LLM_ERROR_H
@@ -0,0 +1,215 @@
+#ifndef LLM_PROVIDER_H
+#define LLM_PROVIDER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "json_path_extractor.h"
+#include "payload_writer.h"
+
+struct ConversationMessage {
+    const std::string role;
+    const std::string content;
+    bool has_image;
+};
+
+enum ApiAuthMethod {
+    AUTH_METHOD_NONE,
+    AUTH_METHOD_URL_PARAM,     // e.g., ?key=API_KEY
+    AUTH_METHOD_BEARER_HEADER  // e.g., Authorization: Bearer API_KEY
+};
+
+// Request body. Two parts are not copied into payload but sent in its place while the request
+// is written: the cached JSON of the conversation history at history_offset, and an attached
+// image base64 encoded at image_offset (which comes after the history).
+struct RequestBody {
+    PayloadWriter payload;
+    std::shared_ptr<const std::string> history;  // Null when not used
+    size_t history_offset;
+    std::string image_path;  // Empty when there is no image
+    size_t image_offset;
+    size_t image_size;
+
+    RequestBody() : history_offset(0), image_offset(0), image_size(0) {}
+
+    void Clear() {
+        payload.Clear();
+        history.reset();
+        image_path.clear();
+    }
+
+    // Appends the buffers that make up the body up to the image (all of it without one).
+    void HeadBuffers(std::vector<struct iovec>& buffers) const;
+
+    // Sets path as the image of the request; the caller then sets image_offset. Returns false
+    // if path is not a regular file.
+    bool AttachImage(const char* path);
+
+    // Content-Length of the body, including the encoded image.
+    size_t size() const;
+};
+
+// Provider adapters. Each one is a set of static functions describing the request body, URL,
+// authentication and response format of one API, so the encoder and decoder of every provider
+// are separate, fully inlined functions. ProviderOpsFor<> turns an adapter into the table LLM
+// calls through; a new provider only needs an adapter and an entry in FindProvider().
+
+// Chat completions API shared by OpenAI and the services that copy it. Traits supplies NAME and
+// whether the API takes content as a list of parts, which is required for images.
+template <class Traits>
+struct OpenAiCompatibleProvider : Traits {
+    static constexpr ApiAuthMethod AUTH = AUTH_METHOD_BEARER_HEADER;
+    static constexpr bool GZIP_REQUEST = false;
+
+    static void WriteHead(PayloadWriter& payload, const std::string& model_name) {
+        payload.AppendLiteral("{\"model\": \"");
+        payload.Append(model_name);
+        payload.AppendLiteral("\", \"messages\": [");
+    }
+
+    // latest is the turn being asked about, the only one that can carry the camera image.
+    static void WriteMessage(RequestBody& body, const ConversationMessage& message, bool latest) {
+        PayloadWriter& payload = body.payload;
+        payload.AppendLiteral("{\"role\": \"");
+        payload.Append(message.role);
+
+        if (!Traits::CONTENT_PARTS) {
+            payload.AppendLiteral("\", \"content\": \"");
+            payload.AppendEscaped(message.content);
+            payload.AppendLiteral("\"}");
+            return;
+        }
+
+        payload.AppendLiteral("\", \"content\": [{\"type\": \"text\", \"text\": \"");
+        payload.AppendEscaped(message.content);
+        if (latest && message.has_image && body.AttachImage("./image.jpg")) {
+            payload.AppendLiteral(
+                "\"}, {\"type\": \"image_url\", \"image_url\": {\"url\": \"data:image/jpeg;base64,");
+            body.image_offset = payload.size();
+            payload.AppendLiteral("\"}}]}");
+            return;
+        }
+        payload.AppendLiteral("\"}]}");
+    }
+
+    static void WriteTail(PayloadWriter& payload, bool stream) {
+        if (stream)
+            payload.AppendLiteral("], \"stream\": true}");
+        else
+            payload.AppendLiteral("], \"stream\": false}");
+    }
+
+    static void AdjustPath(std::string&, bool) {}
+
+    static std::vector<JsonPathExtractor::PathElement> ResponsePath(bool stream) {
+        if (stream)
+            return {"choices", 0, "delta", "content"};
+        return {"choices", 0, "message", "content"};
+    }
+
+    // The event stream ends with a "[DONE]" event instead of a JSON chunk.
+    static bool IsStreamEnd(const std::string& data) { return data == "[DONE]"; }
+};
+
+struct OpenAiTraits {
+    static constexpr const char* NAME = "OpenAI";
+    static constexpr bool CONTENT_PARTS = false;
+};
+
+struct DeepSeekTraits {
+    static constexpr const char* NAME = "DeepSeek";
+    static constexpr bool CONTENT_PARTS = false;
+};
+
+struct QwenTraits {
+    static constexpr const char* NAME = "Qwen";
+    static constexpr bool CONTENT_PARTS = true;
+};
+
+typedef OpenAiCompatibleProvider<OpenAiTraits> OpenAiProvider;
+typedef OpenAiCompatibleProvider<DeepSeekTraits> DeepSeekProvider;
+typedef OpenAiCompatibleProvider<QwenTraits> QwenProvider;
+
+struct GeminiProvider {
+    static constexpr const char* NAME = "Gemini";
+    static constexpr ApiAuthMethod AUTH = AUTH_METHOD_URL_PARAM;
+    // Google APIs accept gzip encoded request bodies
+    static constexpr bool GZIP_REQUEST = true;
+
+    static void WriteHead(PayloadWriter& payload, const std::string&) {
+        payload.AppendLiteral("{ \"contents\": [");
+    }
+
+    static void WriteMessage(RequestBody& body, const ConversationMessage& message, bool) {
+        PayloadWriter& payload = body.payload;
+
+        // Gemini only knows user and model turns
+        if (message.role == "assistant" || message.role == "model")
+            payload.AppendLiteral("{\"role\": \"model");
+        else
+            payload.AppendLiteral("{\"role\": \"user");
+        payload.AppendLiteral("\", \"parts\": [{\"text\": \"");
+        payload.AppendEscaped(message.content);
+        payload.AppendLiteral("\"}]}");
+    }
+
+    static void WriteTail(PayloadWriter& payload, bool) {
+        payload.AppendLiteral("]}");
+    }
+
+    // Gemini streams from a separate method and needs alt=sse to frame it as an event stream.
+    static void AdjustPath(std::string& path, bool stream) {
+        if (!stream)
+            return;
+        static const char kMethod[] = ":generateContent";
+        size_t method = path.rfind(kMethod);
+        if (method != std::string::npos)
+            path.replace(method, sizeof(kMethod) - 1, ":streamGenerateContent");
+        path += "?alt=sse";
+    }
+
+    static std::vector<JsonPathExtractor::PathElement> ResponsePath(bool) {
+        return {"candidates", 0, "content", "parts", 0, "text"};
+    }
+
+    // The stream simply ends after the last chunk.
+    static bool IsStreamEnd(const std::string&) { return false; }
+};
+
+struct ProviderOps {
+    const char* name;
+    ApiAuthMethod auth;
+    bool gzip_request;  // Whether the API accepts a Content-Encoding: gzip request body
+    // The body is WriteHead, the messages separated by ", " and WriteTail.
+    void (*write_head)(PayloadWriter& payload, const std::string& model_name);
+    void (*write_message)(RequestBody& body, const ConversationMessage& message, bool latest);
+    void (*write_tail)(PayloadWriter& payload, bool stream);
+    void (*adjust_path)(std::string& path, bool stream);
+    std::vector<JsonPathExtractor::PathElement> (*response_path)(bool stream);
+    bool (*is_stream_end)(const std::string& data);
+};
+
+template <class Provider>
+const ProviderOps* ProviderOpsFor() {
+    static const ProviderOps ops = {Provider::NAME,           Provider::AUTH,          Provider::GZIP_REQUEST,
+                                    &Provider::WriteHead,     &Provider::WriteMessage, &Provider::WriteTail,
+                                    &Provider::AdjustPath,    &Provider::ResponsePath, &Provider::IsStreamEnd};
+    return &ops;
+}
+
+// Returns the adapter registered under name, or nullptr.
+const ProviderOps* FindProvider(const std::string& name);
+
+// Writes the body of a request for messages into body with the provider's adapter. The
+// messages before first are left out, body.history stands in for them.
+void WriteRequestBody(const ProviderOps& provider,
+                      const std::string& model_name,
+                      const std::vector<ConversationMessage>& messages,
+                      size_t first,
+                      bool stream,
+                      RequestBody& body);
+
+#endif  // LLM_PROVIDER_H
@@ -0,0 +1,215 @@
+#ifndef LLM_ROUTER_H
+#define LLM_ROUTER_H
+
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llm.h"
+
+class PendingReply;
+
+// Sends each turn to one of several LLM providers. Providers are ranked by an EWMA of their
+// time to first token, penalized by their recent error rate. If the chosen provider has not
+// produced a token after its p90 time to first token, the request is hedged to the next
+// provider; whichever streams first wins and the other is cancelled. Providers that fail
+// repeatedly are skipped for a while (circuit breaker) and then probed with a single request.
+//
+// Requests run asynchronously. One loop thread drives every turn in flight (hedge timers,
+// tokens, completion and cancellation) and each provider has a single worker thread doing its
+// I/O, so the number of threads does not grow with the number of requests. A turn that finds
+// every healthy provider busy with another one waits for the first to become free.
+class LlmRouter {
+   public:
+    static constexpr double EWMA_ALPHA = 0.2;
+    static constexpr size_t LATENCY_WINDOW = 32;    // Samples kept for the p90
+    static constexpr size_t MIN_HEDGE_SAMPLES = 5;  // Below this DEFAULT_HEDGE_DELAY_MS is used
+    static constexpr int DEFAULT_HEDGE_DELAY_MS = 3000;
+    static constexpr int MIN_HEDGE_DELAY_MS = 300;
+    static constexpr int FAILURE_THRESHOLD = 3;  // Consecutive failures that open the circuit
+    static constexpr int OPEN_CIRCUIT_SEC = 30;  // Before a half-open probe is allowed
+    static constexpr double ERROR_PENALTY_MS = 10000;  // Added to the score at a 100% error rate
+
+    typedef std::function<void(const std::string& reply)> ReplyCallback;
+
+    LlmRouter();
+    ~LlmRouter();
+
+    LlmRouter(const LlmRouter&) = delete;
+    LlmRouter& operator=(const LlmRouter&) = delete;
+
+    // Takes ownership of llm.
+    void AddProvider(LLM* llm);
+
+    // Starts streaming a reply from the best available provider and returns at once.
+    // preferred names the provider the conversation was started with; it is used first while
+    // its circuit is closed. on_token is only called with tokens of the winning provider, and
+    // on_done with the full reply (empty if every provider failed or the request was
+    // cancelled), both on the loop thread, so they must not block for long. conversation_id
+    // enables the history cache of the providers, see LLM::SendStreamRequest().
+    // The returned reply must not outlive the router.
+    std::shared_ptr<PendingReply> SendStreamRequestAsync(const std::vector<ConversationMessage>& conversation_data,
+                                                         LLM::TokenCallback on_token,
+                                                         ReplyCallback on_done = nullptr,
+                                                         const std::string& preferred = "",
+                                                         int conversation_id = -1);
+
+    // Waits for the reply of SendStreamRequestAsync().
+    std::string SendStreamRequest(const std::vector<ConversationMessage>& conversation_data,
+                                  LLM::TokenCallback on_token,
+                                  const std::string& preferred = "",
+                                  int conversation_id = -1);
+
+    // Has the workers of the provider a turn would start with, and of the one it would hedge
+    // to, open their connections now. Returns at once; a turn started before they are done
+    // waits for the handshake in progress instead of starting its own.
+    void Prewarm(const std::string& preferred = "");
+
+    // Model of the provider named provider, or an empty string if there is none.
+    std::string ModelName(const std::string& provider);
+
+    // Drops the cached history of a conversation in every provider.
+    void InvalidateHistory(int conversation_id);
+
+    void set_hedging(bool enabled) { hedging_ = enabled; }
+
+    // Logs latency, error rate and circuit state of every provider.
+    void DumpStats();
+
+   private:
+    friend class PendingReply;
+
+    typedef std::chrono::steady_clock Clock;
+
+    enum CircuitState { CIRCUIT_CLOSED, CIRCUIT_OPEN, CIRCUIT_HALF_OPEN };
+
+    // State of one turn. Only the loop thread changes it after it was started; provider
+    // workers just read the conversation.
+    struct Turn;
+
+    struct Provider {
+        std::unique_ptr<LLM> llm;
+        std::thread worker;
+        std::condition_variable wake;  // A job was handed to worker, or the router stops
+        std::shared_ptr<Turn> job;     // Request in flight or winding down after a cancel
+        bool prewarm;                  // Connect while there is no job
+
+        double latency_ewma_ms;  // Time to first token
+        double error_ewma;
+        std::vector<double> latency_samples;  // Ring of the last LATENCY_WINDOW samples
+        size_t next_sample;
+        size_t requests;
+
+        CircuitState circuit;
+        int consecutive_failures;
+        Clock::time_point open_until;
+    };
+
+    // Work for the loop thread
+    struct Event {
+        enum Kind {
+            START,          // A new turn
+            TOKEN,          // A token from provider
+            FINISHED,       // provider ended its request, text is the full reply (empty on failure)
+            CANCEL,         // The caller gave up on the turn
+            PROVIDER_FREE,  // provider can take another request
+        };
+
+        Kind kind;
+        std::shared_ptr<Turn> turn;
+        size_t provider;
+        std::string text;
+    };
+
+    // Providers that may take the next request, best first.
+    std::vector<size_t> Rank(const std::string& preferred);
+
+    void Post(Event event);
+
+    // Runs the turns until the router is destroyed.
+    void Loop();
+    void Handle(Event& event);
+
+    // Ranks the providers for a new turn and starts the first, or leaves the turn waiting if
+    // they are all busy.
+    void Begin(const std::shared_ptr<Turn>& turn);
+
+    // Starts the next provider of the turn that is free and arms the hedge timer for it.
+    // Ends the turn when none is left and nothing is running.
+    void StartNext(const std::shared_ptr<Turn>& turn);
+
+    // Hands the turn to provider index unless it is busy.
+    bool Start(const std::shared_ptr<Turn>& turn, size_t index);
+
+    // Aborts the request of provider index if it is still working on turn.
+    void CancelProvider(size_t index, const std::shared_ptr<Turn>& turn);
+
+    // Resolves the turn with reply and cancels the providers that lost.
+    void Finish(const std::shared_ptr<Turn>& turn, std::string reply);
+
+    // Body of the worker thread of provider index.
+    void Work(size_t index);
+
+    // Asks the loop to cancel turn.
+    void Cancel(const std::shared_ptr<Turn>& turn);
+
+    void RecordResult(size_t index, bool success, double first_token_ms);
+
+    std::chrono::milliseconds HedgeDelay(size_t index);
+
+    std::vector<std::unique_ptr<Provider>> providers_;
+    std::mutex mutex_;  // Guards the statistics, circuit state and jobs of providers_
+    bool hedging_;
+    std::atomic<bool> stopping_;
+
+    std::thread loop_;
+    std::deque<Event> events_;
+    std::mutex loop_mutex_;  // Guards events_
+    std::condition_variable loop_wake_;
+    std::vector<std::shared_ptr<Turn>> turns_;  // In flight, only touched by the loop thread
+};
+
+// Reply of a request started with LlmRouter::SendStreamRequestAsync(), usable as a future.
+class PendingReply {
+   public:
+    // Blocks until the reply is complete. Empty if every provider failed or it was cancelled.
+    std::string Get() { return future_.get(); }
+
+    // Whether the reply is complete, after waiting at most timeout for it.
+    bool WaitFor(std::chrono::milliseconds timeout) {
+        return future_.wait_for(timeout) == std::future_status::ready;
+    }
+
+    std::shared_future<std::string> future() const { return future_; }
+
+    // Name of the provider the reply came from, which failover or hedging may have made
+    // another than the preferred one. Empty until the reply is complete, or if it is empty.
+    std::string provider() const;
+
+    // Aborts the sockets of the providers working on the request. Once it returns no callback
+    // of the request runs anymore, so it must not be called from one.
+    void Cancel() {
+        router_->Cancel(turn_);
+        future_.wait();  // The loop resolves the turn after the last callback it made for it
+    }
+
+   private:
+    friend class LlmRouter;
+
+    PendingReply(LlmRouter* router, std::shared_ptr<LlmRouter::Turn> turn, std::shared_future<std::string> future)
+        : router_(router), turn_(turn), future_(future) {}
+
+    LlmRouter* router_;
+    std::shared_ptr<LlmRouter::Turn> turn_;
+    std::shared_future<std::string> future_;
+};
+
+#endif  // LLM_ROUTER_H
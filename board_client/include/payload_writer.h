@@ -0,0 +1,56 @@
+#ifndef PAYLOAD_WRITER_H
+#define PAYLOAD_WRITER_H
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+
+// Growable output buffer for request bodies. Clear() keeps the allocation so that a writer
+// owned by a long-lived object reaches a steady state with no allocation per request.
+// JSON string escaping sizes the output first and writes straight into the buffer.
+class PayloadWriter {
+   public:
+    static constexpr size_t INITIAL_CAPACITY = 4096;
+
+    PayloadWriter() : size_(0), capacity_(0) {}
+
+    PayloadWriter(const PayloadWriter&) = delete;
+    PayloadWriter& operator=(const PayloadWriter&) = delete;
+
+    void Clear() { size_ = 0; }
+
+    void Reserve(size_t capacity);
+
+    void Append(const char* data, size_t len);
+
+    void Append(const std::string& str) { Append(str.data(), str.size()); }
+
+    template <size_t N>
+    void AppendLiteral(const char (&literal)[N]) {
+        Append(literal, N - 1);
+    }
+
+    // Appends data escaped for use inside a JSON string literal (without the quotes).
+    void AppendEscaped(const char* data, size_t len);
+
+    void AppendEscaped(const std::string& str) { AppendEscaped(str.data(), str.size()); }
+
+    // Returns space for len bytes at the end of the buffer; Commit() then publishes the
+    // number actually written.
+    char* Prepare(size_t len);
+    void Commit(size_t len) { size_ += len; }
+
+    // Exact length of data once JSON escaped.
+    static size_t EscapedSize(const char* data, size_t len);
+
+    const char* data() const { return buffer_.get(); }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+
+   private:
+    std::unique_ptr<char[]> buffer_;
+    size_t size_;
+    size_t capacity_;
+};
+
+#endif  // PAYLOAD_WRITER_H
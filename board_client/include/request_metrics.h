@@ -0,0 +1,108 @@
+#ifndef REQUEST_METRICS_H
+#define REQUEST_METRICS_H
+
+#include <time.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+inline double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Where the time of one request went.
+struct RequestTimings {
+    enum Phase {
+        DNS,
+        CONNECT,        // TCP connect, to the proxy when there is one
+        PROXY_CONNECT,  // CONNECT exchange with the proxy
+        HANDSHAKE,
+        WRITE,
+        FIRST_BYTE,  // From the end of the write to the first byte of the response
+        BODY,        // From the first to the last byte of the response
+        PARSE,       // Spent in the response parser and its callbacks, part of FIRST_BYTE and BODY
+        TOTAL,
+        PHASE_COUNT
+    };
+
+    static const char* PhaseName(Phase phase);
+
+    double ms[PHASE_COUNT];  // Negative for phases that did not happen, e.g. DNS on a reused connection
+    size_t bytes_sent;       // Request header and body
+    size_t bytes_received;   // Response as read off the TLS connection
+    bool reused;
+
+    RequestTimings() : bytes_sent(0), bytes_received(0), reused(false) {
+        for (double& phase : ms)
+            phase = -1;
+    }
+};
+
+// Counts of durations in fixed buckets, so that percentiles can be read off without keeping
+// the samples.
+class LatencyHistogram {
+   public:
+    static constexpr size_t BUCKET_COUNT = 15;
+    static const double BUCKET_BOUNDS_MS[BUCKET_COUNT - 1];  // Upper bounds, the last bucket is open
+
+    LatencyHistogram() : buckets_(), count_(0), sum_ms_(0), max_ms_(0) {}
+
+    void Record(double ms);
+
+    // Upper bound of the bucket that holds quantile q (0..1), or max() for the open bucket.
+    double Percentile(double q) const;
+
+    size_t count() const { return count_; }
+    double mean() const { return count_ ? sum_ms_ / count_ : 0; }
+    double max() const { return max_ms_; }
+
+    // Writes the non-empty buckets as "<=bound:count".
+    void DumpBuckets(std::ostream& out) const;
+
+   private:
+    size_t buckets_[BUCKET_COUNT];
+    size_t count_;
+    double sum_ms_;
+    double max_ms_;
+};
+
+// Per-phase latency histograms and transfer totals of the LLM requests of the whole process,
+// per provider. Dumped on demand, or appended to a log file every so often as requests finish.
+class RequestMetrics {
+   public:
+    static RequestMetrics& Instance();
+
+    RequestMetrics(const RequestMetrics&) = delete;
+    RequestMetrics& operator=(const RequestMetrics&) = delete;
+
+    void Record(const std::string& provider, const RequestTimings& timings);
+
+    void Dump(std::ostream& out);
+
+    // Appends a dump to path when a request finishes at least interval_sec after the previous
+    // one. An empty path turns it off.
+    void set_log_file(const std::string& path, int interval_sec);
+
+   private:
+    struct ProviderMetrics {
+        LatencyHistogram phases[RequestTimings::PHASE_COUNT];
+        size_t requests = 0;
+        size_t reused = 0;
+        size_t bytes_sent = 0;
+        size_t bytes_received = 0;
+    };
+
+    RequestMetrics() : log_interval_sec_(0), last_log_(0) {}
+
+    void DumpLocked(std::ostream& out);
+
+    std::map<std::string, ProviderMetrics> providers_;
+    std::string log_path_;
+    int log_interval_sec_;
+    time_t last_log_;
+    std::mutex mutex_;
+};
+
+#endif  // REQUEST_METRICS_H
@@ -0,0 +1,68 @@
+#include <stddef.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "llm_provider.h"
+#include "sqlite3.h"
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+// Replies to questions asked before, stored in the chat record database. The key is a hash of
+// the provider, the model, the last few messages before the question and the question itself,
+// all normalized so that case, spacing and trailing punctuation do not matter. Turns with an
+// image are never cached.
+class ResponseCache {
+    sqlite3* db_;
+    std::string db_path_;
+    bool enabled_;
+    int ttl_sec_;
+    size_t max_entries_;
+
+    size_t hits_;
+    size_t misses_;
+
+    // Hex SHA-256 of the normalized key material, or an empty string if the turn is not cacheable.
+    static std::string MakeKey(const std::string& provider,
+                               const std::string& model,
+                               const std::vector<ConversationMessage>& conversation_data);
+
+    // Drops expired entries, then the least recently used ones above max_entries_.
+    void Evict(time_t now);
+
+   public:
+    static constexpr int DEFAULT_TTL_SEC = 6 * 3600;
+    static constexpr size_t DEFAULT_MAX_ENTRIES = 500;
+    static constexpr size_t CONTEXT_MESSAGES = 2;  // Messages before the question that are part of the key
+
+    explicit ResponseCache(std::string db_path);
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // Opens the database and creates the cache table. Returns an SQLite result code.
+    int InitDatabase();
+
+    // Looks up the reply to the last message of conversation_data. Returns false on a miss.
+    bool Lookup(const std::string& provider,
+                const std::string& model,
+                const std::vector<ConversationMessage>& conversation_data,
+                std::string& response);
+
+    // Remembers response as the reply to the last message of conversation_data.
+    void Store(const std::string& provider,
+               const std::string& model,
+               const std::vector<ConversationMessage>& conversation_data,
+               const std::string& response);
+
+    void set_enabled(bool enabled) { enabled_ = enabled; }
+    void set_ttl_sec(int ttl_sec) { ttl_sec_ = ttl_sec; }
+    void set_max_entries(size_t max_entries) { max_entries_ = max_entries; }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+};
+
+#endif  // RESPONSE_CACHE_H
@@ -0,0 +1,37 @@
+#ifndef SSE_DECODER_H
+#define SSE_DECODER_H
+
+#include <functional>
+#include <string>
+
+// Incremental text/event-stream decoder. Body bytes can be fed in arbitrary pieces; each
+// complete event is handed to the callback with its "data:" lines joined by '\n'.
+class SseDecoder {
+   public:
+    typedef std::function<void(const std::string& event, const std::string& data)> EventCallback;
+
+    static constexpr size_t MAX_EVENT_SIZE = 1024 * 1024;
+
+    explicit SseDecoder(EventCallback callback);
+
+    // Returns false once the stream exceeds MAX_EVENT_SIZE without an event boundary.
+    bool Feed(const char* data, size_t len);
+
+    // Dispatches a last event that was not terminated by a blank line.
+    void Finish();
+
+    void Reset();
+
+   private:
+    void ProcessLine();
+    void Dispatch();
+
+    EventCallback callback_;
+    std::string line_;
+    std::string event_;
+    std::string data_;
+    bool has_data_;
+    bool skip_lf_;  // Previous line ended with '\r', a following '\n' belongs to it
+};
+
+#endif  // SSE_DECODER_H
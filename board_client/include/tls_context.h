@@ -0,0 +1,35 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <openssl/ssl.h>
+
+// Trust store used unless the SSL_CERT_FILE environment variable names another one
+#define CA_BUNDLE_FILE "/etc/ssl/certs/ca-certificates.crt"
+
+// The SSL_CTX shared by every connection of the process. It is set up once, on first use:
+// the CA bundle is parsed a single time, server certificates are verified, and ChaCha20-Poly1305
+// and X25519 are preferred because the Cortex-A7 has no AES or fast P-256 instructions.
+// Hostnames are checked per connection, see ConnectionPool::Connect().
+class TlsContext {
+   public:
+    static TlsContext& Instance();
+
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // nullptr if the context could not be created.
+    SSL_CTX* ctx() const { return ctx_; }
+
+    // False when no CA bundle could be loaded, every handshake will then fail verification.
+    bool has_trust_store() const { return has_trust_store_; }
+
+   private:
+    TlsContext();
+
+    SSL_CTX* ctx_;
+    bool has_trust_store_;
+};
+
+#endif  // TLS_CONTEXT_H
@@ -0,0 +1,60 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <openssl/ssl.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per-host cache of TLS sessions (TLS 1.3 tickets or TLS 1.2 session IDs) so that a new
+// connection to a known provider can resume instead of doing a full handshake. The cache
+// can optionally be persisted to a small file, readable by the owner only, to survive
+// application restarts.
+class TlsSessionCache {
+   public:
+    static constexpr size_t MAX_SESSIONS_PER_HOST = 2;
+
+    TlsSessionCache() = default;
+    ~TlsSessionCache();
+
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    // Registers the new-session callback on ctx. Sessions of a connection only reach a cache
+    // that was attached to it.
+    static void Install(SSL_CTX* ctx);
+
+    // Routes the sessions the server hands out on ssl to this cache.
+    void Attach(SSL* ssl);
+
+    // Enables persistence and loads previously saved sessions from path.
+    void SetPersistPath(const std::string& path);
+
+    // Sets a cached session for host on ssl before the handshake. Returns the maximum
+    // number of early data bytes the session allows, 0 if none, or -1 if nothing is cached.
+    long Apply(SSL* ssl, const std::string& host);
+
+    void Clear();
+
+    // Writes the sessions to the persist path if they changed since the last call. Storing
+    // and taking sessions happens during handshakes, on the path of a request, so the file
+    // is only written from here.
+    void Flush();
+
+   private:
+    static int NewSessionCallback(SSL* ssl, SSL_SESSION* session);
+
+    void Store(const std::string& host, SSL_SESSION* session);
+    void DropExpiredLocked();
+    void Load();
+    std::string SerializeLocked() const;
+
+    std::map<std::string, std::vector<SSL_SESSION*>> sessions_;  // Newest last
+    std::string persist_path_;
+    bool dirty_ = false;  // Changed since the file was written
+    std::mutex mutex_;
+    std::mutex flush_mutex_;  // Keeps writes of the file in order, taken before mutex_
+};
+
+#endif  // TLS_SESSION_CACHE_H
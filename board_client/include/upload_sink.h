@@ -0,0 +1,55 @@
+#ifndef UPLOAD_SINK_H
+#define UPLOAD_SINK_H
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+
+// Where ClientReceiver delivers the body of a sink route instead of a file or a string. The
+// calls come on the receiver's thread: Begin() once the head is parsed, Write() with the body
+// content as it arrives, then Finish() once it is complete or Abort() if it never will be.
+class UploadSink {
+   public:
+    virtual ~UploadSink() = default;
+
+    // size is the Content-Length, -1 for a chunked body. Returns false to refuse the upload.
+    virtual bool Begin(long size) = 0;
+    // Returns false when the body does not fit.
+    virtual bool Write(const char* data, size_t len) = 0;
+    virtual void Finish() = 0;
+    virtual void Abort() = 0;
+};
+
+// Sink that keeps one body in a buffer allocated once, so a reply is handed to playback
+// without touching the disk or the allocator. The body stays held from Finish() until the
+// consumer calls Release(), uploads meanwhile are refused.
+class BufferSink : public UploadSink {
+   public:
+    explicit BufferSink(size_t capacity);
+
+    BufferSink(const BufferSink&) = delete;
+    BufferSink& operator=(const BufferSink&) = delete;
+
+    bool Begin(long size) override;
+    bool Write(const char* data, size_t len) override;
+    void Finish() override;
+    void Abort() override;
+
+    // The last completed body, valid until Release().
+    const char* data() const { return buffer_.get(); }
+    size_t size() const { return size_; }
+
+    // Frees the buffer for the next upload. A body still being received is left alone.
+    void Release();
+
+   private:
+    enum State { FREE, FILLING, HELD };
+
+    std::unique_ptr<char[]> buffer_;  // Not initialized, pages are only touched as they fill
+    size_t capacity_;
+    size_t size_;
+    State state_;
+    std::mutex mutex_;
+};
+
+#endif  // UPLOAD_SINK_H
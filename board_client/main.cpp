@@ -1,9 +1,14 @@
 #include <QApplication>
+#include <signal.h>
 #include <iostream>
 
 #include "chat_window.h"
 
 int main(int argc, char* argv[]) {
+    // Writing to a kept-alive connection the server has already dropped, or to an aplay that
+    // exited, must fail with EPIPE instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+
     QApplication a(argc, argv);
     ChatWindow w;
     w.show();
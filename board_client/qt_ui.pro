@@ -12,6 +12,9 @@ QMAKE_CFLAGS += -D_DEFAULT_SOURCE
 
 DEFINES += QT_DEPRECATED_WARNINGS
 
+# Cortex-A7 上启用 NEON（json_string.cpp 等的向量化路径）
+contains(QT_ARCH, arm): QMAKE_CXXFLAGS += -mfpu=neon-vfpv4
+
 SOURCES += \
     main.cpp \
     $$files(src/*.cpp, true) \
@@ -31,6 +34,7 @@ INCLUDEPATH += include
 INCLUDEPATH += $$PWD/extern/openssl-3.0.14/include
 INCLUDEPATH += $$PWD/extern/jpeg-9e
 INCLUDEPATH += $$PWD/extern/sqlite
+INCLUDEPATH += $$PWD/extern/nghttp2/lib/includes
 
 # 库路径和链接
 LIBS += -L$$PWD/extern/openssl-3.0.14 \
@@ -39,6 +43,12 @@ LIBS += -L$$PWD/extern/openssl-3.0.14 \
 
 LIBS += -L$$PWD/extern/jpeg-9e/.libs -ljpeg
 
+# 请求与响应的 gzip 压缩
+LIBS += -lz
+
+# 与服务器协商 HTTP/2 时使用的 nghttp2
+LIBS += -L$$PWD/extern/nghttp2/lib/.libs -lnghttp2
+
 # 静态库需要添加依赖库（根据实际需要）
 unix:!macx: LIBS += -ldl -lpthread
 
@@ -0,0 +1,113 @@
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BASE64_NEON
+#endif
+
+#include "base64.h"
+
+static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#if defined(BASE64_NEON)
+
+// Maps 6-bit values to the alphabet by adding a per-range offset. ARMv7 has no 64-entry
+// table lookup, so the offset is picked with compares instead.
+static inline uint8x16_t NeonEncodeSextets(uint8x16_t idx) {
+    uint8x16_t offset = vdupq_n_u8('A');
+    offset = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(26)), vdupq_n_u8('a' - 26), offset);
+    offset = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(52)), vdupq_n_u8(static_cast<uint8_t>('0' - 52)), offset);
+    offset = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(62)), vdupq_n_u8(static_cast<uint8_t>('+' - 62)), offset);
+    offset = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(63)), vdupq_n_u8(static_cast<uint8_t>('/' - 63)), offset);
+    return vaddq_u8(idx, offset);
+}
+
+// Encodes whole 48 byte blocks, returns the number of input bytes consumed.
+static size_t EncodeBlocks(const unsigned char* data, size_t len, char* out) {
+    const uint8x16_t low6 = vdupq_n_u8(0x3F);
+    size_t i = 0;
+    for (; i + 48 <= len; i += 48) {
+        // De-interleaves so that lane n of a, b, c holds the n-th 3 byte group
+        uint8x16x3_t in = vld3q_u8(data + i);
+        uint8x16_t a = in.val[0];
+        uint8x16_t b = in.val[1];
+        uint8x16_t c = in.val[2];
+
+        uint8x16x4_t sextets;
+        sextets.val[0] = vshrq_n_u8(a, 2);
+        sextets.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(a, 4), vshrq_n_u8(b, 4)), low6);
+        sextets.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(b, 2), vshrq_n_u8(c, 6)), low6);
+        sextets.val[3] = vandq_u8(c, low6);
+
+        uint8x16x4_t encoded;
+        for (int k = 0; k < 4; k++)
+            encoded.val[k] = NeonEncodeSextets(sextets.val[k]);
+        vst4q_u8(reinterpret_cast<uint8_t*>(out) + i / 3 * 4, encoded);
+    }
+    return i;
+}
+
+#else
+
+static size_t EncodeBlocks(const unsigned char*, size_t, char*) {
+    return 0;
+}
+
+#endif
+
+size_t Base64Encode(const unsigned char* data, size_t len, char* out) {
+    size_t i = EncodeBlocks(data, len, out);
+    char* o = out + i / 3 * 4;
+
+    for (; i + 3 <= len; i += 3) {
+        uint32_t group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        o[0] = kAlphabet[group >> 18];
+        o[1] = kAlphabet[(group >> 12) & 0x3F];
+        o[2] = kAlphabet[(group >> 6) & 0x3F];
+        o[3] = kAlphabet[group & 0x3F];
+        o += 4;
+    }
+
+    if (i < len) {
+        uint32_t group = data[i] << 16;
+        if (i + 1 < len)
+            group |= data[i + 1] << 8;
+        o[0] = kAlphabet[group >> 18];
+        o[1] = kAlphabet[(group >> 12) & 0x3F];
+        o[2] = i + 1 < len ? kAlphabet[(group >> 6) & 0x3F] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+
+    return o - out;
+}
+
+size_t Base64Encoder::Update(const unsigned char* data, size_t len, char* out) {
+    size_t written = 0;
+
+    // Complete the group left over from the previous call
+    if (carry_len_ > 0) {
+        while (carry_len_ < 3 && len > 0) {
+            carry_[carry_len_++] = *data++;
+            len--;
+        }
+        if (carry_len_ < 3)
+            return 0;
+        written = Base64Encode(carry_, 3, out);
+        carry_len_ = 0;
+    }
+
+    size_t whole = len - len % 3;
+    written += Base64Encode(data, whole, out + written);
+
+    carry_len_ = len - whole;
+    for (size_t i = 0; i < carry_len_; i++)
+        carry_[i] = data[whole + i];
+    return written;
+}
+
+size_t Base64Encoder::Finish(char* out) {
+    size_t written = Base64Encode(carry_, carry_len_, out);
+    carry_len_ = 0;
+    return written;
+}
@@ -3,11 +3,26 @@
 #include <string.h>
 #include <ctime>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
 #include "chat_record.h"
 
+static std::mutex listeners_mutex;
+static std::vector<ChatRecordDB::ChangeListener> listeners;
+
+void ChatRecordDB::AddChangeListener(ChangeListener listener) {
+    std::lock_guard<std::mutex> lock(listeners_mutex);
+    listeners.push_back(listener);
+}
+
+void ChatRecordDB::NotifyChanged(int conversation_id) {
+    std::lock_guard<std::mutex> lock(listeners_mutex);
+    for (const ChangeListener& listener : listeners)
+        listener(conversation_id);
+}
+
 ChatRecordDB::ChatRecordDB(std::string db_path) : db_path_(db_path) {}
 
 int ChatRecordDB::InitDatabase() {
@@ -291,6 +306,7 @@ int ChatRecordDB::DeleteConversation(int conversation_id) {
         int changes = sqlite3_changes(db_);
         if (changes > 0) {
             printf("Deleted conversation ID %d with %d associated messages\n", conversation_id, msg_count);
+            NotifyChanged(conversation_id);
         } else {
             printf("No conversation found with ID %d\n", conversation_id);
         }
@@ -301,10 +317,24 @@ int ChatRecordDB::DeleteConversation(int conversation_id) {
 }
 
 int ChatRecordDB::DeleteMessageByID(int message_id) {
+    // Look up the conversation first so that its listeners can be told
+    const char* conv_sql = "SELECT conversation_id FROM messages WHERE id = ?;";
+    sqlite3_stmt* conv_stmt;
+    int conversation_id = -1;
+
+    int rc = sqlite3_prepare_v2(db_, conv_sql, -1, &conv_stmt, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int(conv_stmt, 1, message_id);
+        if (sqlite3_step(conv_stmt) == SQLITE_ROW) {
+            conversation_id = sqlite3_column_int(conv_stmt, 0);
+        }
+        sqlite3_finalize(conv_stmt);
+    }
+
     const char* sql = "DELETE FROM messages WHERE id = ?;";
     sqlite3_stmt* stmt;
 
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL);
+    rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Prepare delete message failed: %s\n", sqlite3_errmsg(db_));
         return rc;
@@ -318,6 +348,8 @@ int ChatRecordDB::DeleteMessageByID(int message_id) {
     } else {
         int changes = sqlite3_changes(db_);
         printf("Deleted message ID %d with %d changes\n", message_id, changes);
+        if (changes > 0 && conversation_id >= 0)
+            NotifyChanged(conversation_id);
     }
 
     sqlite3_finalize(stmt);
@@ -1,27 +1,68 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <sstream>
 
 #include <iostream>
 #include "client_receiver.h"
 
+// std::chrono binds this to a reference, so it needs a definition
+constexpr int ClientReceiver::IDLE_TIMEOUT_SEC;
+
+// CPU time of the calling thread, time spent waiting on the socket does not count
+static int64_t ThreadCpuMicroseconds() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// write() may take only part of the data
+static bool WriteFile(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("write() failed");
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void ClosePipe(int fds[2]) {
+    if (fds[0] != -1) {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
 ClientReceiver::ClientReceiver(int port) : listen_socket_(-1) {
-    listen_socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    listen_socket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (listen_socket_ < 0) {
         perror("socket() failed");
+        return;
     }
 
     int opt = 1;
     if (setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
         perror("setsockopt() failed");
         close(listen_socket_);
+        listen_socket_ = -1;
+        return;
     }
 
     struct sockaddr_in addr;
@@ -33,40 +74,86 @@ ClientReceiver::ClientReceiver(int port) : listen_socket_(-1) {
     if (bind(listen_socket_, (struct sockaddr*)&addr, sizeof(addr))) {
         perror("bind() failed");
         close(listen_socket_);
+        listen_socket_ = -1;
+        return;
     }
 
     if (listen(listen_socket_, MAX_PENDING_CONNECTIONS) < 0) {
         perror("listen() failed");
         close(listen_socket_);
+        listen_socket_ = -1;
     }
 }
 
 ClientReceiver::~ClientReceiver() {
+    if (thread_.joinable()) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) != sizeof(one))
+            perror("eventfd write failed");
+        thread_.join();
+    }
+
+    while (!connections_.empty())
+        CloseConnection(connections_.begin()->first);
+    if (epoll_fd_ != -1)
+        close(epoll_fd_);
+    if (wake_fd_ != -1)
+        close(wake_fd_);
     if (listen_socket_ != -1) {
         close(listen_socket_);
     }
 }
 
-int ClientReceiver::SendAll(int sockfd, const char* buf, size_t len) {
-    size_t sent = 0;
-    while (sent < len) {
-        ssize_t n;
-        do {
-            n = send(sockfd, buf + sent, len - sent, MSG_NOSIGNAL);
-        } while (n == -1 && errno == EINTR);
+void ClientReceiver::AddRoute(const std::string& path, long max_size, RouteHandler handler) {
+    routes_[path] = Route{"", nullptr, max_size, handler, false};
+}
+
+void ClientReceiver::AddFileRoute(const std::string& path,
+                                  const std::string& file_path,
+                                  long max_size,
+                                  RouteHandler handler) {
+    routes_[path] = Route{file_path, nullptr, max_size, handler, false};
+}
+
+void ClientReceiver::AddSinkRoute(const std::string& path, UploadSink* sink, long max_size, RouteHandler handler) {
+    routes_[path] = Route{"", sink, max_size, handler, false};
+}
 
-        if (n <= 0)
-            return -1;
-        sent += n;
+bool ClientReceiver::Start() {
+    if (listen_socket_ < 0)
+        return false;
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        perror("epoll setup failed");
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+        perror("epoll_ctl() failed");
+        return false;
     }
-    return 0;
+
+    receive_buffer_.resize(RECEIVE_BUFFER_SIZE);
+    UpdateListening();
+    thread_ = std::thread(&ClientReceiver::Loop, this);
+    return true;
 }
 
-void ClientReceiver::SendErrorResponse(int sockfd, int code, const std::string& message) {
+std::string ClientReceiver::ErrorResponse(int code, const std::string& message) {
     const std::string status_lines[] = {
         "HTTP/1.1 400 Bad Request",
+        "HTTP/1.1 404 Not Found",
+        "HTTP/1.1 405 Method Not Allowed",
         "HTTP/1.1 411 Length Required",
         "HTTP/1.1 413 Payload Too Large",
+        "HTTP/1.1 431 Request Header Fields Too Large",
+        "HTTP/1.1 501 Not Implemented",
         "HTTP/1.1 500 Internal Server Error",
     };
 
@@ -75,15 +162,27 @@ void ClientReceiver::SendErrorResponse(int sockfd, int code, const std::string&
         case 400:
             status_line = status_lines[0];
             break;
-        case 411:
+        case 404:
             status_line = status_lines[1];
             break;
-        case 413:
+        case 405:
             status_line = status_lines[2];
             break;
-        default:
+        case 411:
             status_line = status_lines[3];
             break;
+        case 413:
+            status_line = status_lines[4];
+            break;
+        case 431:
+            status_line = status_lines[5];
+            break;
+        case 501:
+            status_line = status_lines[6];
+            break;
+        default:
+            status_line = status_lines[7];
+            break;
     }
 
     std::string headers = status_line +
@@ -94,221 +193,442 @@ void ClientReceiver::SendErrorResponse(int sockfd, int code, const std::string&
                           std::to_string(message.size()) + "\r\n\r\n" + message;
 
     if (headers.size() > MAX_ERROR_MSG) {
-        const char* fallback =
-            "HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\nContent-Length: 22\r\n\r\nInternal "
-            "server error";
-        SendAll(sockfd, fallback, strlen(fallback));
-    } else {
-        SendAll(sockfd, headers.c_str(), headers.size());
+        return "HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\nContent-Length: 22\r\n\r\nInternal "
+               "server error";
     }
+    return headers;
 }
 
-int ClientReceiver::ParseHeaders(const std::string& headers, RequestInfo& info) {
-    std::istringstream stream(headers);
-    std::string line;
-
-    // Parse request line
-    if (!std::getline(stream, line))
-        return -1;
-    if (line.back() == '\r')
-        line.pop_back();
-
-    size_t pos1 = line.find(' ');
-    if (pos1 == std::string::npos)
-        return -1;
-    info.method = line.substr(0, pos1);
-
-    size_t pos2 = line.find(' ', pos1 + 1);
-    if (pos2 == std::string::npos)
-        return -1;
-    info.uri = line.substr(pos1 + 1, pos2 - pos1 - 1);
-    info.version = line.substr(pos2 + 1);
-
-    if (info.method != "POST")
-        return -1;
-
-    // Parse headers
-    bool found_cl = false;
-    while (std::getline(stream, line)) {
-        if (line.back() == '\r')
-            line.pop_back();
-        if (line.empty())
-            break;
+void ClientReceiver::Loop() {
+    std::vector<struct epoll_event> events(MAX_CONNECTIONS + 2);
+    while (true) {
+        // Wakes up at least once a second to close idle connections
+        int n = epoll_wait(epoll_fd_, events.data(), events.size(), 1000);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait() failed");
+            return;
+        }
 
-        if (line.find("Content-Length:") == 0) {
-            size_t colon = line.find(':');
-            size_t value_start = line.find_first_not_of(" \t", colon + 1);
-            if (value_start == std::string::npos)
-                return -1;
-
-            try {
-                info.content_length = std::stol(line.substr(value_start));
-                found_cl = true;
-            } catch (...) {
-                return -1;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_)
+                return;
+            if (fd == listen_socket_) {
+                Accept();
+                continue;
             }
+
+            auto it = connections_.find(fd);
+            if (it == connections_.end())
+                continue;
+            Connection& conn = *it->second;
+            bool open = conn.state == Connection::WRITING_RESPONSE ? OnWritable(conn) : OnReadable(conn);
+            if (!open)
+                CloseConnection(fd);
         }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::vector<int> idle;
+        for (const auto& entry : connections_) {
+            if (now - entry.second->last_active >= std::chrono::seconds(IDLE_TIMEOUT_SEC))
+                idle.push_back(entry.first);
+        }
+        for (int fd : idle)
+            CloseConnection(fd);
+
+        UpdateListening();
     }
-    return found_cl ? 0 : -1;
 }
 
-int ClientReceiver::ReceiveHeaders(int sockfd, RequestInfo& info) {
-    receive_buffer_.resize(MAX_HEADER_SIZE);
-    size_t received = 0;
-    char* headers_end = nullptr;
+void ClientReceiver::Accept() {
+    while (connections_.size() < MAX_CONNECTIONS) {
+        int client_sock = accept4(listen_socket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+                perror("accept() failed");
+            return;
+        }
 
-    while (received < MAX_HEADER_SIZE && !headers_end) {
-        ssize_t n = recv(sockfd, &receive_buffer_[received], MAX_HEADER_SIZE - received, 0);
-        if (n <= 0)
-            return -1;
-        received += n;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = client_sock;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            perror("epoll_ctl() failed");
+            close(client_sock);
+            continue;
+        }
 
-        receive_buffer_[received] = '\0';
-        headers_end = strstr(&receive_buffer_[0], "\r\n\r\n");
+        std::unique_ptr<Connection> conn(new Connection());
+        conn->fd = client_sock;
+        conn->last_active = std::chrono::steady_clock::now();
+        connections_[client_sock] = std::move(conn);
     }
+}
 
-    if (!headers_end)
-        return -1;
+bool ClientReceiver::OnReadable(Connection& conn) {
+    if (conn.state == Connection::DRAINING) {
+        ssize_t n = recv(conn.fd, receive_buffer_.data(), receive_buffer_.size(), 0);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        return n > 0;
+    }
+
+    if (conn.state == Connection::READING_HEAD) {
+        if (conn.head.empty())
+            conn.head.resize(MAX_HEADER_SIZE);
+
+        ssize_t n = recv(conn.fd, &conn.head[conn.head_len], MAX_HEADER_SIZE - conn.head_len, 0);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (n == 0)
+            return false;
+        conn.head_len += n;
+        conn.last_active = std::chrono::steady_clock::now();
+
+        long head_size = conn.parser.ParseHead(conn.head.data(), conn.head_len);
+        if (head_size < 0)
+            Respond(conn, ErrorResponse(conn.parser.error_status(), "Malformed request head"));
+        else if (head_size > 0)
+            StartRequest(conn, head_size);
+        else if (conn.head_len == MAX_HEADER_SIZE)
+            Respond(conn, ErrorResponse(431, "Header too large"));
+        return true;
+    }
+
+    if (conn.pipe_fds[0] != -1)
+        return SpliceBody(conn);
+
+    ssize_t n = recv(conn.fd, receive_buffer_.data(), receive_buffer_.size(), 0);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    if (n == 0) {
+        Respond(conn, ErrorResponse(400, "Incomplete body"));
+        return true;
+    }
+    conn.last_active = std::chrono::steady_clock::now();
+    ReceiveBody(conn, receive_buffer_.data(), n);
+    return true;
+}
 
-    info.header_len = headers_end - &receive_buffer_[0];
-    info.body_start_offset = headers_end + 4 - &receive_buffer_[0];
-    info.initial_body = received - info.body_start_offset;
+bool ClientReceiver::OnWritable(Connection& conn) {
+    while (conn.response_sent < conn.response.size()) {
+        ssize_t n = send(conn.fd, conn.response.data() + conn.response_sent,
+                         conn.response.size() - conn.response_sent, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        conn.response_sent += n;
+        conn.last_active = std::chrono::steady_clock::now();
+    }
 
-    return 0;
+    // Every response closes the connection, once the client has seen the end of it
+    shutdown(conn.fd, SHUT_WR);
+    conn.state = Connection::DRAINING;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = conn.fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev) == 0;
 }
 
-void ClientReceiver::HandleAudioUpload(int sockfd,
-                                        const RequestInfo& info,
-                                        const std::string& file_path,
-                                        long long max_size) {
-    if (info.content_length > max_size) {
-        SendErrorResponse(sockfd, 413, "Payload too large");
+void ClientReceiver::StartRequest(Connection& conn, size_t head_size) {
+    const HttpRequestParser& parser = conn.parser;
+    if (!parser.method().Equals("POST")) {
+        Respond(conn, ErrorResponse(405, "Only POST is supported"));
+        return;
+    }
+    if (parser.content_length() < 0 && !parser.chunked()) {
+        Respond(conn, ErrorResponse(411, "Content-Length required"));
         return;
     }
 
-    FILE* fp = fopen(file_path.c_str(), "wb");
-    if (!fp) {
-        SendErrorResponse(sockfd, 500, "Failed to create file");
+    // A handful of routes, comparing in place saves making a key out of the target
+    Route* route = nullptr;
+    for (auto& entry : routes_) {
+        if (parser.target().Equals(entry.first.c_str()))
+            route = &entry.second;
+    }
+    if (!route) {
+        Respond(conn, ErrorResponse(404, "Not Found"));
+        return;
+    }
+    if (route->writing) {
+        Respond(conn, ErrorResponse(500, "Another upload is in progress"));
         return;
     }
 
-    size_t written = 0;
-    if (info.initial_body > 0) {
-        size_t to_write = std::min(info.initial_body, static_cast<size_t>(info.content_length));
-        if (fwrite(&receive_buffer_[info.body_start_offset], 1, to_write, fp) != to_write) {
-            fclose(fp);
-            remove(file_path.c_str());
-            SendErrorResponse(sockfd, 500, "File write error");
+    conn.route = route;
+    if (parser.content_length() > route->max_size) {
+        Respond(conn, ErrorResponse(413, "Payload too large"));
+        return;
+    }
+    if (!route->file_path.empty()) {
+        if (!OpenUploadFile(conn)) {
+            Respond(conn, ErrorResponse(500, "Failed to create file"));
+            return;
+        }
+        route->writing = true;
+        conn.upload_start = std::chrono::steady_clock::now();
+        conn.upload_cpu_start_us = ThreadCpuMicroseconds();
+    } else if (route->sink) {
+        if (!route->sink->Begin(parser.chunked() ? -1 : parser.content_length())) {
+            Respond(conn, ErrorResponse(500, "Another upload is in progress"));
             return;
         }
-        written += to_write;
+        conn.sink = route->sink;
+    } else if (parser.content_length() > 0) {
+        conn.body.reserve(parser.content_length());
     }
 
-    char buffer[RECEIVE_BUFFER_SIZE];
-    while (written < static_cast<size_t>(info.content_length)) {
-        size_t remain = info.content_length - written;
-        size_t to_read = std::min(remain, sizeof(buffer));
+    // The socket has just been read from and nothing was written to it, the interim
+    // response fits
+    if (parser.expect_continue()) {
+        static const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(conn.fd, kContinue, sizeof(kContinue) - 1, MSG_NOSIGNAL);
+    }
 
-        ssize_t n;
-        do {
-            n = recv(sockfd, buffer, to_read, 0);
-        } while (n == -1 && errno == EINTR);
+    conn.state = Connection::READING_BODY;
+    ReceiveBody(conn, &conn.head[head_size], conn.head_len - head_size);
+}
 
-        if (n <= 0) {
-            fclose(fp);
-            remove(file_path.c_str());
-            SendErrorResponse(sockfd, 400, "Incomplete body");
+void ClientReceiver::ReceiveBody(Connection& conn, const char* data, size_t len) {
+    // Bytes after the body would be a pipelined request, every response closes the connection
+    while (len > 0 && !conn.parser.done()) {
+        ByteView payload;
+        long used = conn.parser.DecodeBody(data, len, payload);
+        if (used < 0) {
+            Respond(conn, ErrorResponse(conn.parser.error_status(), "Malformed chunked body"));
             return;
         }
-
-        if (fwrite(buffer, 1, n, fp) != static_cast<size_t>(n)) {
-            fclose(fp);
-            remove(file_path.c_str());
-            SendErrorResponse(sockfd, 500, "File write error");
+        if (!payload.empty() && !StoreBody(conn, payload))
             return;
-        }
-        written += n;
+        data += used;
+        len -= used;
     }
-
-    fclose(fp);
-    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
-                           std::to_string(file_path.length() + 15) +
-                           "\r\nConnection: close\r\n\r\nFile received: " + file_path;
-    SendAll(sockfd, response.c_str(), response.size());
+    if (conn.parser.done())
+        FinishRequest(conn);
 }
 
-std::string ClientReceiver::HandleTextRequest(int sockfd, RequestInfo& info, size_t max_size) {
-    if (static_cast<size_t>(info.content_length) > max_size) {
-        SendErrorResponse(sockfd, 413, "Payload too large");
-        return "";
+bool ClientReceiver::OpenUploadFile(Connection& conn) {
+    const std::string& path = conn.route->file_path;
+    conn.file_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (conn.file_fd < 0) {
+        perror("open() failed");
+        return false;
     }
 
-    std::string body;
-    body.reserve(info.content_length);
-
-    if (info.initial_body > 0) {
-        size_t to_copy = std::min(info.initial_body, static_cast<size_t>(info.content_length));
-        body.append(&receive_buffer_[info.body_start_offset], to_copy);
+    long length = conn.parser.content_length();
+    if (conn.parser.chunked() || length <= 0)
+        return true;
+
+    // Taking the blocks at once saves growing the file write by write. Not every filesystem
+    // can, those still take the writes
+    if (fallocate(conn.file_fd, 0, 0, length) < 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        perror("fallocate() failed");
+        close(conn.file_fd);
+        conn.file_fd = -1;
+        remove(path.c_str());
+        return false;
     }
 
-    char buffer[RECEIVE_BUFFER_SIZE];
-    while (body.size() < static_cast<size_t>(info.content_length)) {
-        size_t remain = info.content_length - body.size();
-        size_t to_read = std::min(remain, sizeof(buffer));
+    // Without a pipe the body is copied through the receive buffer
+    if (pipe2(conn.pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        perror("pipe2() failed");
+    return true;
+}
 
-        ssize_t n;
-        do {
-            n = recv(sockfd, buffer, to_read, 0);
-        } while (n == -1 && errno == EINTR);
+bool ClientReceiver::SpliceBody(Connection& conn) {
+    while (conn.pipe_fds[0] != -1 && !conn.parser.done()) {
+        size_t want = conn.parser.body_remaining();
+        if (want > SPLICE_CHUNK_SIZE)
+            want = SPLICE_CHUNK_SIZE;
+        ssize_t n = splice(conn.fd, nullptr, conn.pipe_fds[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return true;
+            if (errno != EINVAL)
+                return false;
+            // The socket cannot be spliced from, the rest of the body is copied
+            ClosePipe(conn.pipe_fds);
+            return true;
+        }
+        if (n == 0) {
+            Respond(conn, ErrorResponse(400, "Incomplete body"));
+            return true;
+        }
 
-        if (n <= 0) {
-            SendErrorResponse(sockfd, 400, "Incomplete body");
-            return "";
+        conn.last_active = std::chrono::steady_clock::now();
+        if (!FlushPipe(conn, n)) {
+            Respond(conn, ErrorResponse(500, "File write error"));
+            return true;
         }
-        body.append(buffer, n);
+        conn.spliced += n;
+        conn.parser.SkipBody(n);
     }
-
-    const char* response =
-        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 15\r\nConnection: close\r\n\r\nText "
-        "received.\n";
-    SendAll(sockfd, response, strlen(response));
-    return body;
+    if (conn.parser.done())
+        FinishRequest(conn);
+    return true;
 }
 
-std::string ClientReceiver::HandleRequest(const std::string& file_path) {
+bool ClientReceiver::FlushPipe(Connection& conn, size_t n) {
+    while (n > 0) {
+        ssize_t moved = splice(conn.pipe_fds[0], nullptr, conn.file_fd, nullptr, n, SPLICE_F_MOVE);
+        if (moved > 0) {
+            n -= moved;
+            continue;
+        }
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved == 0 || errno != EINVAL) {
+            perror("splice() failed");
+            return false;
+        }
 
-    struct sockaddr_in client_addr;
-    socklen_t addrlen = sizeof(client_addr);
-    int client_sock = accept(listen_socket_, (struct sockaddr*)&client_addr, &addrlen);
-    if (client_sock < 0) {
-        perror("accept() failed");
-        return "";
+        // The filesystem does not take splice(). What the pipe holds is copied out, the rest
+        // of the body comes through the receive buffer
+        while (n > 0) {
+            ssize_t got = read(conn.pipe_fds[0], receive_buffer_.data(), std::min(n, receive_buffer_.size()));
+            if (got <= 0 || !WriteFile(conn.file_fd, receive_buffer_.data(), got))
+                return false;
+            n -= got;
+        }
+        ClosePipe(conn.pipe_fds);
     }
+    return true;
+}
 
+void ClientReceiver::FinishRequest(Connection& conn) {
+    std::string result;
+    std::string response;
+    if (conn.file_fd != -1) {
+        ClosePipe(conn.pipe_fds);
+        int ret = close(conn.file_fd);
+        conn.file_fd = -1;
+        conn.route->writing = false;
+        if (ret != 0) {
+            remove(conn.route->file_path.c_str());
+            Respond(conn, ErrorResponse(500, "File write error"));
+            return;
+        }
 
-    RequestInfo info;
-    if (ReceiveHeaders(client_sock, info) < 0) {
-        SendErrorResponse(client_sock, 413, "Header too large or incomplete");
-        close(client_sock);
-        return "";
+        // CPU time of the server thread, which serves the other connections meanwhile too
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - conn.upload_start).count();
+        double cpu_ms = (ThreadCpuMicroseconds() - conn.upload_cpu_start_us) / 1000.0;
+        size_t bytes = conn.parser.body_bytes();
+        printf("[Upload] %s: %zu bytes (%zu spliced) in %.3f s, %.2f MB/s, %.2f ms CPU\n",
+               conn.route->file_path.c_str(), bytes, conn.spliced, seconds,
+               seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0, cpu_ms);
+
+        result = conn.route->file_path;
+        response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " +
+                   std::to_string(result.length() + 15) + "\r\nConnection: close\r\n\r\nFile received: " + result;
+    } else if (conn.sink) {
+        conn.sink->Finish();
+        conn.sink = nullptr;
+        response =
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 15\r\nConnection: close\r\n\r\nData "
+            "received.\n";
+    } else {
+        result.swap(conn.body);
+        response =
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 15\r\nConnection: close\r\n\r\nText "
+            "received.\n";
     }
 
-    std::string headers_str(receive_buffer_.begin(), receive_buffer_.begin() + info.header_len);
-    if (ParseHeaders(headers_str, info) < 0) {
-        SendErrorResponse(client_sock, 411, "Content-Length required");
-        close(client_sock);
-        return "";
+    // The route has its result, Respond() is not to report the request as failed
+    Route* route = conn.route;
+    conn.route = nullptr;
+    if (route->handler)
+        route->handler(true, result);
+    Respond(conn, response);
+}
+
+bool ClientReceiver::StoreBody(Connection& conn, const ByteView& payload) {
+    // A chunked body only shows its size as it arrives
+    if (static_cast<long>(conn.parser.body_bytes()) > conn.route->max_size) {
+        Respond(conn, ErrorResponse(413, "Payload too large"));
+        return false;
     }
 
-    std::string result;
-    if (info.uri == "/upload/audio") {
-        HandleAudioUpload(client_sock, info, file_path, MAX_AUDIO_SIZE);
-    } else if (info.uri == "/upload/text") {
-        result = HandleTextRequest(client_sock, info, MAX_TEXT_SIZE);
+    if (conn.file_fd != -1) {
+        if (!WriteFile(conn.file_fd, payload.data, payload.size)) {
+            Respond(conn, ErrorResponse(500, "File write error"));
+            return false;
+        }
+    } else if (conn.sink) {
+        if (!conn.sink->Write(payload.data, payload.size)) {
+            Respond(conn, ErrorResponse(413, "Payload too large"));
+            return false;
+        }
     } else {
-        SendErrorResponse(client_sock, 404, "Not Found");
+        conn.body.append(payload.data, payload.size);
+    }
+    return true;
+}
+
+void ClientReceiver::Respond(Connection& conn, const std::string& response) {
+    // A finished upload was handed over already, any other is answered with an error. It is
+    // dropped now rather than once the client closes the connection
+    DiscardUpload(conn);
+
+    conn.response = response;
+    conn.response_sent = 0;
+    conn.state = Connection::WRITING_RESPONSE;
+
+    // Nothing more is read from a connection that is being answered
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+void ClientReceiver::CloseConnection(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end())
+        return;
+
+    DiscardUpload(*it->second);
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections_.erase(it);
+}
+
+void ClientReceiver::DiscardUpload(Connection& conn) {
+    if (!conn.route)
+        return;
+
+    if (conn.file_fd != -1) {
+        ClosePipe(conn.pipe_fds);
+        close(conn.file_fd);
+        conn.file_fd = -1;
+        remove(conn.route->file_path.c_str());
+        conn.route->writing = false;
+    }
+    if (conn.sink) {
+        conn.sink->Abort();
+        conn.sink = nullptr;
     }
 
-    close(client_sock);
-    return result;
+    // Whoever waits for the route's result would wait forever otherwise
+    Route* route = conn.route;
+    conn.route = nullptr;
+    if (route->handler)
+        route->handler(false, "");
+}
+
+void ClientReceiver::UpdateListening() {
+    bool listen = connections_.size() < MAX_CONNECTIONS;
+    if (listen == listening_)
+        return;
+
+    // Connections beyond the limit wait in the kernel's backlog
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_socket_;
+    if (epoll_ctl(epoll_fd_, listen ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listen_socket_, &ev) == 0)
+        listening_ = listen;
 }
@@ -1,6 +1,7 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -15,51 +16,116 @@
 
 ClientSender::ClientSender(const std::string& ip_address, int port) : ip_address_(ip_address), port_(port) {}
 
-int ClientSender::AudioSend(const std::string& wav_file_path, const std::string& request_path) {
-    int sockfd = -1;
+ClientSender::~ClientSender() {
+    CloseWarm();
+}
+
+void ClientSender::CloseWarm() {
+    if (warm_fd_ >= 0)
+        close(warm_fd_);
+    warm_fd_ = -1;
+}
+
+void ClientSender::Prewarm() {
+    // A recent one is still good
+    if (CloseExpired() >= 0)
+        return;
+
     struct sockaddr_in server_addr;
-    FILE* wav_file = nullptr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port_);
+    if (inet_pton(AF_INET, ip_address_.c_str(), &server_addr.sin_addr) <= 0)
+        return;
 
-    // Get file stats
-    struct stat file_stat;
-    if (stat(wav_file_path.c_str(), &file_stat) < 0) {
-        perror("Error getting file stats");
-        return -1;
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return;
+    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        close(sockfd);
+        return;
     }
-    const long file_size = file_stat.st_size;
+    warm_fd_ = sockfd;
+    warm_since_ = time(nullptr);
+}
 
-    // Open WAV file
-    wav_file = fopen(wav_file_path.c_str(), "rb");
-    if (!wav_file) {
-        perror("Error opening WAV file");
+int ClientSender::CloseExpired() {
+    if (warm_fd_ < 0)
         return -1;
+    time_t left = warm_since_ + WARM_TIMEOUT_SEC - time(nullptr);
+    if (left > 0)
+        return static_cast<int>(left) * 1000;
+    CloseWarm();
+    return -1;
+}
+
+int ClientSender::Connect() {
+    int sockfd = warm_fd_;
+    warm_fd_ = -1;
+    if (sockfd >= 0 && time(nullptr) - warm_since_ < WARM_TIMEOUT_SEC) {
+        // Waits a little for a connect still in flight, a fresh one is tried after that.
+        // Readable before anything was sent means the server closed it or the connect failed.
+        struct pollfd pfd = {sockfd, POLLOUT, 0};
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (poll(&pfd, 1, WARM_CONNECT_WAIT_MS) == 1 && !(pfd.revents & (POLLIN | POLLERR | POLLHUP)) &&
+            getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) {
+            fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+            return sockfd;
+        }
     }
+    if (sockfd >= 0)
+        close(sockfd);
 
     // Create socket
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("Error creating socket");
-        fclose(wav_file);
         return -1;
     }
 
     // Configure server address
+    struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port_);
     if (inet_pton(AF_INET, ip_address_.c_str(), &server_addr.sin_addr) <= 0) {
         perror("Invalid address");
-        fclose(wav_file);
         close(sockfd);
         return -1;
     }
 
-    // Connect to server
     if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Connection failed");
-        fclose(wav_file);
         close(sockfd);
         return -1;
     }
+    return sockfd;
+}
+
+int ClientSender::AudioSend(const std::string& wav_file_path, const std::string& request_path) {
+    int sockfd = -1;
+    FILE* wav_file = nullptr;
+
+    // Get file stats
+    struct stat file_stat;
+    if (stat(wav_file_path.c_str(), &file_stat) < 0) {
+        perror("Error getting file stats");
+        return -1;
+    }
+    const long file_size = file_stat.st_size;
+
+    // Open WAV file
+    wav_file = fopen(wav_file_path.c_str(), "rb");
+    if (!wav_file) {
+        perror("Error opening WAV file");
+        return -1;
+    }
+
+    // Connect to server
+    if ((sockfd = Connect()) < 0) {
+        fclose(wav_file);
+        return -1;
+    }
 
     // Build HTTP header
     std::stringstream header_stream;
@@ -114,30 +180,10 @@ int ClientSender::AudioSend(const std::string& wav_file_path, const std::string&
 
 int ClientSender::LlmReponseSend(const std::string& text_to_send, const std::string& request_path) {
     int sockfd = -1;
-    struct sockaddr_in server_addr;
-
-    // Create socket
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("Error creating socket");
-        return -1;
-    }
-
-    // Configure server address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port_);
-    if (inet_pton(AF_INET, ip_address_.c_str(), &server_addr.sin_addr) <= 0) {
-        perror("Invalid address");
-        close(sockfd);
-        return -1;
-    }
 
     // Connect to server
-    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Connection failed");
-        close(sockfd);
+    if ((sockfd = Connect()) < 0)
         return -1;
-    }
 
     // Build HTTP header
     std::stringstream header_stream;
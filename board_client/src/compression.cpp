@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "compression.h"
+
+// Output grows by this much whenever zlib fills what it was given
+static constexpr size_t DEFLATE_CHUNK_SIZE = 16 * 1024;
+
+GzipCompressor::~GzipCompressor() {
+    if (initialized_)
+        deflateEnd(&stream_);
+}
+
+bool GzipCompressor::Reset(int level) {
+    output_.clear();
+
+    if (initialized_ && level == level_)
+        return deflateReset(&stream_) == Z_OK;
+
+    if (initialized_)
+        deflateEnd(&stream_);
+    initialized_ = false;
+
+    memset(&stream_, 0, sizeof(stream_));
+    // 15 + 16: largest window, with a gzip header and trailer
+    if (deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    initialized_ = true;
+    level_ = level;
+    return true;
+}
+
+void GzipCompressor::Update(const char* data, size_t len) {
+    Deflate(data, len, Z_NO_FLUSH);
+}
+
+void GzipCompressor::Finish() {
+    Deflate(nullptr, 0, Z_FINISH);
+}
+
+void GzipCompressor::Deflate(const char* data, size_t len, int flush) {
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(len);
+
+    // Until zlib leaves room in the output, it has more to write
+    do {
+        size_t used = output_.size();
+        output_.resize(used + DEFLATE_CHUNK_SIZE);
+        stream_.next_out = reinterpret_cast<Bytef*>(&output_[used]);
+        stream_.avail_out = static_cast<uInt>(DEFLATE_CHUNK_SIZE);
+        deflate(&stream_, flush);
+        output_.resize(used + DEFLATE_CHUNK_SIZE - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+}
+
+Inflater::~Inflater() {
+    if (initialized_)
+        inflateEnd(&stream_);
+}
+
+bool Inflater::Reset(Format format) {
+    int window_bits = format == FORMAT_GZIP ? 15 + 16 : 15;
+    finished_ = false;
+    raw_fallback_ = format == FORMAT_DEFLATE;
+
+    if (initialized_)
+        return inflateReset2(&stream_, window_bits) == Z_OK;
+
+    memset(&stream_, 0, sizeof(stream_));
+    if (inflateInit2(&stream_, window_bits) != Z_OK)
+        return false;
+    initialized_ = true;
+    return true;
+}
+
+bool Inflater::Feed(const char* data, size_t len) {
+    if (finished_ || len == 0)
+        return true;
+
+    const uLong fed_before = stream_.total_in;
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(len);
+
+    char out[OUTPUT_CHUNK_SIZE];
+    while (true) {
+        stream_.next_out = reinterpret_cast<Bytef*>(out);
+        stream_.avail_out = sizeof(out);
+        int ret = inflate(&stream_, Z_SYNC_FLUSH);
+
+        if (ret == Z_DATA_ERROR && raw_fallback_ && fed_before == 0) {
+            // No zlib header, start over on the same bytes as raw deflate
+            raw_fallback_ = false;
+            if (inflateReset2(&stream_, -15) != Z_OK)
+                return false;
+            stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            stream_.avail_in = static_cast<uInt>(len);
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return false;
+
+        size_t produced = sizeof(out) - stream_.avail_out;
+        if (produced > 0)
+            output_(out, produced);
+
+        if (ret == Z_STREAM_END) {
+            finished_ = true;
+            return true;
+        }
+        // Room left in the output means zlib needs more input
+        if (stream_.avail_out != 0 || ret == Z_BUF_ERROR)
+            return true;
+    }
+}
@@ -0,0 +1,610 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "connection_pool.h"
+#include "http2_session.h"
+#include "http_response_parser.h"
+#include "llm.h"
+#include "llm_error.h"
+#include "tls_context.h"
+
+// std::chrono binds these to a reference, so they need a definition
+constexpr int ConnectionPool::CONNECT_STAGGER_MS;
+constexpr int ConnectionPool::CANCEL_POLL_MS;
+
+// ALPN protocol list in wire format, HTTP/2 preferred
+static const unsigned char kAlpnProtocols[] = "\x02h2\x08http/1.1";
+
+static void ThrowIfCancelled(int cancel_fd) {
+    if (IsCancelled(cancel_fd))
+        throw LlmError(LlmError::CANCELLED, "Request cancelled");
+}
+
+// CPU time of the calling thread, time spent waiting on the socket does not count
+static int64_t ThreadCpuMicroseconds() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+ConnectionPool::ConnectionPool(int idle_timeout_sec)
+    : idle_timeout_sec_(idle_timeout_sec),
+      full_handshake_count_(0),
+      resumed_handshake_count_(0),
+      early_data_count_(0),
+      reuse_count_(0),
+      prewarm_count_(0),
+      tunnel_count_(0),
+      tunnel_reuse_count_(0),
+      handshake_cpu_us_(0) {}
+
+ConnectionPool::~ConnectionPool() {
+    Clear();
+    session_cache_.Flush();
+    session_cache_.Clear();
+}
+
+std::string ConnectionPool::MakeKey(const std::string& host, int port, bool use_proxy) {
+    std::string key = host + ":" + std::to_string(port);
+    if (use_proxy)
+        key = std::string(PROXY_HOST) + ":" + std::to_string(PROXY_PORT) + "/" + key;
+    return key;
+}
+
+std::shared_ptr<HttpsConnection> ConnectionPool::Acquire(const std::string& host,
+                                                         int port,
+                                                         bool use_proxy,
+                                                         const std::vector<struct iovec>* request,
+                                                         Deadline deadline,
+                                                         int cancel_fd) {
+    const std::string key = MakeKey(host, port, use_proxy);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        EvictIdleLocked(time(nullptr));
+        if (std::shared_ptr<HttpsConnection> conn = TakeLocked(key, use_proxy))
+            return conn;
+
+        if (http2_enabled_ && connecting_.count(key)) {
+            // The connection being opened may take this request as another stream. If it does
+            // not, this one connects on its own without waiting again.
+            while (connecting_.count(key) && std::chrono::steady_clock::now() < deadline && !IsCancelled(cancel_fd))
+                connected_.wait_for(lock, std::chrono::milliseconds(CANCEL_POLL_MS));
+            if (std::shared_ptr<HttpsConnection> conn = TakeLocked(key, use_proxy))
+                return conn;
+        } else if (http2_enabled_) {
+            connecting_.insert(key);
+            lock.unlock();
+            return ConnectAnnounced(key, host, port, use_proxy, request, deadline, cancel_fd);
+        }
+    }
+
+    return Connect(host, port, use_proxy, request, deadline, cancel_fd);
+}
+
+std::shared_ptr<HttpsConnection> ConnectionPool::TakeLocked(const std::string& key, bool use_proxy) {
+    // The request becomes one more stream of the shared session, not checked out
+    auto shared = shared_.find(key);
+    if (shared != shared_.end()) {
+        if (shared->second->http2()->IsAlive()) {
+            if (shared->second->reused()) {
+                reuse_count_++;
+                if (use_proxy)
+                    tunnel_reuse_count_++;
+            }
+            return shared->second;
+        }
+        shared_.erase(shared);
+    }
+
+    auto it = idle_.find(key);
+    while (it != idle_.end() && !it->second.empty()) {
+        // Most recently used first, it is the least likely to have been closed by the server
+        std::shared_ptr<HttpsConnection> conn = std::move(it->second.back());
+        it->second.pop_back();
+        if (conn->IsAlive()) {
+            // A prewarmed one has not served a request yet
+            if (conn->reused()) {
+                reuse_count_++;
+                if (use_proxy)
+                    tunnel_reuse_count_++;
+            }
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<HttpsConnection> ConnectionPool::ConnectAnnounced(const std::string& key,
+                                                                  const std::string& host,
+                                                                  int port,
+                                                                  bool use_proxy,
+                                                                  const std::vector<struct iovec>* request,
+                                                                  Deadline deadline,
+                                                                  int cancel_fd) {
+    struct Announcement {
+        ConnectionPool* pool;
+        const std::string& key;
+        ~Announcement() {
+            std::lock_guard<std::mutex> lock(pool->mutex_);
+            pool->connecting_.erase(key);
+            pool->connected_.notify_all();
+        }
+    } announcement = {this, key};
+    return Connect(host, port, use_proxy, request, deadline, cancel_fd);
+}
+
+std::shared_ptr<HttpsConnection> ConnectionPool::Connect(const std::string& host,
+                                                         int port,
+                                                         bool use_proxy,
+                                                         const std::vector<struct iovec>* request,
+                                                         Deadline deadline,
+                                                         int cancel_fd) {
+    SSL_CTX* ctx = TlsContext::Instance().ctx();
+    if (!ctx)
+        throw std::runtime_error("Error creating SSL context");
+
+    RequestTimings timings;
+    Deadline connect_deadline = DeadlineIn(timeouts_.connect_ms, deadline);
+    int sockfd = use_proxy ? ConnectViaProxy(host, port, connect_deadline, cancel_fd, timings)
+                           : ConnectDirect(host, port, connect_deadline, cancel_fd, timings);
+
+    // --- SSL/TLS Setup ---
+    SSL* ssl = SSL_new(ctx);
+    if (!ssl) {
+        close(sockfd);
+        throw std::runtime_error("Error creating SSL structure");
+    }
+
+    // From here on the connection object owns both the socket and the SSL structure
+    std::shared_ptr<HttpsConnection> conn(new HttpsConnection(sockfd, ssl, MakeKey(host, port, use_proxy)));
+
+    if (!SSL_set_fd(ssl, sockfd))
+        throw std::runtime_error("Error attaching SSL to socket descriptor");
+
+    if (SSL_set_tlsext_host_name(ssl, host.c_str()) != 1)
+        throw std::runtime_error("Error setting SNI hostname");
+
+    // The certificate has to be valid for host, not just signed by a trusted CA
+    SSL_set_hostflags(ssl, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+    if (SSL_set1_host(ssl, host.c_str()) != 1)
+        throw std::runtime_error("Error setting the hostname to verify");
+
+    session_cache_.Attach(ssl);
+    if (http2_enabled_ && SSL_set_alpn_protos(ssl, kAlpnProtocols, sizeof(kAlpnProtocols) - 1) != 0)
+        throw std::runtime_error("Error setting ALPN protocols");
+
+    // The socket is non-blocking, every step of the handshake waits for it until this deadline
+    std::chrono::steady_clock::time_point handshake_start = std::chrono::steady_clock::now();
+    const int64_t handshake_cpu_start = ThreadCpuMicroseconds();
+    Deadline handshake_deadline = DeadlineIn(timeouts_.handshake_ms, deadline);
+    auto wait = [&](int ret) {
+        int ssl_error = SSL_get_error(ssl, ret);
+        short events = ssl_error == SSL_ERROR_WANT_READ ? POLLIN : ssl_error == SSL_ERROR_WANT_WRITE ? POLLOUT : 0;
+        if (events == 0)
+            return false;
+        if (!WaitForSocket(sockfd, events, handshake_deadline, cancel_fd)) {
+            ThrowIfCancelled(cancel_fd);
+            throw LlmError(LlmError::HANDSHAKE_TIMEOUT, "TLS handshake with " + host + " timed out");
+        }
+        return true;
+    };
+
+    // Resume a cached session when there is one, and let the request ride in the first
+    // flight if the server allows early data for it.
+    long max_early_data = session_cache_.Apply(ssl, host);
+    size_t early_written = 0;
+    if (max_early_data > 0 && http2_enabled_) {
+        // The request is HTTP/1.1, early data can only carry it if the session was HTTP/1.1 too
+        const unsigned char* alpn = nullptr;
+        size_t alpn_len = 0;
+        SSL_SESSION_get0_alpn_selected(SSL_get_session(ssl), &alpn, &alpn_len);
+        if (alpn_len != 8 || memcmp(alpn, "http/1.1", 8) != 0)
+            max_early_data = 0;
+    }
+    if (request && early_data_enabled_ && max_early_data > 0) {
+        for (const struct iovec& iov : *request) {
+            size_t len = std::min(iov.iov_len, static_cast<size_t>(max_early_data) - early_written);
+            size_t written = 0;
+            if (len == 0)
+                break;
+            int ret = SSL_write_early_data(ssl, iov.iov_base, len, &written);
+            while (ret != 1 && wait(ret))
+                ret = SSL_write_early_data(ssl, iov.iov_base, len, &written);
+            if (ret != 1) {
+                ERR_clear_error();
+                break;
+            }
+            early_written += written;
+        }
+    }
+
+    int ret;
+    while ((ret = SSL_connect(ssl)) <= 0) {
+        if (!wait(ret)) {
+            ERR_clear_error();
+            long verify_result = SSL_get_verify_result(ssl);
+            if (verify_result != X509_V_OK) {
+                throw LlmError(LlmError::HANDSHAKE_FAILED, "Certificate of " + host + " not trusted: " +
+                                                               X509_verify_cert_error_string(verify_result));
+            }
+            throw LlmError(LlmError::HANDSHAKE_FAILED, "Error in SSL handshake with " + host);
+        }
+    }
+
+    timings.ms[RequestTimings::HANDSHAKE] = MillisecondsSince(handshake_start);
+    handshake_cpu_us_ += ThreadCpuMicroseconds() - handshake_cpu_start;
+    conn->set_setup_timings(timings);
+
+    const unsigned char* alpn = nullptr;
+    unsigned int alpn_len = 0;
+    SSL_get0_alpn_selected(ssl, &alpn, &alpn_len);
+    if (alpn_len == 2 && memcmp(alpn, "h2", 2) == 0) {
+        std::unique_ptr<Http2Session> session(new Http2Session(*conn));
+        if (!session->Init())
+            throw std::runtime_error("Error creating HTTP/2 session");
+        conn->set_http2(std::move(session));
+    }
+
+    if (SSL_session_reused(ssl))
+        resumed_handshake_count_++;
+    else
+        full_handshake_count_++;
+
+    // Rejected early data has to be sent again as normal application data
+    if (early_written > 0 && SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED) {
+        conn->set_early_data(early_written);
+        early_data_count_++;
+    }
+
+    // Callers that come while this one's request is under way join it
+    if (conn->http2()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ShareLocked(conn);
+    }
+    return conn;
+}
+
+int ConnectionPool::ConnectDirect(const std::string& host,
+                                  int port,
+                                  Deadline deadline,
+                                  int cancel_fd,
+                                  RequestTimings& timings) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool timed_out;
+    std::vector<ResolvedAddress> addresses = DnsResolver::Instance().Resolve(host, deadline, timed_out, cancel_fd);
+    timings.ms[RequestTimings::DNS] = MillisecondsSince(start);
+    if (addresses.empty()) {
+        ThrowIfCancelled(cancel_fd);
+        if (timed_out)
+            throw LlmError(LlmError::CONNECT_TIMEOUT, "Timed out resolving hostname: " + host);
+        throw LlmError(LlmError::CONNECT_FAILED, "Could not resolve hostname: " + host);
+    }
+
+    std::string error;
+    start = std::chrono::steady_clock::now();
+    int sockfd = ConnectRacing(addresses, port, deadline, cancel_fd, error, timed_out);
+    timings.ms[RequestTimings::CONNECT] = MillisecondsSince(start);
+    if (sockfd < 0) {
+        ThrowIfCancelled(cancel_fd);
+        throw LlmError(timed_out ? LlmError::CONNECT_TIMEOUT : LlmError::CONNECT_FAILED,
+                       "Error connecting to target " + host + ":" + std::to_string(port) + " - " + error);
+    }
+
+    return sockfd;
+}
+
+int ConnectionPool::ConnectRacing(const std::vector<ResolvedAddress>& addresses,
+                                  int port,
+                                  Deadline deadline,
+                                  int cancel_fd,
+                                  std::string& error,
+                                  bool& timed_out) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point next_attempt = Clock::now();
+    size_t next = 0;
+    std::vector<struct pollfd> pending;
+    int winner = -1;
+
+    error = "connection timed out";
+    timed_out = false;
+    while (winner < 0) {
+        Clock::time_point now = Clock::now();
+        if (now >= deadline) {
+            timed_out = true;
+            break;
+        }
+
+        // Start the next address when the stagger delay elapsed or every attempt so far failed
+        if (next < addresses.size() && (now >= next_attempt || pending.empty())) {
+            ResolvedAddress address = addresses[next++];
+            if (address.family == AF_INET)
+                reinterpret_cast<struct sockaddr_in*>(&address.addr)->sin_port = htons(port);
+            else
+                reinterpret_cast<struct sockaddr_in6*>(&address.addr)->sin6_port = htons(port);
+
+            int fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                error = strerror(errno);
+                continue;
+            }
+
+            if (connect(fd, reinterpret_cast<struct sockaddr*>(&address.addr), address.addr_len) == 0) {
+                winner = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                error = strerror(errno);
+                close(fd);
+                continue;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            pending.push_back(pfd);
+            next_attempt = now + std::chrono::milliseconds(CONNECT_STAGGER_MS);
+            continue;
+        }
+
+        if (pending.empty())
+            break;
+
+        Clock::time_point wake = deadline;
+        if (next < addresses.size() && next_attempt < wake)
+            wake = next_attempt;
+        int timeout_ms =
+            static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count()) + 1;
+
+        // cancel_fd rides at the end of the set, poll() ignores it when -1
+        struct pollfd cancel_pfd = {cancel_fd, POLLIN, 0};
+        pending.push_back(cancel_pfd);
+        int ready = poll(pending.data(), pending.size(), timeout_ms);
+        bool cancelled = pending.back().revents != 0;
+        pending.pop_back();
+        if (cancelled) {
+            error = "cancelled";
+            break;
+        }
+        if (ready < 0 && errno != EINTR) {
+            error = strerror(errno);
+            break;
+        }
+
+        for (size_t i = 0; ready > 0 && i < pending.size();) {
+            if (!pending[i].revents) {
+                i++;
+                continue;
+            }
+
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == 0 && so_error == 0) {
+                winner = pending[i].fd;
+                pending.erase(pending.begin() + i);
+                break;
+            }
+
+            // This address failed, let the next one start right away
+            error = strerror(so_error ? so_error : errno);
+            close(pending[i].fd);
+            pending.erase(pending.begin() + i);
+            next_attempt = Clock::now();
+        }
+    }
+
+    // Abandon the attempts that lost the race
+    for (const struct pollfd& pfd : pending)
+        close(pfd.fd);
+
+    return winner;
+}
+
+int ConnectionPool::ConnectViaProxy(const std::string& host,
+                                    int port,
+                                    Deadline deadline,
+                                    int cancel_fd,
+                                    RequestTimings& timings) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool timed_out;
+    std::vector<ResolvedAddress> addresses =
+        DnsResolver::Instance().Resolve(PROXY_HOST, deadline, timed_out, cancel_fd);
+    timings.ms[RequestTimings::DNS] = MillisecondsSince(start);
+    if (addresses.empty()) {
+        ThrowIfCancelled(cancel_fd);
+        if (timed_out)
+            throw LlmError(LlmError::CONNECT_TIMEOUT, "Timed out resolving the proxy address");
+        throw LlmError(LlmError::CONNECT_FAILED, "Invalid proxy address or address not supported");
+    }
+
+    std::string error;
+    start = std::chrono::steady_clock::now();
+    int sockfd = ConnectRacing(addresses, PROXY_PORT, deadline, cancel_fd, error, timed_out);
+    timings.ms[RequestTimings::CONNECT] = MillisecondsSince(start);
+    if (sockfd < 0) {
+        ThrowIfCancelled(cancel_fd);
+        throw LlmError(timed_out ? LlmError::CONNECT_TIMEOUT : LlmError::CONNECT_FAILED,
+                       "Error connecting to proxy " + std::string(PROXY_HOST) + ":" + std::to_string(PROXY_PORT) +
+                           " - " + error);
+    }
+
+    // The tunnel is set up within the connect deadline
+    start = std::chrono::steady_clock::now();
+    try {
+        OpenTunnel(sockfd, host, port, deadline, cancel_fd);
+    } catch (...) {
+        close(sockfd);
+        throw;
+    }
+    timings.ms[RequestTimings::PROXY_CONNECT] = MillisecondsSince(start);
+    tunnel_count_++;
+    return sockfd;
+}
+
+void ConnectionPool::OpenTunnel(int sockfd, const std::string& host, int port, Deadline deadline, int cancel_fd) {
+    std::string connect_req = "CONNECT " + host + ":" + std::to_string(port) + " HTTP/1.1\r\n" +
+                              "Host: " + host + ":" + std::to_string(port) + "\r\n" +
+                              "Proxy-Connection: Keep-Alive\r\n" + "User-Agent: C++-Client/1.0\r\n\r\n";
+
+    size_t sent = 0;
+    while (sent < connect_req.length()) {
+        ssize_t n = send(sockfd, connect_req.c_str() + sent, connect_req.length() - sent, MSG_NOSIGNAL);
+        if (n >= 0) {
+            sent += n;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            throw LlmError(LlmError::CONNECT_FAILED,
+                           "Error sending CONNECT request to proxy: " + std::string(strerror(errno)));
+        } else if (!WaitForSocket(sockfd, POLLOUT, deadline, cancel_fd)) {
+            ThrowIfCancelled(cancel_fd);
+            throw LlmError(LlmError::CONNECT_TIMEOUT, "Timed out sending CONNECT request to proxy");
+        }
+    }
+
+    // The reply can arrive in pieces and ends with an empty line. The TLS handshake has not
+    // started yet, so everything up to there comes from the proxy.
+    std::string response;
+    size_t header_end = std::string::npos;
+    char buffer[1024];
+    while (header_end == std::string::npos) {
+        if (response.size() > MAX_PROXY_RESPONSE_SIZE)
+            throw LlmError(LlmError::CONNECT_FAILED, "Proxy CONNECT response too large");
+
+        ssize_t n = recv(sockfd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            size_t searched = response.size() < 3 ? 0 : response.size() - 3;
+            response.append(buffer, n);
+            header_end = response.find("\r\n\r\n", searched);
+        } else if (n == 0) {
+            throw LlmError(LlmError::CONNECT_FAILED, "Proxy closed the connection during CONNECT");
+        } else if (errno != EAGAIN && errno != EINTR) {
+            throw LlmError(LlmError::CONNECT_FAILED,
+                           "Error reading response from proxy: " + std::string(strerror(errno)));
+        } else if (!WaitForSocket(sockfd, POLLIN, deadline, cancel_fd)) {
+            ThrowIfCancelled(cancel_fd);
+            throw LlmError(LlmError::CONNECT_TIMEOUT, "Timed out waiting for the proxy to answer CONNECT");
+        }
+    }
+    header_end += 4;
+
+    HttpResponseParser parser;
+    parser.Feed(response.data(), header_end);
+    if (!parser.headers_complete())
+        throw LlmError(LlmError::CONNECT_FAILED, "Malformed proxy CONNECT response");
+
+    // Any 2xx opens the tunnel
+    if (parser.status_code() < 200 || parser.status_code() >= 300) {
+        throw LlmError(LlmError::CONNECT_FAILED,
+                       "Proxy CONNECT request failed: " + response.substr(0, response.find("\r\n")));
+    }
+    if (header_end != response.size())
+        throw LlmError(LlmError::CONNECT_FAILED, "Proxy sent data ahead of the TLS handshake");
+}
+
+bool ConnectionPool::Prewarm(const std::string& host, int port, bool use_proxy) {
+    const std::string key = MakeKey(host, port, use_proxy);
+    bool announced;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        EvictIdleLocked(time(nullptr));
+        auto it = idle_.find(key);
+        if ((it != idle_.end() && !it->second.empty()) || shared_.count(key) || connecting_.count(key))
+            return false;
+        // A request that comes meanwhile waits for this connection if it may be shared
+        announced = http2_enabled_;
+        if (announced)
+            connecting_.insert(key);
+    }
+
+    // Idle but not reused, the first request gets its setup timings. Connect() already shared
+    // an HTTP/2 one.
+    std::shared_ptr<HttpsConnection> conn =
+        announced ? ConnectAnnounced(key, host, port, use_proxy, nullptr, Deadline::max(), -1)
+                  : Connect(host, port, use_proxy);
+    if (!conn->http2())
+        AddIdle(std::move(conn));
+    prewarm_count_++;
+    return true;
+}
+
+void ConnectionPool::Release(std::shared_ptr<HttpsConnection> conn) {
+    if (!conn)
+        return;
+
+    conn->MarkIdle();
+    if (!conn->http2()) {
+        AddIdle(std::move(conn));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto shared = shared_.find(conn->key());
+    if (conn->http2()->usable())
+        ShareLocked(conn);
+    else if (shared != shared_.end() && shared->second == conn)
+        shared_.erase(shared);
+}
+
+void ConnectionPool::ShareLocked(const std::shared_ptr<HttpsConnection>& conn) {
+    // A second one only exists when callers connected at the same time, it goes once unused
+    std::shared_ptr<HttpsConnection>& shared = shared_[conn->key()];
+    if (!shared || (shared != conn && !shared->http2()->usable()))
+        shared = conn;
+}
+
+void ConnectionPool::AddIdle(std::shared_ptr<HttpsConnection> conn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<HttpsConnection>>& idle = idle_[conn->key()];
+    if (idle.size() >= MAX_IDLE_PER_KEY)
+        idle.erase(idle.begin());  // Drop the oldest one
+    idle.push_back(std::move(conn));
+}
+
+void ConnectionPool::EvictIdle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EvictIdleLocked(time(nullptr));
+}
+
+void ConnectionPool::EvictIdleLocked(time_t now) {
+    for (auto it = idle_.begin(); it != idle_.end();) {
+        std::vector<std::shared_ptr<HttpsConnection>>& idle = it->second;
+        for (auto conn = idle.begin(); conn != idle.end();) {
+            if (now - (*conn)->last_used() >= idle_timeout_sec_)
+                conn = idle.erase(conn);
+            else
+                ++conn;
+        }
+
+        if (idle.empty())
+            it = idle_.erase(it);
+        else
+            ++it;
+    }
+
+    // Callers still running streams keep theirs open until they are done
+    for (auto it = shared_.begin(); it != shared_.end();) {
+        Http2Session* session = it->second->http2();
+        if (!session->usable() ||
+            (now - it->second->last_used() >= idle_timeout_sec_ && session->open_streams() == 0))
+            it = shared_.erase(it);
+        else
+            ++it;
+    }
+}
+
+void ConnectionPool::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    shared_.clear();
+}
@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <poll.h>
 #include <sqlite3.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,27 +13,66 @@
 #include "llm.h"
 #include "v4l2_camera.h"
 
-ConversationHandler::ConversationHandler(std::string db_path) {
-    // LLM qwen = LLM("Qwen", "dashscope.aliyuncs.com", "/compatible-mode/v1/chat/completions", QWEN_API_KEY,
-    //                AUTH_METHOD_BEARER_HEADER, "qwen-vl-plus", "\"content\":\"", "system", false);
-
-    // LLM deepseek = LLM("DeepSeek", "api.deepseek.com", "/chat/completions", DEEPSEEK_API_KEY,
-    //                    AUTH_METHOD_BEARER_HEADER, "deepseek-chat", "\"content\":\"", "assistant", false);
+// std::chrono binds these to references, so they need a definition
+constexpr int ConversationHandler::KEY_POLL_MS;
+constexpr int ConversationHandler::CALLBACK_TIMEOUT_SEC;
 
-    // LLM gemini = LLM("Gemini", "generativelanguage.googleapis.com",
-    //                  "/v1beta/models/gemini-2.5-flash-preview-04-17:generateContent", GEMINI_API_KEY,
-    //                  AUTH_METHOD_URL_PARAM, "gemini-2.5-flash-preview-04-17", "\"text\": \"", "model",
-    //                  true);
+// Where the speech backend posts the recognized text and the synthesized reply
+static const char kAsrTextPath[] = "/upload/text";
+static const char kTtsAudioPath[] = "/upload/audio";
 
+ConversationHandler::ConversationHandler(std::string db_path) {
     key_fd_ = open("/dev/key", O_RDWR);
     if (key_fd_ < 0)
         printf("Can't open file");
 
-    llm_ = new LLM("Qwen", "dashscope.aliyuncs.com", "/compatible-mode/v1/chat/completions", QWEN_API_KEY,
-                   AUTH_METHOD_BEARER_HEADER, "qwen-vl-plus", "\"content\":\"", "system", false);
+    // Each conversation names its provider in conversations.llm, the router falls back to and
+    // hedges with the others
+    std::vector<LLM*> llms = {
+        new LLM("Qwen", "dashscope.aliyuncs.com", "/compatible-mode/v1/chat/completions", QWEN_API_KEY,
+                "qwen-vl-plus", "system", false),
+        new LLM("DeepSeek", "api.deepseek.com", "/chat/completions", DEEPSEEK_API_KEY, "deepseek-chat",
+                "system", false),
+        new LLM("Gemini", "generativelanguage.googleapis.com",
+                "/v1beta/models/gemini-2.5-flash-preview-04-17:generateContent", GEMINI_API_KEY,
+                "gemini-2.5-flash-preview-04-17", "user", true),
+        // Any OpenAI-compatible server, e.g. a local stand-in, no key needed
+        // new LLM("OpenAI", "llm.local", "/v1/chat/completions", "", "qwen2.5", "system", false),
+    };
+
+    router_ = new LlmRouter();
+    for (LLM* llm : llms) {
+        llm->set_session_cache_file("./tls_sessions_" + llm->name() + ".cache");
+        // Early data can be replayed, only Qwen's endpoint has been checked to take it
+        llm->set_early_data(llm->name() == "Qwen");
+        // The Wi-Fi link is slower than a low zlib level on the Cortex-A7
+        llm->set_request_compression(3);
+        llm->set_accept_compressed(true);
+        llm->set_http2(true);
+        router_->AddProvider(llm);
+    }
+    // Per-phase latency histograms of all requests, appended every five minutes
+    RequestMetrics::Instance().set_log_file("./llm_metrics.log", 300);
+
+    // Deleted messages change the history the providers have cached
+    ChatRecordDB::AddChangeListener([this](int conversation_id) { router_->InvalidateHistory(conversation_id); });
 
     sender_ = new ClientSender("10.33.47.116", 8000);
     receiver_ = new ClientReceiver(8001);
+    // The working directory is on slow eMMC or SD storage, the reply goes to aplay from memory
+    tts_audio_ = new BufferSink(ClientReceiver::MAX_AUDIO_SIZE);
+    receiver_->AddRoute(kAsrTextPath, ClientReceiver::MAX_TEXT_SIZE,
+                        [this](bool ok, const std::string& text) { PostCallback(kAsrTextPath, ok, text); });
+    receiver_->AddSinkRoute(
+        kTtsAudioPath, tts_audio_, ClientReceiver::MAX_AUDIO_SIZE,
+        [this](bool ok, const std::string& result) { PostCallback(kTtsAudioPath, ok, result); });
+    if (!receiver_->Start())
+        printf("Callback server failed to start\n");
+
+    // Repeated questions are answered from the same database without asking an LLM
+    response_cache_ = new ResponseCache(db_path);
+    if (response_cache_->InitDatabase() != SQLITE_OK)
+        printf("Response cache initialization failed\n");
 
     chat_record_db_ = new ChatRecordDB(db_path);
     int ret = chat_record_db_->InitDatabase();
@@ -57,25 +97,78 @@ void ConversationHandler::HasImage() {
     has_image_ = true;
 }
 
+void ConversationHandler::PostCallback(const std::string& path, bool ok, const std::string& result) {
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    callbacks_[path].push_back({ok, result});
+    callbacks_cv_.notify_all();
+}
+
+void ConversationHandler::ClearCallbacks(const std::string& path) {
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    callbacks_[path].clear();
+}
+
+bool ConversationHandler::WaitForCallback(const std::string& path, std::string& result, bool& key_pressed) {
+    key_pressed = false;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(CALLBACK_TIMEOUT_SEC);
+
+    std::unique_lock<std::mutex> lock(callbacks_mutex_);
+    std::deque<Callback>& results = callbacks_[path];
+    // The key is checked as often as while waiting for a reply
+    while (!callbacks_cv_.wait_for(lock, std::chrono::milliseconds(KEY_POLL_MS),
+                                   [&]() { return !results.empty(); })) {
+        unsigned char key_status;
+        struct pollfd pfd = {key_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 0) > 0 && read(key_fd_, &key_status, sizeof(key_status)) == 1 && key_status == 1) {
+            key_pressed = true;
+            return false;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            std::cerr << "ERROR [Callback]: No call to " << path << " within " << CALLBACK_TIMEOUT_SEC << " s"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    Callback callback = results.front();
+    results.pop_front();
+    result = callback.result;
+    return callback.ok;
+}
+
+void ConversationHandler::Prewarm() {
+    sender_->Prewarm();
+    router_->Prewarm(chat_record_db_->GetConversation(current_conversation_id_).llm);
+}
+
+void ConversationHandler::StartRecording(FILE*& arecord_pipe) {
+    emit SendConvoStatus(const_cast<char*>("Recoding started"), const_cast<char*>(""));
+    arecord_pipe = popen("arecord -f cd ./record.wav", "r");
+    Prewarm();
+}
+
 void ConversationHandler::run() {
     unsigned char key_status;
     FILE* arecord_pipe = nullptr;
     std::string status;
     std::string value;
     while (true) {
+        // Wakes up to close the speech backend connection Prewarm() opened if it went unused
+        struct pollfd key_pfd = {key_fd_, POLLIN, 0};
+        if (poll(&key_pfd, 1, sender_->CloseExpired()) <= 0)
+            continue;
         read(key_fd_, &key_status, sizeof(key_status));
 
-        if (key_status == 1) {
-            emit SendConvoStatus(const_cast<char*>("Recoding started"), const_cast<char*>(""));
-            arecord_pipe = popen("arecord -f cd ./record.wav", "r");
-        }
+        if (key_status == 1)
+            StartRecording(arecord_pipe);
 
         if (key_status == 2) {
             system("pkill arecord");
             pclose(arecord_pipe);
 
             std::vector<ConversationMessage> conversation_data = {
-                {llm_->role().c_str(),
+                {"system",
                  "回复中的数字不要使用阿拉伯数字，使用中文数字，回复不要太长，在200字以内，回复中只回应以"
                  "下内容：\n\n",
                  false}};
@@ -93,34 +186,100 @@ void ConversationHandler::run() {
             // std::string filename = "./test_audios/test" + std::to_string((test_audio_id % 4) + 1) + ".wav";
             // sender_->AudioSend(filename, "/upload/audio");
             // test_audio_id++;
+            ClearCallbacks(kAsrTextPath);
             sender_->AudioSend("./record.wav", "/upload/audio");
             emit SendConvoStatus(const_cast<char*>("Audio sent"), const_cast<char*>(""));
 
-            std::string audio_text = receiver_->HandleRequest("");
+            // Pressing the key again while the backend works drops the question, as while the
+            // reply is on its way
+            std::string audio_text;
+            bool key_pressed;
+            if (!WaitForCallback(kAsrTextPath, audio_text, key_pressed)) {
+                has_image_ = false;
+                if (key_pressed)
+                    StartRecording(arecord_pipe);
+                else
+                    emit SendConvoStatus(const_cast<char*>("Audio text failed"), const_cast<char*>(""));
+                continue;
+            }
             emit SendConvoStatus(const_cast<char*>("Audio text received"),
                                  const_cast<char*>(audio_text.c_str()));
 
             conversation_data.push_back({"user", audio_text.c_str(), has_image_});
 
             emit SendConvoStatus(const_cast<char*>("LLM requesting"), const_cast<char*>(""));
-            std::string response = llm_->SendRequest(conversation_data);
+            bool first_token = true;
+            std::string preferred = chat_record_db_->GetConversation(current_conversation_id_).llm;
+            std::string model = router_->ModelName(preferred);
+            std::string response;
+            if (response_cache_->Lookup(preferred, model, conversation_data, response)) {
+                std::cout << "[Cache] Hit, " << response_cache_->hits() << " hits and " << response_cache_->misses()
+                          << " misses so far" << std::endl;
+            } else {
+                std::shared_ptr<PendingReply> pending = router_->SendStreamRequestAsync(
+                    conversation_data,
+                    [&](const std::string&) {
+                        if (first_token) {
+                            emit SendConvoStatus(const_cast<char*>("LLM streaming"), const_cast<char*>(""));
+                            first_token = false;
+                        }
+                    },
+                    nullptr, preferred, current_conversation_id_);
+
+                // Pressing the key again while the reply is on its way drops it and starts
+                // recording the next question
+                bool interrupted = false;
+                while (!pending->WaitFor(std::chrono::milliseconds(KEY_POLL_MS))) {
+                    struct pollfd pfd = {key_fd_, POLLIN, 0};
+                    if (poll(&pfd, 1, 0) > 0 && read(key_fd_, &key_status, sizeof(key_status)) == 1 &&
+                        key_status == 1) {
+                        pending->Cancel();
+                        interrupted = true;
+                        break;
+                    }
+                }
+                if (interrupted) {
+                    has_image_ = false;
+                    StartRecording(arecord_pipe);
+                    continue;
+                }
+
+                response = pending->Get();
+                router_->DumpStats();
+                // Failover or hedging may have answered with another provider than the preferred one,
+                // the reply is kept under the one that wrote it
+                std::string provider = pending->provider();
+                if (!provider.empty())
+                    response_cache_->Store(provider, router_->ModelName(provider), conversation_data, response);
+            }
             emit SendConvoStatus(const_cast<char*>("LLM response received"),
                                  const_cast<char*>(response.c_str()));
             has_image_ = false;
 
             emit SendConvoStatus(const_cast<char*>("Generating audio"), const_cast<char*>(response.c_str()));
+            // The upload may start as soon as the text is sent, a reply left over goes first
+            tts_audio_->Release();
+            ClearCallbacks(kTtsAudioPath);
             sender_->LlmReponseSend(response, "/send/text");
-            std::string response_filename = "./llm_response_audio.wav";
-            if (access(response_filename.c_str(), F_OK) == 0)
-                remove(response_filename.c_str());
-            receiver_->HandleRequest(response_filename);
+            std::string audio_result;
+            if (!WaitForCallback(kTtsAudioPath, audio_result, key_pressed)) {
+                if (key_pressed)
+                    StartRecording(arecord_pipe);
+                else
+                    emit SendConvoStatus(const_cast<char*>("Response audio failed"), const_cast<char*>(""));
+                continue;
+            }
             emit SendConvoStatus(const_cast<char*>("Response audio received"),
                                  const_cast<char*>(response.c_str()));
 
-            std::string aplay_command = "aplay " + response_filename;
-            FILE* aplay_pipe = popen(aplay_command.c_str(), "r");
-            if (pclose(aplay_pipe) == 0)
-                printf("音频播放完成\n");
+            // aplay reads the WAV from its standard input
+            FILE* aplay_pipe = popen("aplay -", "w");
+            if (aplay_pipe) {
+                fwrite(tts_audio_->data(), 1, tts_audio_->size(), aplay_pipe);
+                if (pclose(aplay_pipe) == 0)
+                    printf("音频播放完成\n");
+            }
+            tts_audio_->Release();
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <algorithm>
+
+#include "deadline.h"
+
+Deadline DeadlineIn(int ms, Deadline limit) {
+    return std::min(std::chrono::steady_clock::now() + std::chrono::milliseconds(ms), limit);
+}
+
+bool WaitForSocket(int fd, short events, Deadline deadline, int cancel_fd) {
+    struct pollfd pfds[2];
+    pfds[0].fd = fd;
+    pfds[0].events = events;
+    pfds[1].fd = cancel_fd;  // Ignored by poll() when -1
+    pfds[1].events = POLLIN;
+
+    while (true) {
+        int timeout_ms = -1;
+        if (deadline != Deadline::max()) {
+            Deadline now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                return false;
+            // Rounded up so that the deadline has passed when poll() times out
+            long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+            timeout_ms = static_cast<int>(std::min<long long>(left, INT_MAX));
+        }
+
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+        int ret = poll(pfds, 2, timeout_ms);
+        if (ret > 0 && pfds[1].revents)
+            return false;
+        if (ret > 0 || (ret < 0 && errno != EINTR))
+            return true;
+    }
+}
+
+bool IsCancelled(int cancel_fd) {
+    if (cancel_fd < 0)
+        return false;
+    struct pollfd pfd;
+    pfd.fd = cancel_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0;
+}
@@ -0,0 +1,233 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+#include "dns_resolver.h"
+
+// std::chrono binds these to references, so they need a definition
+constexpr int DnsResolver::NEGATIVE_TTL_SEC;
+constexpr int DnsResolver::REFRESH_AHEAD_SEC;
+
+DnsResolver& DnsResolver::Instance() {
+    static DnsResolver resolver;
+    return resolver;
+}
+
+DnsResolver::DnsResolver() : ttl_sec_(DEFAULT_TTL_SEC), stop_(false), lookups_(0) {
+    worker_ = std::thread(&DnsResolver::WorkerLoop, this);
+}
+
+DnsResolver::~DnsResolver() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stop_ = true;
+        resolved_cv_.wait(lock, [this] { return lookups_ == 0; });
+    }
+    queue_cv_.notify_all();
+    if (worker_.joinable())
+        worker_.join();
+}
+
+std::vector<ResolvedAddress> DnsResolver::Resolve(const std::string& host,
+                                                  Deadline deadline,
+                                                  bool& timed_out,
+                                                  int cancel_fd) {
+    timed_out = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto static_entry = hosts_.find(host);
+    if (static_entry != hosts_.end())
+        return static_entry->second;
+
+    CacheEntry& entry = cache_[host];
+    const Clock::time_point now = Clock::now();
+
+    if (!entry.addresses.empty()) {
+        // Serve from the cache and refresh in the background when the entry is about to
+        // expire. An expired entry is still returned: the addresses of API endpoints rarely
+        // change and a failed connect falls back to the next address anyway.
+        if (!entry.resolving && entry.expires_at - now < std::chrono::seconds(REFRESH_AHEAD_SEC))
+            QueueLocked(host);
+        return entry.addresses;
+    }
+
+    if (!entry.resolving && now < entry.expires_at)
+        return {};  // Negative cache
+
+    // Cold cache: wait for the lookup in flight or start one. getaddrinfo cannot be
+    // interrupted, so it runs on a thread of its own that a cancelled caller leaves behind.
+    if (!entry.resolving) {
+        entry.resolving = true;
+        lookups_++;
+        std::thread(&DnsResolver::LookupDetached, this, host).detach();
+    }
+    if (!resolved_cv_.wait_until(lock, deadline, [&] { return !cache_[host].resolving || IsCancelled(cancel_fd); }))
+        timed_out = true;
+    return cache_[host].resolving ? std::vector<ResolvedAddress>() : cache_[host].addresses;
+}
+
+void DnsResolver::Interrupt() {
+    // A waiter either has not checked its cancel_fd yet or is already waiting
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    resolved_cv_.notify_all();
+}
+
+void DnsResolver::LookupDetached(const std::string& host) {
+    ResolveAndStore(host);
+
+    // Notified under the lock, the destructor may be waiting for this thread
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups_--;
+    resolved_cv_.notify_all();
+}
+
+void DnsResolver::Prefetch(const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (hosts_.count(host))
+        return;
+
+    CacheEntry& entry = cache_[host];
+    if (!entry.resolving && entry.expires_at - Clock::now() < std::chrono::seconds(REFRESH_AHEAD_SEC))
+        QueueLocked(host);
+}
+
+void DnsResolver::QueueLocked(const std::string& host) {
+    cache_[host].resolving = true;
+    queue_.push_back(host);
+    queue_cv_.notify_one();
+}
+
+void DnsResolver::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (stop_)
+            return;
+
+        std::string host = queue_.front();
+        queue_.pop_front();
+
+        lock.unlock();
+        ResolveAndStore(host);
+        lock.lock();
+    }
+}
+
+void DnsResolver::ResolveAndStore(const std::string& host) {
+    std::vector<ResolvedAddress> addresses = Lookup(host);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        CacheEntry& entry = cache_[host];
+        entry.resolving = false;
+        if (!addresses.empty()) {
+            entry.addresses = addresses;
+            entry.expires_at = Clock::now() + std::chrono::seconds(ttl_sec_);
+        } else if (entry.addresses.empty()) {
+            entry.expires_at = Clock::now() + std::chrono::seconds(NEGATIVE_TTL_SEC);
+        }
+        // A failed refresh keeps serving the previous addresses
+    }
+    resolved_cv_.notify_all();
+}
+
+std::vector<ResolvedAddress> DnsResolver::Lookup(const std::string& host) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+        return {};
+
+    std::vector<ResolvedAddress> addresses;
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) || ai->ai_addrlen > sizeof(sockaddr_storage))
+            continue;
+
+        ResolvedAddress address;
+        memset(&address, 0, sizeof(address));
+        memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+        address.addr_len = ai->ai_addrlen;
+        address.family = ai->ai_family;
+        addresses.push_back(address);
+    }
+    freeaddrinfo(result);
+
+    return Interleave(addresses);
+}
+
+std::vector<ResolvedAddress> DnsResolver::Interleave(const std::vector<ResolvedAddress>& addresses) {
+    // Alternate families (RFC 8305) starting with the family getaddrinfo preferred, so a
+    // broken IPv6 route only costs one connection attempt delay.
+    if (addresses.empty())
+        return addresses;
+
+    std::vector<ResolvedAddress> preferred, other;
+    for (const ResolvedAddress& address : addresses) {
+        if (address.family == addresses[0].family)
+            preferred.push_back(address);
+        else
+            other.push_back(address);
+    }
+
+    std::vector<ResolvedAddress> ordered;
+    for (size_t i = 0; i < preferred.size() || i < other.size(); i++) {
+        if (i < preferred.size())
+            ordered.push_back(preferred[i]);
+        if (i < other.size())
+            ordered.push_back(other[i]);
+    }
+    return ordered;
+}
+
+int DnsResolver::LoadHostsFile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open())
+        return -1;
+
+    std::map<std::string, std::vector<ResolvedAddress>> hosts;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string ip;
+        if (!(fields >> ip))
+            continue;
+
+        ResolvedAddress address;
+        memset(&address, 0, sizeof(address));
+        struct sockaddr_in* v4 = reinterpret_cast<struct sockaddr_in*>(&address.addr);
+        struct sockaddr_in6* v6 = reinterpret_cast<struct sockaddr_in6*>(&address.addr);
+        if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            address.addr_len = sizeof(struct sockaddr_in);
+            address.family = AF_INET;
+        } else if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            address.addr_len = sizeof(struct sockaddr_in6);
+            address.family = AF_INET6;
+        } else {
+            continue;
+        }
+
+        std::string name;
+        while (fields >> name)
+            hosts[name].push_back(address);
+    }
+
+    int count = static_cast<int>(hosts.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    hosts_.swap(hosts);
+    return count;
+}
@@ -0,0 +1,410 @@
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "http2_session.h"
+#include "https_connection.h"
+
+// Connection-specific HTTP/1.1 headers that HTTP/2 forbids
+static const char* const kHopByHopHeaders[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding",
+                                               "upgrade", "host"};
+
+static nghttp2_nv MakeNv(const std::string& name, const std::string& value) {
+    nghttp2_nv nv;
+    nv.name = reinterpret_cast<uint8_t*>(const_cast<char*>(name.data()));
+    nv.namelen = name.size();
+    nv.value = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+    nv.valuelen = value.size();
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
+    return nv;
+}
+
+// Splits "POST /path HTTP/1.1\r\nName: value\r\n...\r\n\r\n" into pseudo-headers and
+// lower-cased fields. Returns false if the request line is malformed.
+static bool ParseRequestHead(const std::string& head, std::vector<std::pair<std::string, std::string>>& fields) {
+    size_t line_end = head.find("\r\n");
+    size_t method_end = head.find(' ');
+    size_t path_end = method_end == std::string::npos ? std::string::npos : head.find(' ', method_end + 1);
+    if (line_end == std::string::npos || path_end == std::string::npos || path_end > line_end)
+        return false;
+
+    std::string authority;
+    std::vector<std::pair<std::string, std::string>> headers;
+    for (size_t start = line_end + 2; start < head.size();) {
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos || end == start)
+            break;
+
+        size_t colon = head.find(':', start);
+        if (colon != std::string::npos && colon < end) {
+            std::string name = head.substr(start, colon - start);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t value_start = head.find_first_not_of(' ', colon + 1);
+            std::string value = value_start < end ? head.substr(value_start, end - value_start) : "";
+
+            if (name == "host")
+                authority = value;
+            if (std::find(std::begin(kHopByHopHeaders), std::end(kHopByHopHeaders), name) ==
+                std::end(kHopByHopHeaders))
+                headers.emplace_back(name, value);
+        }
+        start = end + 2;
+    }
+
+    // Pseudo-headers have to come first
+    fields.emplace_back(":method", head.substr(0, method_end));
+    fields.emplace_back(":scheme", "https");
+    fields.emplace_back(":authority", authority);
+    fields.emplace_back(":path", head.substr(method_end + 1, path_end - method_end - 1));
+    fields.insert(fields.end(), headers.begin(), headers.end());
+    return true;
+}
+
+Http2Session::Http2Session(HttpsConnection& conn)
+    : conn_(conn), session_(nullptr), failed_(false), reading_(false), read_buffer_(READ_BUFFER_SIZE), wake_fd_(-1) {}
+
+Http2Session::~Http2Session() {
+    if (session_)
+        nghttp2_session_del(session_);
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+}
+
+bool Http2Session::Init() {
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        perror("eventfd() failed");
+        return false;
+    }
+
+    nghttp2_session_callbacks* callbacks;
+    if (nghttp2_session_callbacks_new(&callbacks) != 0)
+        return false;
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, OnHeader);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, OnFrameRecv);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, OnDataChunkRecv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, OnStreamClose);
+    int ret = nghttp2_session_client_new(&session_, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (ret != 0)
+        return false;
+
+    nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+                                         {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, LOCAL_WINDOW_SIZE}};
+    return nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings, 2) == 0 &&
+           nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE, 0, LOCAL_WINDOW_SIZE) == 0;
+}
+
+int32_t Http2Session::SubmitRequest(const std::string& head,
+                                    const std::vector<struct iovec>& body,
+                                    const BodySource& body_source,
+                                    Deadline deadline,
+                                    int& error) {
+    error = -1;
+    std::vector<std::pair<std::string, std::string>> fields;
+    if (!ParseRequestHead(head, fields))
+        return -1;
+
+    std::vector<nghttp2_nv> nva;
+    nva.reserve(fields.size());
+    for (const auto& field : fields)
+        nva.push_back(MakeNv(field.first, field.second));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_)
+        return -1;
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = nullptr;
+    provider.read_callback = ReadBody;
+    int32_t stream_id = nghttp2_submit_request(session_, nullptr, nva.data(), nva.size(), &provider, nullptr);
+    if (stream_id < 0) {
+        // Out of stream ids, the connection cannot take more requests
+        failed_ = true;
+        return -1;
+    }
+
+    // Registered before anything is sent, the response can be read by another stream's caller
+    Stream& stream = streams_[stream_id];
+    stream.body = body;
+    stream.body_source = body_source;
+    error = Flush(deadline);
+    return stream_id;
+}
+
+int Http2Session::Read(int32_t stream_id, char* buf, size_t len, Deadline deadline) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        Stream* stream = FindStream(stream_id);
+        if (!stream)
+            return -1;
+
+        if (stream->read_offset < stream->received.size()) {
+            size_t n = std::min(len, stream->received.size() - stream->read_offset);
+            memcpy(buf, stream->received.data() + stream->read_offset, n);
+            stream->read_offset += n;
+            if (stream->read_offset == stream->received.size()) {
+                stream->received.clear();
+                stream->read_offset = 0;
+            }
+            return static_cast<int>(n);
+        }
+        if (stream->closed)
+            return stream->reset ? -1 : 0;
+        if (failed_)
+            return -1;
+        if (std::chrono::steady_clock::now() >= deadline)
+            return HttpsConnection::TIMED_OUT;
+
+        // Another caller is reading, it wakes everyone when it got something or stops
+        if (reading_) {
+            if (deadline == Deadline::max())
+                cv_.wait(lock);
+            else
+                cv_.wait_until(lock, deadline);
+            continue;
+        }
+
+        reading_ = true;
+        int ret = Pump(lock, deadline);
+        reading_ = false;
+        cv_.notify_all();
+        if (ret == HttpsConnection::TIMED_OUT)
+            return ret;
+    }
+}
+
+int Http2Session::Pump(std::unique_lock<std::mutex>& lock, Deadline deadline) {
+    // OpenSSL may hold decrypted data the socket no longer signals, so try a read first
+    int n = conn_.Read(read_buffer_.data(), read_buffer_.size(), Deadline::min());
+    if (n == HttpsConnection::TIMED_OUT) {
+        // Other callers open streams meanwhile, the lock is only needed once there is data
+        lock.unlock();
+        bool ready = WaitForSocket(conn_.fd(), POLLIN, deadline, wake_fd_);
+        lock.lock();
+
+        uint64_t count;
+        if (read(wake_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            perror("eventfd read failed");
+        if (!ready)
+            return std::chrono::steady_clock::now() >= deadline ? HttpsConnection::TIMED_OUT : 0;
+
+        n = conn_.Read(read_buffer_.data(), read_buffer_.size(), Deadline::min());
+        if (n == HttpsConnection::TIMED_OUT)
+            return 0;  // Not a whole TLS record yet
+    }
+    if (n <= 0) {
+        failed_ = true;
+        return -1;
+    }
+
+    ssize_t consumed = nghttp2_session_mem_recv(session_, reinterpret_cast<const uint8_t*>(read_buffer_.data()), n);
+    if (consumed < 0) {
+        failed_ = true;
+        return -1;
+    }
+
+    // WINDOW_UPDATE, SETTINGS and PING acks, and the rest of bodies flow control held back
+    return Flush(deadline);
+}
+
+void Http2Session::CloseStream(int32_t stream_id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = streams_.find(stream_id);
+        if (it != streams_.end()) {
+            // Stops the server from sending the rest, e.g. of a cancelled reply. A reader sends
+            // it along with its next flush, or else it is sent right away.
+            if (!it->second.closed && !failed_) {
+                nghttp2_submit_rst_stream(session_, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+                if (!reading_)
+                    Flush(DeadlineIn(RESET_FLUSH_MS));
+            }
+            streams_.erase(it);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(cancel_mutex_);
+    cancelled_.erase(std::remove(cancelled_.begin(), cancelled_.end(), stream_id), cancelled_.end());
+}
+
+void Http2Session::CancelStream(int32_t stream_id) {
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        cancelled_.push_back(stream_id);
+    }
+
+    // The reader leaves its wait and wakes the others, whichever reads the stream sees it is
+    // cancelled. The session mutex is not taken, a write under it can take until its deadline.
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+        perror("eventfd write failed");
+    cv_.notify_all();
+}
+
+bool Http2Session::usable() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !failed_ && nghttp2_session_check_request_allowed(session_) != 0;
+}
+
+bool Http2Session::IsAlive() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_ || nghttp2_session_check_request_allowed(session_) == 0)
+        return false;
+    // With streams open a close shows up on their reads; without, nobody reads the socket
+    return !streams_.empty() || conn_.IsAlive();
+}
+
+size_t Http2Session::open_streams() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_.size();
+}
+
+Http2Session::Stream* Http2Session::FindStream(int32_t stream_id) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(cancel_mutex_);
+    if (std::find(cancelled_.begin(), cancelled_.end(), stream_id) != cancelled_.end())
+        return nullptr;
+    return &it->second;
+}
+
+int Http2Session::Flush(Deadline deadline) {
+    while (true) {
+        const uint8_t* data;
+        ssize_t len = nghttp2_session_mem_send(session_, &data);
+        if (len < 0) {
+            failed_ = true;
+            return -1;
+        }
+        if (len == 0)
+            return 0;
+
+        int ret = conn_.WriteAll(reinterpret_cast<const char*>(data), len, deadline);
+        if (ret != 0) {
+            failed_ = true;
+            return ret == HttpsConnection::TIMED_OUT ? ret : -1;
+        }
+    }
+}
+
+int Http2Session::OnHeader(nghttp2_session*,
+                           const nghttp2_frame* frame,
+                           const uint8_t* name,
+                           size_t namelen,
+                           const uint8_t* value,
+                           size_t valuelen,
+                           uint8_t,
+                           void* user_data) {
+    Http2Session* self = static_cast<Http2Session*>(user_data);
+    Stream* stream = self->FindStream(frame->hd.stream_id);
+    if (!stream || stream->head_sent)
+        return 0;
+
+    const char* name_str = reinterpret_cast<const char*>(name);
+    const char* value_str = reinterpret_cast<const char*>(value);
+    if (namelen == 7 && memcmp(name_str, ":status", 7) == 0) {
+        stream->head.assign("HTTP/2 ").append(value_str, valuelen).append("\r\n");
+    } else if (namelen > 0 && name_str[0] != ':') {
+        stream->head.append(name_str, namelen).append(": ").append(value_str, valuelen).append("\r\n");
+    }
+    return 0;
+}
+
+int Http2Session::OnFrameRecv(nghttp2_session*, const nghttp2_frame* frame, void* user_data) {
+    Http2Session* self = static_cast<Http2Session*>(user_data);
+    if (frame->hd.type != NGHTTP2_HEADERS || !(frame->hd.flags & NGHTTP2_FLAG_END_HEADERS))
+        return 0;
+    Stream* stream = self->FindStream(frame->hd.stream_id);
+    if (!stream || stream->head_sent)
+        return 0;
+
+    // Interim 1xx responses are dropped, the final one follows in another HEADERS frame
+    if (stream->head.compare(0, 8, "HTTP/2 1") == 0) {
+        stream->head.clear();
+        return 0;
+    }
+
+    stream->head.append("\r\n");
+    stream->head_sent = true;
+    stream->received.append(stream->head);
+    return 0;
+}
+
+int Http2Session::OnDataChunkRecv(nghttp2_session*,
+                                  uint8_t,
+                                  int32_t stream_id,
+                                  const uint8_t* data,
+                                  size_t len,
+                                  void* user_data) {
+    Http2Session* self = static_cast<Http2Session*>(user_data);
+    Stream* stream = self->FindStream(stream_id);
+    if (stream && stream->head_sent)
+        stream->received.append(reinterpret_cast<const char*>(data), len);
+    return 0;
+}
+
+int Http2Session::OnStreamClose(nghttp2_session*, int32_t stream_id, uint32_t error_code, void* user_data) {
+    Http2Session* self = static_cast<Http2Session*>(user_data);
+    auto it = self->streams_.find(stream_id);
+    if (it == self->streams_.end())
+        return 0;
+
+    // The end of the stream delimits a body without Content-Length, a reset never completes it
+    it->second.closed = true;
+    it->second.reset = error_code != NGHTTP2_NO_ERROR || !it->second.head_sent;
+    return 0;
+}
+
+ssize_t Http2Session::ReadBody(nghttp2_session*,
+                               int32_t stream_id,
+                               uint8_t* buf,
+                               size_t length,
+                               uint32_t* data_flags,
+                               nghttp2_data_source*,
+                               void* user_data) {
+    Http2Session* self = static_cast<Http2Session*>(user_data);
+    Stream* stream = self->FindStream(stream_id);
+    // nghttp2 resets a stream that was cancelled or closed, its buffers may be gone by now
+    if (!stream)
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+    size_t copied = 0;
+    while (copied < length && stream->body_index < stream->body.size()) {
+        const struct iovec& iov = stream->body[stream->body_index];
+        size_t len = std::min(length - copied, iov.iov_len - stream->body_offset);
+        memcpy(buf + copied, static_cast<const char*>(iov.iov_base) + stream->body_offset, len);
+        copied += len;
+        stream->body_offset += len;
+        if (stream->body_offset == iov.iov_len) {
+            stream->body_index++;
+            stream->body_offset = 0;
+        }
+    }
+
+    if (stream->body_index < stream->body.size())
+        return static_cast<ssize_t>(copied);
+
+    // The rest comes from the source, until it ends or the frame is full
+    bool eof = !stream->body_source;
+    while (!eof && copied < length) {
+        ssize_t len = stream->body_source(reinterpret_cast<char*>(buf) + copied, length - copied);
+        if (len < 0)
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;  // Resets this stream, the others go on
+        copied += len;
+        eof = len == 0;
+    }
+
+    if (eof) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        stream->body_source = nullptr;
+    }
+    return static_cast<ssize_t>(copied);
+}
@@ -0,0 +1,266 @@
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+#include "http_request_parser.h"
+
+static bool IsSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static ByteView Trim(const char* data, size_t len) {
+    while (len > 0 && IsSpace(data[0])) {
+        data++;
+        len--;
+    }
+    while (len > 0 && IsSpace(data[len - 1]))
+        len--;
+    ByteView view;
+    view.data = data;
+    view.size = len;
+    return view;
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool ByteView::Equals(const char* text) const {
+    return strlen(text) == size && memcmp(data, text, size) == 0;
+}
+
+bool ByteView::EqualsIgnoreCase(const char* text) const {
+    return strlen(text) == size && strncasecmp(data, text, size) == 0;
+}
+
+HttpRequestParser::HttpRequestParser() {
+    Reset();
+}
+
+void HttpRequestParser::Reset() {
+    state_ = STATE_REQUEST_LINE;
+    error_status_ = 0;
+    line_start_ = 0;
+    method_ = ByteView();
+    target_ = ByteView();
+    version_ = ByteView();
+    header_count_ = 0;
+    content_length_ = -1;
+    chunked_ = false;
+    expect_continue_ = false;
+    remaining_ = 0;
+    chunk_digits_ = false;
+    trailer_line_empty_ = true;
+    trailer_bytes_ = 0;
+    body_bytes_ = 0;
+}
+
+ByteView HttpRequestParser::header(const char* name) const {
+    for (size_t i = 0; i < header_count_; i++) {
+        if (headers_[i].name.EqualsIgnoreCase(name))
+            return headers_[i].value;
+    }
+    return ByteView();
+}
+
+long HttpRequestParser::Fail(int status) {
+    state_ = STATE_ERROR;
+    error_status_ = status;
+    return -1;
+}
+
+bool HttpRequestParser::ParseRequestLine(const char* line, size_t len) {
+    // POST /upload/audio HTTP/1.1
+    const char* end = line + len;
+    const char* method_end = static_cast<const char*>(memchr(line, ' ', len));
+    if (!method_end || method_end == line)
+        return false;
+    const char* target = method_end + 1;
+    const char* target_end = static_cast<const char*>(memchr(target, ' ', end - target));
+    if (!target_end || target_end == target)
+        return false;
+
+    method_.data = line;
+    method_.size = method_end - line;
+    target_.data = target;
+    target_.size = target_end - target;
+    version_.data = target_end + 1;
+    version_.size = end - version_.data;
+    return version_.size == 8 && memcmp(version_.data, "HTTP/1.", 7) == 0 &&
+           isdigit(static_cast<unsigned char>(version_.data[7]));
+}
+
+bool HttpRequestParser::ParseHeaderLine(const char* line, size_t len) {
+    // Obsolete line folding is not accepted, as RFC 9112 allows
+    if (IsSpace(line[0]))
+        return false;
+    const char* colon = static_cast<const char*>(memchr(line, ':', len));
+    if (!colon || colon == line || IsSpace(colon[-1]))
+        return false;
+    if (header_count_ == MAX_HEADERS) {
+        error_status_ = 431;
+        return false;
+    }
+
+    Header& header = headers_[header_count_++];
+    header.name.data = line;
+    header.name.size = colon - line;
+    header.value = Trim(colon + 1, line + len - colon - 1);
+
+    if (header.name.EqualsIgnoreCase("content-length")) {
+        long length = 0;
+        for (size_t i = 0; i < header.value.size; i++) {
+            char c = header.value.data[i];
+            if (!isdigit(static_cast<unsigned char>(c)) || length > (std::numeric_limits<long>::max() - 9) / 10)
+                return false;
+            length = length * 10 + (c - '0');
+        }
+        // Repeated with a different value, the body cannot be framed safely
+        if (header.value.empty() || (content_length_ >= 0 && content_length_ != length))
+            return false;
+        content_length_ = length;
+    } else if (header.name.EqualsIgnoreCase("transfer-encoding")) {
+        if (!header.value.EqualsIgnoreCase("chunked")) {
+            error_status_ = 501;
+            return false;
+        }
+        chunked_ = true;
+    } else if (header.name.EqualsIgnoreCase("expect")) {
+        expect_continue_ = header.value.EqualsIgnoreCase("100-continue");
+    }
+    return true;
+}
+
+void HttpRequestParser::StartBody() {
+    // Chunked framing wins over a Content-Length sent along with it
+    if (chunked_) {
+        state_ = STATE_CHUNK_SIZE;
+    } else if (content_length_ > 0) {
+        remaining_ = content_length_;
+        state_ = STATE_BODY_LENGTH;
+    } else {
+        state_ = STATE_DONE;  // A request without framing has no body
+    }
+}
+
+long HttpRequestParser::ParseHead(const char* buf, size_t len) {
+    if (state_ == STATE_ERROR)
+        return -1;
+
+    while (state_ <= STATE_HEADERS) {
+        const char* line = buf + line_start_;
+        const char* newline = static_cast<const char*>(memchr(line, '\n', len - line_start_));
+        if (!newline)
+            return 0;
+
+        size_t line_len = newline - line;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--;
+        line_start_ = newline + 1 - buf;
+
+        if (state_ == STATE_REQUEST_LINE) {
+            // Empty lines ahead of the request line are ignored
+            if (line_len == 0)
+                continue;
+            if (!ParseRequestLine(line, line_len))
+                return Fail(400);
+            state_ = STATE_HEADERS;
+        } else if (line_len == 0) {
+            StartBody();
+        } else if (!ParseHeaderLine(line, line_len)) {
+            return Fail(error_status_ ? error_status_ : 400);
+        }
+    }
+    return static_cast<long>(line_start_);
+}
+
+void HttpRequestParser::SkipBody(size_t n) {
+    if (state_ != STATE_BODY_LENGTH)
+        return;
+    n = std::min(n, static_cast<size_t>(remaining_));
+    body_bytes_ += n;
+    remaining_ -= n;
+    if (remaining_ == 0)
+        state_ = STATE_DONE;
+}
+
+long HttpRequestParser::DecodeBody(const char* data, size_t len, ByteView& payload) {
+    payload = ByteView();
+    size_t pos = 0;
+    while (pos < len) {
+        char c = data[pos];
+        switch (state_) {
+            case STATE_BODY_LENGTH:
+            case STATE_CHUNK_DATA: {
+                size_t take = std::min(len - pos, static_cast<size_t>(remaining_));
+                payload.data = data + pos;
+                payload.size = take;
+                body_bytes_ += take;
+                remaining_ -= take;
+                if (remaining_ == 0)
+                    state_ = state_ == STATE_BODY_LENGTH ? STATE_DONE : STATE_CHUNK_DATA_END;
+                return static_cast<long>(pos + take);
+            }
+
+            case STATE_CHUNK_SIZE: {
+                int digit = HexValue(c);
+                if (digit >= 0) {
+                    if (remaining_ > (std::numeric_limits<long>::max() >> 4))
+                        return Fail(413);
+                    remaining_ = remaining_ * 16 + digit;
+                    chunk_digits_ = true;
+                    pos++;
+                    break;
+                }
+                if (!chunk_digits_ || (c != ';' && c != '\r' && c != '\n' && !IsSpace(c)))
+                    return Fail(400);
+                state_ = STATE_CHUNK_EXTENSION;
+                break;
+            }
+
+            case STATE_CHUNK_EXTENSION:
+                pos++;
+                if (c != '\n')
+                    break;
+                chunk_digits_ = false;
+                state_ = remaining_ == 0 ? STATE_TRAILERS : STATE_CHUNK_DATA;
+                break;
+
+            case STATE_CHUNK_DATA_END:
+                pos++;
+                if (c == '\n')
+                    state_ = STATE_CHUNK_SIZE;
+                else if (c != '\r')
+                    return Fail(400);
+                break;
+
+            case STATE_TRAILERS:
+                // Trailer fields are skipped, an empty line ends the body
+                pos++;
+                if (++trailer_bytes_ > MAX_TRAILER_SIZE)
+                    return Fail(431);
+                if (c == '\n') {
+                    if (trailer_line_empty_) {
+                        state_ = STATE_DONE;
+                        return static_cast<long>(pos);
+                    }
+                    trailer_line_empty_ = true;
+                } else if (c != '\r') {
+                    trailer_line_empty_ = false;
+                }
+                break;
+
+            default:
+                // Done, or not in the body yet
+                return state_ == STATE_ERROR ? -1 : static_cast<long>(pos);
+        }
+    }
+    return static_cast<long>(pos);
+}
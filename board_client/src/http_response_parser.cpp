@@ -0,0 +1,256 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "http_response_parser.h"
+
+static std::string ToLower(const std::string& input) {
+    std::string output(input);
+    for (char& c : output)
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return output;
+}
+
+static std::string Trim(const std::string& input) {
+    size_t start = input.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    size_t end = input.find_last_not_of(" \t");
+    return input.substr(start, end - start + 1);
+}
+
+HttpResponseParser::HttpResponseParser() {
+    Reset();
+}
+
+void HttpResponseParser::Reset() {
+    state_ = STATE_STATUS_LINE;
+    line_.clear();
+    status_code_ = 0;
+    content_length_ = -1;
+    remaining_ = 0;
+    chunked_ = false;
+    keep_alive_ = true;
+    close_delimited_ = false;
+    trailing_data_ = false;
+    content_encoding_.clear();
+    decoding_ = false;
+    body_bytes_ = 0;
+    decoded_body_bytes_ = 0;
+    headers_.clear();
+    body_.clear();
+}
+
+std::string HttpResponseParser::Header(const std::string& name) const {
+    const std::string lower = ToLower(name);
+    for (const auto& header : headers_) {
+        if (header.first == lower)
+            return header.second;
+    }
+    return "";
+}
+
+bool HttpResponseParser::ParseStatusLine(const std::string& line) {
+    // HTTP/1.1 200 OK
+    if (line.compare(0, 5, "HTTP/") != 0)
+        return false;
+
+    size_t space = line.find(' ');
+    if (space == std::string::npos || space + 4 > line.size())
+        return false;
+
+    status_code_ = atoi(line.c_str() + space + 1);
+    if (status_code_ < 100 || status_code_ > 999)
+        return false;
+
+    // HTTP/1.0 servers close the connection unless told otherwise
+    keep_alive_ = line.compare(0, 8, "HTTP/1.0") != 0;
+    return true;
+}
+
+bool HttpResponseParser::ParseHeaderLine(const std::string& line) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0)
+        return false;
+
+    std::string name = ToLower(Trim(line.substr(0, colon)));
+    std::string value = Trim(line.substr(colon + 1));
+
+    if (name == "content-length") {
+        char* end = nullptr;
+        long length = strtol(value.c_str(), &end, 10);
+        if (end == value.c_str() || *end != '\0' || length < 0)
+            return false;
+        content_length_ = length;
+    } else if (name == "transfer-encoding") {
+        chunked_ = ToLower(value).find("chunked") != std::string::npos;
+    } else if (name == "content-encoding") {
+        content_encoding_ = ToLower(value);
+        if (content_encoding_ == "identity")
+            content_encoding_.clear();
+    } else if (name == "connection") {
+        std::string lower = ToLower(value);
+        if (lower.find("close") != std::string::npos)
+            keep_alive_ = false;
+        else if (lower.find("keep-alive") != std::string::npos)
+            keep_alive_ = true;
+    }
+
+    headers_.emplace_back(name, value);
+    return true;
+}
+
+void HttpResponseParser::StartBody() {
+    // 1xx, 204 and 304 responses never carry a body
+    if ((status_code_ >= 100 && status_code_ < 200) || status_code_ == 204 || status_code_ == 304) {
+        state_ = STATE_DONE;
+    } else if (chunked_) {
+        state_ = STATE_CHUNK_SIZE;
+    } else if (content_length_ >= 0) {
+        remaining_ = content_length_;
+        state_ = remaining_ > 0 ? STATE_BODY_LENGTH : STATE_DONE;
+    } else {
+        close_delimited_ = true;
+        state_ = STATE_BODY_EOF;
+    }
+
+    if (state_ == STATE_DONE || content_encoding_.empty())
+        return;
+
+    // Other encodings are never asked for and are passed on as they are
+    Inflater::Format format;
+    if (content_encoding_ == "gzip" || content_encoding_ == "x-gzip")
+        format = Inflater::FORMAT_GZIP;
+    else if (content_encoding_ == "deflate")
+        format = Inflater::FORMAT_DEFLATE;
+    else
+        return;
+
+    if (!inflater_)
+        inflater_.reset(new Inflater([this](const char* data, size_t len) { DeliverBody(data, len); }));
+    if (inflater_->Reset(format))
+        decoding_ = true;
+    else
+        state_ = STATE_ERROR;
+}
+
+void HttpResponseParser::EmitBody(const char* data, size_t len) {
+    if (len == 0)
+        return;
+    body_bytes_ += len;
+    if (!decoding_)
+        DeliverBody(data, len);
+    else if (!inflater_->Feed(data, len))
+        state_ = STATE_ERROR;
+}
+
+void HttpResponseParser::EndBody() {
+    // Cut off before the end of the deflate stream or the gzip trailer
+    state_ = decoding_ && !inflater_->finished() ? STATE_ERROR : STATE_DONE;
+}
+
+void HttpResponseParser::DeliverBody(const char* data, size_t len) {
+    decoded_body_bytes_ += len;
+    if (body_callback_)
+        body_callback_(data, len);
+    else
+        body_.append(data, len);
+}
+
+long HttpResponseParser::Feed(const char* data, size_t len) {
+    size_t pos = 0;
+
+    while (pos < len && state_ != STATE_DONE && state_ != STATE_ERROR) {
+        switch (state_) {
+            case STATE_BODY_LENGTH:
+            case STATE_CHUNK_DATA: {
+                size_t n = std::min(static_cast<size_t>(remaining_), len - pos);
+                EmitBody(data + pos, n);
+                if (state_ == STATE_ERROR)
+                    break;
+                pos += n;
+                remaining_ -= n;
+                if (remaining_ == 0) {
+                    if (state_ == STATE_BODY_LENGTH)
+                        EndBody();
+                    else
+                        state_ = STATE_CHUNK_DATA_END;
+                }
+                break;
+            }
+
+            case STATE_BODY_EOF:
+                EmitBody(data + pos, len - pos);
+                pos = len;
+                break;
+
+            default: {
+                // Line oriented states: status line, headers, chunk sizes and trailers
+                const char* newline = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+                size_t end = newline ? newline - data : len;
+                if (line_.size() + (end - pos) > MAX_LINE_SIZE) {
+                    state_ = STATE_ERROR;
+                    break;
+                }
+                line_.append(data + pos, end - pos);
+                pos = newline ? end + 1 : len;
+                if (!newline)
+                    break;
+
+                if (!line_.empty() && line_.back() == '\r')
+                    line_.pop_back();
+
+                if (state_ == STATE_STATUS_LINE) {
+                    state_ = ParseStatusLine(line_) ? STATE_HEADERS : STATE_ERROR;
+                } else if (state_ == STATE_HEADERS) {
+                    if (line_.empty()) {
+                        if (status_code_ == 101) {
+                            // Nothing here asks to switch protocols
+                            state_ = STATE_ERROR;
+                        } else if (status_code_ >= 100 && status_code_ < 200) {
+                            // Interim response (100 Continue, 103 Early Hints...), the real one follows
+                            bool keep_alive = keep_alive_;
+                            Reset();
+                            keep_alive_ = keep_alive;
+                        } else {
+                            StartBody();
+                        }
+                    } else if (!ParseHeaderLine(line_)) {
+                        state_ = STATE_ERROR;
+                    }
+                } else if (state_ == STATE_CHUNK_SIZE) {
+                    char* size_end = nullptr;
+                    long size = strtol(line_.c_str(), &size_end, 16);
+                    if (size_end == line_.c_str() || size < 0) {
+                        state_ = STATE_ERROR;
+                    } else if (size == 0) {
+                        state_ = STATE_TRAILERS;
+                    } else {
+                        remaining_ = size;
+                        state_ = STATE_CHUNK_DATA;
+                    }
+                } else if (state_ == STATE_CHUNK_DATA_END) {
+                    state_ = line_.empty() ? STATE_CHUNK_SIZE : STATE_ERROR;
+                } else if (state_ == STATE_TRAILERS) {
+                    if (line_.empty())
+                        EndBody();
+                }
+                line_.clear();
+                break;
+            }
+        }
+    }
+
+    // The server sent more than the response, what follows would be read as the next one
+    if (state_ == STATE_DONE && pos < len)
+        trailing_data_ = true;
+    return state_ == STATE_ERROR ? -1 : static_cast<long>(pos);
+}
+
+void HttpResponseParser::FeedEof() {
+    if (state_ == STATE_BODY_EOF)
+        EndBody();
+    else if (state_ != STATE_DONE)
+        state_ = STATE_ERROR;
+}
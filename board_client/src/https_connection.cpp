@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http2_session.h"
+#include "https_connection.h"
+
+constexpr int HttpsConnection::TIMED_OUT;
+
+HttpsConnection::HttpsConnection(int sockfd, SSL* ssl, const std::string& key)
+    : sockfd_(sockfd),
+      ssl_(ssl),
+      key_(key),
+      last_used_(time(nullptr)),
+      requests_started_(0),
+      early_data_(0) {}
+
+HttpsConnection::~HttpsConnection() {
+    // Goes before the SSL object it writes through
+    http2_.reset();
+    if (ssl_) {
+        // Only send close_notify on a connection that is still usable, never block on the reply
+        if (SSL_is_init_finished(ssl_) && !(SSL_get_shutdown(ssl_) & SSL_RECEIVED_SHUTDOWN))
+            SSL_shutdown(ssl_);
+        SSL_free(ssl_);
+    }
+    if (sockfd_ >= 0)
+        close(sockfd_);
+}
+
+// Waits for the socket condition an SSL call asked for. Returns 1 to retry the call, 0 if the
+// error is not a wait condition, or TIMED_OUT.
+static int WaitForSsl(int sockfd, int ssl_error, Deadline deadline) {
+    short events;
+    if (ssl_error == SSL_ERROR_WANT_READ)
+        events = POLLIN;
+    else if (ssl_error == SSL_ERROR_WANT_WRITE)
+        events = POLLOUT;
+    else
+        return 0;
+    return WaitForSocket(sockfd, events, deadline) ? 1 : HttpsConnection::TIMED_OUT;
+}
+
+int HttpsConnection::WriteAll(const char* data, size_t len, Deadline deadline) {
+    size_t written = 0;
+    while (written < len) {
+        // A retried write passes the same buffer again, as OpenSSL requires
+        int n = SSL_write(ssl_, data + written, static_cast<int>(len - written));
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+
+        int ssl_error = SSL_get_error(ssl_, n);
+        int wait = WaitForSsl(sockfd_, ssl_error, deadline);
+        if (wait == 1)
+            continue;
+        if (wait == TIMED_OUT)
+            return TIMED_OUT;
+        return ssl_error != SSL_ERROR_NONE ? ssl_error : SSL_ERROR_SYSCALL;
+    }
+    return 0;
+}
+
+int HttpsConnection::WriteV(const struct iovec* iov, int iovcnt, Deadline deadline, size_t skip) {
+    int on = 1;
+    setsockopt(sockfd_, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+    int ret = 0;
+    for (int i = 0; i < iovcnt && ret == 0; i++) {
+        const char* base = static_cast<const char*>(iov[i].iov_base);
+        size_t len = iov[i].iov_len;
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        ret = WriteAll(base + skip, len - skip, deadline);
+        skip = 0;
+    }
+
+    int off = 0;
+    setsockopt(sockfd_, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    return ret;
+}
+
+int HttpsConnection::Read(char* buf, size_t len, Deadline deadline) {
+    while (true) {
+        int n = SSL_read(ssl_, buf, static_cast<int>(len));
+        if (n > 0)
+            return n;
+
+        int ssl_error = SSL_get_error(ssl_, n);
+        if (ssl_error == SSL_ERROR_ZERO_RETURN)
+            return 0;
+
+        int wait = WaitForSsl(sockfd_, ssl_error, deadline);
+        if (wait == 1)
+            continue;
+        if (wait == TIMED_OUT)
+            return TIMED_OUT;
+        ERR_clear_error();
+        return -1;
+    }
+}
+
+bool HttpsConnection::IsAlive() const {
+    // An idle keep-alive connection must have nothing to read: readability means either
+    // the FIN or a close_notify/alert from the server, both of which end the connection.
+    // HTTP/2 is the exception, the server sends SETTINGS and PING frames on its own; the
+    // session handles them with the next response.
+    if (SSL_pending(ssl_) > 0)
+        return http2_ != nullptr;
+
+    struct pollfd pfd;
+    pfd.fd = sockfd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ret;
+    do {
+        ret = poll(&pfd, 1, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret <= 0)
+        return ret == 0;
+
+    // TLS 1.3 session tickets also arrive after the handshake, on a connection that never
+    // served a request they are still unread. Peeking processes them without taking any data.
+    char byte;
+    int peeked = SSL_peek(ssl_, &byte, 1);
+    if (peeked > 0)
+        return http2_ != nullptr;
+    int error = SSL_get_error(ssl_, peeked);
+    ERR_clear_error();
+    return error == SSL_ERROR_WANT_READ;
+}
+
+void HttpsConnection::set_http2(std::unique_ptr<Http2Session> session) {
+    http2_ = std::move(session);
+}
+
+void HttpsConnection::MarkIdle() {
+    last_used_ = time(nullptr);
+}
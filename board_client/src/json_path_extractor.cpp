@@ -0,0 +1,294 @@
+#include <stdlib.h>
+
+#include "json_path_extractor.h"
+#include "json_string.h"
+
+static inline bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+JsonPathExtractor::JsonPathExtractor(const std::vector<PathElement>& path, TextCallback on_text)
+    : path_(path), on_text_(on_text) {
+    Reset();
+}
+
+void JsonPathExtractor::Reset() {
+    state_ = STATE_VALUE;
+    stack_.clear();
+    key_.clear();
+    key_too_long_ = false;
+    key_escape_ = false;
+    escape_.clear();
+    found_ = false;
+}
+
+std::string JsonPathExtractor::PathString() const {
+    std::string result;
+    for (const PathElement& element : path_) {
+        if (element.index >= 0) {
+            result += "[" + std::to_string(element.index) + "]";
+        } else {
+            if (!result.empty())
+                result += '.';
+            result += element.key;
+        }
+    }
+    return result;
+}
+
+JsonPathExtractor::Match JsonPathExtractor::MatchValue() const {
+    if (stack_.empty())
+        return path_.empty() ? MATCH_TARGET : MATCH_PREFIX;
+
+    const Frame& top = stack_.back();
+    if (!top.on_path)
+        return MATCH_NONE;
+
+    const size_t depth = stack_.size() - 1;
+    const PathElement& element = path_[depth];
+    bool matches = top.is_object ? (element.index < 0 && !key_too_long_ && key_ == element.key)
+                                 : element.index == top.index;
+    if (!matches)
+        return MATCH_NONE;
+    return depth + 1 == path_.size() ? MATCH_TARGET : MATCH_PREFIX;
+}
+
+bool JsonPathExtractor::BeginValue(char c) {
+    const Match match = MatchValue();
+
+    if (c == '{' || c == '[') {
+        if (stack_.size() >= MAX_DEPTH)
+            return false;
+
+        Frame frame;
+        frame.is_object = c == '{';
+        frame.on_path = match == MATCH_PREFIX;
+        frame.index = 0;
+        stack_.push_back(frame);
+        state_ = frame.is_object ? STATE_KEY_OR_END : STATE_VALUE_OR_END;
+    } else if (c == '"') {
+        state_ = match == MATCH_TARGET ? STATE_TARGET_STRING : STATE_VALUE_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+        state_ = STATE_LITERAL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void JsonPathExtractor::EndValue() {
+    state_ = stack_.empty() ? STATE_DONE : STATE_COMMA_OR_END;
+}
+
+void JsonPathExtractor::FinishTargetEscape() {
+    scratch_.clear();
+    JsonUnescape(escape_.data(), escape_.size(), scratch_);
+    if (on_text_ && !scratch_.empty())
+        on_text_(scratch_.data(), scratch_.size());
+    escape_.clear();
+    state_ = STATE_TARGET_STRING;
+}
+
+bool JsonPathExtractor::Feed(const char* data, size_t len) {
+    size_t i = 0;
+    while (i < len && state_ != STATE_ERROR) {
+        const char c = data[i];
+
+        switch (state_) {
+            case STATE_VALUE:
+            case STATE_VALUE_OR_END:
+                if (IsSpace(c)) {
+                    i++;
+                } else if (c == ']' && state_ == STATE_VALUE_OR_END) {
+                    stack_.pop_back();
+                    EndValue();
+                    i++;
+                } else if (!BeginValue(c)) {
+                    state_ = STATE_ERROR;
+                } else if (state_ != STATE_LITERAL) {
+                    i++;  // Literals are scanned from their first character
+                }
+                break;
+
+            case STATE_KEY_OR_END:
+            case STATE_KEY:
+                if (IsSpace(c)) {
+                    i++;
+                } else if (c == '}' && state_ == STATE_KEY_OR_END) {
+                    stack_.pop_back();
+                    EndValue();
+                    i++;
+                } else if (c == '"') {
+                    key_.clear();
+                    key_too_long_ = false;
+                    key_escape_ = false;
+                    state_ = STATE_KEY_STRING;
+                    i++;
+                } else {
+                    state_ = STATE_ERROR;
+                }
+                break;
+
+            case STATE_KEY_STRING:
+                // Keys are short, byte at a time is fine
+                i++;
+                if (!key_escape_ && c == '"') {
+                    if (key_.find('\\') != std::string::npos) {
+                        std::string raw;
+                        raw.swap(key_);
+                        JsonUnescape(raw.data(), raw.size(), key_);
+                    }
+                    state_ = STATE_COLON;
+                    break;
+                }
+                key_escape_ = !key_escape_ && c == '\\';
+                if (key_.size() < MAX_KEY_SIZE)
+                    key_ += c;
+                else
+                    key_too_long_ = true;
+                break;
+
+            case STATE_COLON:
+                if (IsSpace(c)) {
+                    i++;
+                } else if (c == ':') {
+                    state_ = STATE_VALUE;
+                    i++;
+                } else {
+                    state_ = STATE_ERROR;
+                }
+                break;
+
+            case STATE_COMMA_OR_END: {
+                Frame& top = stack_.back();
+                i++;
+                if (IsSpace(c)) {
+                    break;
+                } else if (c == ',') {
+                    if (top.is_object) {
+                        state_ = STATE_KEY;
+                    } else {
+                        top.index++;
+                        state_ = STATE_VALUE;
+                    }
+                } else if (c == (top.is_object ? '}' : ']')) {
+                    stack_.pop_back();
+                    EndValue();
+                } else {
+                    state_ = STATE_ERROR;
+                }
+                break;
+            }
+
+            case STATE_VALUE_STRING: {
+                // Skip to the next quote or backslash
+                size_t j = i;
+                while (j < len && data[j] != '"' && data[j] != '\\')
+                    j++;
+                if (j == len) {
+                    i = len;
+                } else if (data[j] == '\\') {
+                    state_ = STATE_SKIP_ESCAPE;
+                    i = j + 1;
+                } else {
+                    EndValue();
+                    i = j + 1;
+                }
+                break;
+            }
+
+            case STATE_SKIP_ESCAPE:
+                state_ = STATE_VALUE_STRING;
+                i++;
+                break;
+
+            case STATE_TARGET_STRING: {
+                // Plain bytes go out straight from the input buffer. Two-character escapes that
+                // are complete in it are decoded into scratch_ along with the plain runs around
+                // them, so escaped text costs one callback per buffer instead of one per escape.
+                scratch_.clear();
+                size_t run = i;  // Start of the bytes not handed out or copied yet
+                while (true) {
+                    i += JsonPlainPrefix(data + i, len - i);
+                    if (i + 1 >= len || data[i] != '\\' || data[i + 1] == 'u')
+                        break;
+                    scratch_.append(data + run, i - run);
+                    JsonUnescape(data + i, 2, scratch_);
+                    i += 2;
+                    run = i;
+                }
+                if (on_text_) {
+                    if (!scratch_.empty()) {
+                        scratch_.append(data + run, i - run);
+                        on_text_(scratch_.data(), scratch_.size());
+                    } else if (i > run) {
+                        on_text_(data + run, i - run);
+                    }
+                }
+                if (i == len)
+                    break;
+
+                if (data[i] == '"') {
+                    found_ = true;
+                    EndValue();
+                } else if (data[i] == '\\') {
+                    // \uXXXX, or an escape cut off by the end of the buffer
+                    escape_.assign(1, '\\');
+                    state_ = STATE_TARGET_ESCAPE;
+                } else if (on_text_) {
+                    on_text_(data + i, 1);  // Raw control character, tolerated
+                }
+                i++;
+                break;
+            }
+
+            case STATE_TARGET_ESCAPE: {
+                escape_ += c;
+                i++;
+                const size_t n = escape_.size();
+                if (n == 2) {
+                    if (c != 'u')
+                        FinishTargetEscape();
+                } else if (n == 6) {
+                    // A high surrogate has to be decoded together with the following \uXXXX
+                    long unit = strtol(escape_.substr(2).c_str(), nullptr, 16);
+                    if (unit < 0xD800 || unit > 0xDBFF)
+                        FinishTargetEscape();
+                } else if (n == 7 && c != '\\') {
+                    escape_.pop_back();
+                    i--;
+                    FinishTargetEscape();
+                } else if (n == 8 && c != 'u') {
+                    // Lone high surrogate followed by another escape: decode the first on its
+                    // own and restart at the new backslash
+                    escape_.resize(6);
+                    i--;
+                    FinishTargetEscape();
+                    escape_.assign(1, '\\');
+                    state_ = STATE_TARGET_ESCAPE;
+                } else if (n == 12) {
+                    FinishTargetEscape();
+                }
+                break;
+            }
+
+            case STATE_LITERAL:
+                if (c == ',' || c == '}' || c == ']' || IsSpace(c))
+                    EndValue();
+                else
+                    i++;
+                break;
+
+            case STATE_DONE:
+                if (!IsSpace(c))
+                    state_ = STATE_ERROR;
+                i++;
+                break;
+
+            case STATE_ERROR:
+                break;
+        }
+    }
+
+    return state_ != STATE_ERROR;
+}
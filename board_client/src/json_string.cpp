@@ -0,0 +1,366 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JSON_STRING_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define JSON_STRING_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_STRING_SSE2
+#endif
+
+#include "json_string.h"
+
+// Escaped length of every byte value: 1 for plain bytes, 2 for the short escapes and 6 for
+// the other control characters (\u00XX).
+static const unsigned char kEscapedLength[256] = {
+    6, 6, 6, 6, 6, 6, 6, 6, 2, 2, 2, 6, 2, 2, 6, 6,  // 0x00
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0x10
+    1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x20 '"'
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1,  // 0x50 '\\'
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xB0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xC0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xD0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xE0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  // 0xF0
+};
+
+static const char kHex[] = "0123456789abcdef";
+
+// JsonPlainPrefix/FindBackslash kernels. The vector versions test 16 or 32 bytes per step
+// and leave the tail to the scalar loop.
+#if defined(JSON_STRING_NEON)
+
+// Collapses a 0x00/0xFF byte mask into 4 bits per byte (vshrn trick, ARMv7 has no vmaxv)
+static inline uint64_t NeonMask(uint8x16_t mask) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(mask), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+size_t JsonPlainPrefix(const char* data, size_t len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t chunk = vld1q_u8(p + i);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)),
+                                      vcltq_u8(chunk, space));
+        uint64_t mask = NeonMask(special);
+        if (mask)
+            return i + (__builtin_ctzll(mask) >> 2);
+    }
+    while (i < len && kEscapedLength[p[i]] == 1)
+        i++;
+    return i;
+}
+
+static size_t FindBackslash(const char* data, size_t len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint64_t mask = NeonMask(vceqq_u8(vld1q_u8(p + i), backslash));
+        if (mask)
+            return i + (__builtin_ctzll(mask) >> 2);
+    }
+    while (i < len && p[i] != '\\')
+        i++;
+    return i;
+}
+
+#elif defined(JSON_STRING_AVX2)
+
+size_t JsonPlainPrefix(const char* data, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control_max = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        // Unsigned chunk <= 0x1F  <=>  min(chunk, 0x1F) == chunk
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control_max), chunk);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)), control);
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    while (i < len && kEscapedLength[p[i]] == 1)
+        i++;
+    return i;
+}
+
+static size_t FindBackslash(const char* data, size_t len) {
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    while (i < len && data[i] != '\\')
+        i++;
+    return i;
+}
+
+#elif defined(JSON_STRING_SSE2)
+
+size_t JsonPlainPrefix(const char* data, size_t len) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        // Unsigned chunk <= 0x1F  <=>  min(chunk, 0x1F) == chunk
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control_max), chunk);
+        __m128i special =
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), control);
+        int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    while (i < len && kEscapedLength[p[i]] == 1)
+        i++;
+    return i;
+}
+
+static size_t FindBackslash(const char* data, size_t len) {
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    while (i < len && data[i] != '\\')
+        i++;
+    return i;
+}
+
+#else
+
+size_t JsonPlainPrefix(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    size_t i = 0;
+    while (i < len && kEscapedLength[p[i]] == 1)
+        i++;
+    return i;
+}
+
+static size_t FindBackslash(const char* data, size_t len) {
+    const void* found = memchr(data, '\\', len);
+    return found ? static_cast<const char*>(found) - data : len;
+}
+
+#endif
+
+size_t JsonEscapedSize(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    size_t size = 0;
+    size_t i = 0;
+    while (i < len) {
+        size_t plain = JsonPlainPrefix(data + i, len - i);
+        size += plain;
+        i += plain;
+        if (i < len)
+            size += kEscapedLength[p[i++]];
+    }
+    return size;
+}
+
+char* JsonEscape(const char* data, size_t len, char* out) {
+    size_t i = 0;
+    while (i < len) {
+        size_t plain = JsonPlainPrefix(data + i, len - i);
+        memcpy(out, data + i, plain);
+        out += plain;
+        i += plain;
+        if (i == len)
+            break;
+
+        unsigned char c = static_cast<unsigned char>(data[i++]);
+        *out++ = '\\';
+        switch (c) {
+            case '\"':
+                *out++ = '\"';
+                break;
+            case '\\':
+                *out++ = '\\';
+                break;
+            case '\b':
+                *out++ = 'b';
+                break;
+            case '\f':
+                *out++ = 'f';
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = 't';
+                break;
+            default:  // Other control characters (0x00-0x1F)
+                memcpy(out, "u00", 3);
+                out[3] = kHex[c >> 4];
+                out[4] = kHex[c & 0xF];
+                out += 5;
+                break;
+        }
+    }
+    return out;
+}
+
+// Value of a hex digit, or -1 (0xFF) for a character that is not one
+static const signed char kHexValue[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x00
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x10
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x20
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  -1, -1, -1, -1, -1, -1,  // 0x30 '0'-'9'
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x40 'A'-'F'
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x50
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x60 'a'-'f'
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x70
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x80
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0x90
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xA0
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xB0
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xC0
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xD0
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xE0
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  // 0xF0
+};
+
+// Parses the 4 hex digits at data, returns -1 if they are not all hex.
+static long ParseHex4(const char* data) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    int d0 = kHexValue[p[0]], d1 = kHexValue[p[1]], d2 = kHexValue[p[2]], d3 = kHexValue[p[3]];
+    if ((d0 | d1 | d2 | d3) < 0)  // One test for all four digits
+        return -1;
+    return (d0 << 12) | (d1 << 8) | (d2 << 4) | d3;
+}
+
+// Writes cp as UTF-8 to out, returns the end of the written bytes.
+static char* WriteUtf8(unsigned long cp, char* out) {
+    if (cp < 0x80) {
+        *out++ = static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (cp >> 6));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | (cp >> 12));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | (cp >> 18));
+        *out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+void JsonUnescape(const char* data, size_t len, std::string& out) {
+    // Unescaping never makes the text longer: written in place and trimmed at the end, so an
+    // escape costs no more than a few stores
+    const size_t start = out.size();
+    out.resize(start + len);
+    char* const begin = &out[start];
+    char* dst = begin;
+
+    size_t i = 0;
+    while (i < len) {
+        // Escapes often come back to back (\uXXXX runs), so skip the search when one follows
+        size_t plain = data[i] == '\\' ? 0 : FindBackslash(data + i, len - i);
+        memcpy(dst, data + i, plain);
+        dst += plain;
+        i += plain;
+        if (i + 1 >= len) {  // No escape left, or a trailing lone backslash
+            memcpy(dst, data + i, len - i);
+            dst += len - i;
+            break;
+        }
+
+        const char esc_char = data[i + 1];
+        i += 2;
+        switch (esc_char) {
+            case 'n':
+                *dst++ = '\n';
+                break;
+            case 't':
+                *dst++ = '\t';
+                break;
+            case 'r':
+                *dst++ = '\r';
+                break;
+            case 'b':
+                *dst++ = '\b';
+                break;
+            case 'f':
+                *dst++ = '\f';
+                break;
+            case '"':
+                *dst++ = '"';
+                break;
+            case '\\':
+                *dst++ = '\\';
+                break;
+            case '/':
+                *dst++ = '/';
+                break;
+            case 'u': {
+                long unit = i + 4 <= len ? ParseHex4(data + i) : -1;
+                if (unit < 0) {
+                    // Keep the malformed escape as it is
+                    *dst++ = '\\';
+                    *dst++ = 'u';
+                    break;
+                }
+                i += 4;
+
+                unsigned long cp = unit;
+                if (unit >= 0xD800 && unit <= 0xDBFF) {
+                    // High surrogate, must be followed by \uDC00-\uDFFF
+                    long low = -1;
+                    if (i + 6 <= len && data[i] == '\\' && data[i + 1] == 'u')
+                        low = ParseHex4(data + i + 2);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+                    cp = 0xFFFD;  // Low surrogate without a high one
+                }
+                // At most 4 bytes out of at least 6 in (3 out of 6 for a lone surrogate)
+                dst = WriteUtf8(cp, dst);
+                break;
+            }
+            default:  // Keep unrecognised escape sequences
+                *dst++ = '\\';
+                *dst++ = esc_char;
+                break;
+        }
+    }
+    out.resize(start + (dst - begin));
+}
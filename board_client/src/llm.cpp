@@ -3,438 +3,713 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <openssl/bio.h>
 #include <openssl/err.h>
-#include <openssl/evp.h>
 #include <openssl/ssl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <memory>
 
+#include "base64.h"
+#include "http2_session.h"
 #include "llm.h"
+#include "sse_decoder.h"
+
+// Raw image bytes read per step when streaming an image into a request, a multiple of 3 so
+// that every chunk but the last encodes without carry
+static constexpr size_t IMAGE_CHUNK_SIZE = 48 * 1024;
+
+// Smaller bodies fit in a couple of segments anyway, compressing them only costs CPU
+static constexpr size_t MIN_COMPRESS_SIZE = 1024;
+
+// Error responses are only logged, keep at most this much of them
+static constexpr size_t ERROR_BODY_LIMIT = 4096;
+
+static void AppendLimited(std::string& out, const char* data, size_t len) {
+    if (out.size() < ERROR_BODY_LIMIT)
+        out.append(data, std::min(len, ERROR_BODY_LIMIT - out.size()));
+}
+
+// Reads an image file and base64 encodes it one chunk at a time, so that only a single chunk
+// of it is ever held in memory. Throws std::runtime_error if the file cannot be read.
+class ImageEncoder {
+   public:
+    ImageEncoder(const std::string& path, size_t size)
+        : path_(path),
+          file_(path, std::ios::binary),
+          remaining_(size),
+          chunk_(new char[IMAGE_CHUNK_SIZE]),
+          encoded_(new char[Base64Encoder::MaxOutputSize(IMAGE_CHUNK_SIZE)]),
+          encoded_len_(0),
+          encoded_pos_(0) {
+        if (!file_.is_open())
+            throw std::runtime_error("Could not open " + path_);
+    }
+
+    // Encodes the next chunk into data(). Returns its length, 0 once the image is done.
+    size_t Next() {
+        if (remaining_ == 0)
+            return 0;
+        file_.read(chunk_.get(), std::min(remaining_, IMAGE_CHUNK_SIZE));
+        size_t got = file_.gcount();
+        if (got == 0)
+            throw std::runtime_error("Image " + path_ + " shrank while being sent");
+        remaining_ -= got;
+
+        encoded_len_ = encoder_.Update(reinterpret_cast<unsigned char*>(chunk_.get()), got, encoded_.get());
+        if (remaining_ == 0)
+            encoded_len_ += encoder_.Finish(encoded_.get() + encoded_len_);
+        encoded_pos_ = 0;
+        return encoded_len_;
+    }
+
+    const char* data() const { return encoded_.get(); }
+
+    // Copies up to len bytes of the encoding to buf, encoding the next chunk once the last one
+    // is used up. Returns how many, 0 once the image is done.
+    size_t Read(char* buf, size_t len) {
+        if (encoded_pos_ == encoded_len_ && Next() == 0)
+            return 0;
+        size_t copied = std::min(len, encoded_len_ - encoded_pos_);
+        memcpy(buf, encoded_.get() + encoded_pos_, copied);
+        encoded_pos_ += copied;
+        return copied;
+    }
+
+   private:
+    std::string path_;
+    std::ifstream file_;
+    size_t remaining_;  // Image bytes not read yet
+    Base64Encoder encoder_;
+    std::unique_ptr<char[]> chunk_;
+    std::unique_ptr<char[]> encoded_;
+    size_t encoded_len_;
+    size_t encoded_pos_;  // Taken by Read() so far
+};
 
 LLM::LLM(std::string name,
          std::string host,
          std::string path_base,
          std::string api_key,
-         ApiAuthMethod auth_method,
          std::string model_name,
-         std::string response_search_key,
          std::string role,
          bool use_proxy)
     : name_(name),
       host_(host),
+      port_(TARGET_PORT),
       path_base_(path_base),
       api_key_(api_key),
-      auth_method_(auth_method),
       model_name_(model_name),
-      response_search_key_(response_search_key),
       role_(role),
-      use_proxy_(use_proxy) {};
+      use_proxy_(use_proxy),
+      provider_(FindProvider(name)),
+      last_error_(LlmError::NONE),
+      compression_level_(0),
+      accept_compressed_(false),
+      body_compressed_(false),
+      last_transfer_(),
+      cancelled_(false),
+      active_fd_(-1),
+      history_clock_(0) {
+    if (!provider_)
+        throw std::runtime_error("Unknown LLM provider: " + name);
+
+    cancel_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cancel_fd_ < 0)
+        perror("eventfd() failed");
+
+    // Resolve ahead of the first request so it does not wait on DNS
+    DnsResolver::Instance().Prefetch(use_proxy_ ? PROXY_HOST : host_);
+};
+
+LLM::~LLM() {
+    if (cancel_fd_ >= 0)
+        close(cancel_fd_);
+};
+
+std::string LLM::SendRequest(std::vector<ConversationMessage>& conversation_data, int conversation_id) {
+    try {
+        std::string header = BuildRequest(conversation_data, false, conversation_id);
+
+        // The reply text is pulled out of the body as it arrives instead of buffering the document
+        std::string text;
+        JsonPathExtractor extractor(provider_->response_path(false), [&](const char* data, size_t len) {
+            text.append(data, len);
+        });
+
+        HttpResponseParser parser;
+        std::string error_body;
+        parser.set_body_callback([&](const char* data, size_t len) {
+            if (parser.status_code() != 200)
+                AppendLimited(error_body, data, len);
+            else
+                extractor.Feed(data, len);
+        });
+
+        Transact(header, parser);
+
+        if (parser.status_code() != 200) {
+            std::cerr << "ERROR [Parse]: HTTP " << parser.status_code() << " " << error_body << std::endl;
+            last_error_ = LlmError::HTTP_ERROR;
+            return "";
+        }
+        if (!extractor.found()) {
+            std::cerr << "ERROR [Parse]: Could not find " << extractor.PathString() << " in response body."
+                      << std::endl;
+            last_error_ = LlmError::BAD_RESPONSE;
+            return "";
+        }
+        last_error_ = LlmError::NONE;
+        return text;
 
-LLM::~LLM() {};
+    } catch (const std::exception& e) {
+        RecordError("SendRequest", e);
+        return "";
+    }
+}
 
-std::string LLM::SendRequest(std::vector<ConversationMessage>& conversation_data) {
+std::string LLM::SendStreamRequest(std::vector<ConversationMessage>& conversation_data,
+                                   TokenCallback on_token,
+                                   int conversation_id) {
     try {
-        // --- Initialize OpenSSL ---
-        OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr);
-        OPENSSL_init_crypto(OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, nullptr);
-
-        // --- Create Socket ---
-        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0) {
-            throw std::runtime_error("Failed to open socket: " + std::string(strerror(errno)));
+        std::string header = BuildRequest(conversation_data, true, conversation_id);
+
+        std::string text;
+        std::string delta;
+        JsonPathExtractor extractor(provider_->response_path(true), [&](const char* data, size_t len) {
+            delta.append(data, len);
+        });
+        SseDecoder sse([&](const std::string& event, const std::string& data) {
+            (void)event;
+            if (provider_->is_stream_end(data))
+                return;
+
+            // Role-only and finish chunks carry no text
+            delta.clear();
+            extractor.Reset();
+            extractor.Feed(data.data(), data.size());
+            if (!extractor.found() || delta.empty())
+                return;
+
+            text += delta;
+            if (on_token)
+                on_token(delta);
+        });
+
+        // Errors are reported as a plain JSON body instead of an event stream
+        HttpResponseParser parser;
+        bool is_event_stream = false;
+        bool sse_overflow = false;
+        std::string error_body;
+        parser.set_body_callback([&](const char* data, size_t len) {
+            if (!is_event_stream && error_body.empty())
+                is_event_stream = parser.Header("Content-Type").find("text/event-stream") != std::string::npos;
+
+            if (!is_event_stream)
+                AppendLimited(error_body, data, len);
+            else if (!sse.Feed(data, len))
+                sse_overflow = true;
+        });
+
+        Transact(header, parser);
+
+        if (!is_event_stream) {
+            std::cerr << "ERROR [Stream]: HTTP " << parser.status_code() << " " << error_body << std::endl;
+            last_error_ = parser.status_code() != 200 ? LlmError::HTTP_ERROR : LlmError::BAD_RESPONSE;
+            return "";
         }
+        if (sse_overflow)
+            throw LlmError(LlmError::BAD_RESPONSE, "Event stream exceeds maximum event size");
 
-        // --- Connect (Directly or via Proxy) ---
-        if (use_proxy_) {
-            struct sockaddr_in proxy_addr;
-            memset(&proxy_addr, 0, sizeof(proxy_addr));
-            proxy_addr.sin_family = AF_INET;
-            proxy_addr.sin_port = htons(PROXY_PORT);
-            if (inet_pton(AF_INET, PROXY_HOST, &proxy_addr.sin_addr) <= 0) {
-                close(sockfd);
-                throw std::runtime_error("Invalid proxy address or address not supported");
-            }
-
-            if (connect(sockfd, reinterpret_cast<struct sockaddr*>(&proxy_addr), sizeof(proxy_addr)) < 0) {
-                std::string error_msg = "Error connecting to proxy " + std::string(PROXY_HOST) + ":" +
-                                        std::to_string(PROXY_PORT) + " - " + strerror(errno);
-                close(sockfd);
-                throw std::runtime_error(error_msg);
-            }
-
-            std::string connect_req = "CONNECT " + host_ + ":" + std::to_string(TARGET_PORT) +
-                                      " HTTP/1.1\r\n" + "Host: " + host_ + ":" + std::to_string(TARGET_PORT) +
-                                      "\r\n" + "Proxy-Connection: Keep-Alive\r\n" +
-                                      "User-Agent: C++-Client/1.0\r\n\r\n";
-
-            if (send(sockfd, connect_req.c_str(), connect_req.length(), 0) < 0) {
-                close(sockfd);
-                throw std::runtime_error("Error sending CONNECT request to proxy: " +
-                                         std::string(strerror(errno)));
-            }
-
-            std::vector<char> proxy_response(BUFFER_SIZE);
-            int bytes = recv(sockfd, proxy_response.data(), proxy_response.size() - 1, 0);
-            if (bytes <= 0) {
-                close(sockfd);
-                throw std::runtime_error("Error reading response from proxy: " +
-                                         std::string(strerror(errno)));
-            }
-
-            proxy_response[bytes] = '\0';
-            std::string response_str(proxy_response.data());
-
-            if (response_str.find("HTTP/1.") == 0 && response_str.find(" 200 ") == std::string::npos) {
-                close(sockfd);
-                throw std::runtime_error("Proxy CONNECT request failed: " + response_str);
-            }
-        } else {  // Direct Connection
-            struct hostent* hostent = gethostbyname(host_.c_str());
-            if (hostent == nullptr) {
-                close(sockfd);
-                throw std::runtime_error("Could not resolve hostname: " + host_);
-            }
-
-            struct sockaddr_in target_addr;
-            memset(&target_addr, 0, sizeof(target_addr));
-            target_addr.sin_family = AF_INET;
-            target_addr.sin_port = htons(TARGET_PORT);
-            memcpy(&target_addr.sin_addr, hostent->h_addr_list[0], hostent->h_length);
-
-            if (connect(sockfd, reinterpret_cast<struct sockaddr*>(&target_addr), sizeof(target_addr)) < 0) {
-                std::string error_msg = "Error connecting to target " + host_ + ":" +
-                                        std::to_string(TARGET_PORT) + " - " + strerror(errno);
-                close(sockfd);
-                throw std::runtime_error(error_msg);
-            }
-        }
+        sse.Finish();
+        last_error_ = LlmError::NONE;
+        return text;
 
-        // --- SSL/TLS Setup ---
-        std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> ctx(SSL_CTX_new(TLS_client_method()), SSL_CTX_free);
-        if (!ctx) {
-            close(sockfd);
-            throw std::runtime_error("Error creating SSL context");
-        }
+    } catch (const std::exception& e) {
+        RecordError("SendStreamRequest", e);
+        return "";
+    }
+}
 
-        SSL_CTX_set_min_proto_version(ctx.get(), TLS1_2_VERSION);
+void LLM::RecordError(const char* function, const std::exception& e) {
+    const LlmError* error = dynamic_cast<const LlmError*>(&e);
+    last_error_ = error ? error->kind() : LlmError::OTHER;
+    std::cerr << "Error in LLM::" << function << ": " << e.what() << std::endl;
+}
 
-        std::unique_ptr<SSL, decltype(&SSL_free)> ssl(SSL_new(ctx.get()), SSL_free);
-        if (!ssl) {
-            close(sockfd);
-            throw std::runtime_error("Error creating SSL structure");
-        }
+std::string LLM::BuildRequest(std::vector<ConversationMessage>& conversation_data, bool stream, int conversation_id) {
+    // --- Construct the HTTPS POST Request ---
+    std::string full_path = path_base_;
+    std::string auth_header;
 
-        if (!SSL_set_fd(ssl.get(), sockfd)) {
-            close(sockfd);
-            throw std::runtime_error("Error attaching SSL to socket descriptor");
-        }
+    provider_->adjust_path(full_path, stream);
 
-        if (SSL_set_tlsext_host_name(ssl.get(), host_.c_str()) != 1) {
-            close(sockfd);
-            throw std::runtime_error("Error setting SNI hostname");
-        }
+    // Build path and potentially Authorization header based on auth_method
+    if (api_key_.empty()) {
+        // Local stand-ins usually take no key
+    } else if (provider_->auth == AUTH_METHOD_URL_PARAM) {
+        full_path += (full_path.find('?') == std::string::npos ? "?key=" : "&key=") + api_key_;
+    } else if (provider_->auth == AUTH_METHOD_BEARER_HEADER) {
+        auth_header = "Authorization: Bearer " + api_key_ + "\r\n";
+    }
 
-        if (SSL_connect(ssl.get()) <= 0) {
-            close(sockfd);
-            throw std::runtime_error("Error in SSL handshake");
-        }
+    GeneratePayload(conversation_data, stream, conversation_id);
+    body_compressed_ = CompressBody();
+
+    std::string header;
+    header.reserve(256 + full_path.size() + auth_header.size());
+    header.append("POST ").append(full_path).append(" HTTP/1.1\r\nHost: ").append(host_);
+    if (port_ != TARGET_PORT)
+        header.append(":").append(std::to_string(port_));
+    header.append("\r\nContent-Type: application/json\r\n");
+    if (body_compressed_)
+        header.append("Content-Encoding: gzip\r\n");
+    if (accept_compressed_)
+        header.append("Accept-Encoding: gzip, deflate\r\n");
+    if (stream)
+        header.append("Accept: text/event-stream\r\n");
+    size_t content_length = body_compressed_ ? compressor_.output().size() : body_.size();
+    header.append(auth_header).append("Content-Length: ").append(std::to_string(content_length));
+    header.append("\r\nConnection: keep-alive\r\nUser-Agent: C++-Client/1.0\r\n\r\n");
+    return header;
+}
 
-        // --- Construct the HTTPS POST Request ---
-        std::string full_path;
-        std::string auth_header;
+bool LLM::CompressBody() {
+    if (compression_level_ <= 0 || !provider_->gzip_request || body_.size() < MIN_COMPRESS_SIZE)
+        return false;
+    if (!compressor_.Reset(compression_level_))
+        return false;
+
+    std::vector<struct iovec> buffers;
+    body_.HeadBuffers(buffers);
+    for (const struct iovec& buffer : buffers)
+        compressor_.Update(static_cast<const char*>(buffer.iov_base), buffer.iov_len);
+
+    if (!body_.image_path.empty()) {
+        EncodeImage([this](const char* data, size_t len) {
+            compressor_.Update(data, len);
+            return true;
+        });
+        const PayloadWriter& payload = body_.payload;
+        compressor_.Update(payload.data() + body_.image_offset, payload.size() - body_.image_offset);
+    }
+    compressor_.Finish();
 
-        // Build path and potentially Authorization header based on auth_method
-        if (auth_method_ == AUTH_METHOD_URL_PARAM) {
-            full_path = path_base_ + "?key=" + api_key_;
-        } else {
-            full_path = path_base_;
+    // Already compressed content, such as a base64 image, can come out larger
+    return compressor_.output().size() < body_.size();
+}
 
-            if (auth_method_ == AUTH_METHOD_BEARER_HEADER) {
-                auth_header = "Authorization: Bearer " + api_key_ + "\r\n";
-            }
+void LLM::Transact(const std::string& header, HttpResponseParser& parser) {
+    // Header and body go out as separate buffers, the body is never copied behind the header
+    // and the cached history is sent from the cache. With an image only the part of the body
+    // before it is in the buffers.
+    std::vector<struct iovec> request(1);
+    request[0].iov_base = const_cast<char*>(header.data());
+    request[0].iov_len = header.size();
+    if (body_compressed_) {
+        struct iovec compressed;
+        compressed.iov_base = const_cast<char*>(compressor_.output().data());
+        compressed.iov_len = compressor_.output().size();
+        request.push_back(compressed);
+    } else {
+        body_.HeadBuffers(request);
+    }
+
+    // Clears the active connection however the attempt ends, before its socket is closed, and
+    // closes the attempt's HTTP/2 stream so that the shared session lets go of it
+    struct ActiveConnection {
+        LLM* llm;
+        std::shared_ptr<HttpsConnection> http2_conn;  // Keeps the session alive until then
+        int32_t stream_id = -1;
+        ActiveConnection(LLM* l, int fd) : llm(l) { llm->SetActiveConnection(fd); }
+        ~ActiveConnection() {
+            llm->SetActiveConnection(-1);
+            if (http2_conn)
+                http2_conn->http2()->CloseStream(stream_id);
         }
+    };
+
+    const Deadline deadline = DeadlineIn(timeouts_.total_ms);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-        std::string payload = GeneratePayload(conversation_data);
+    // A pooled connection can be closed by the server at any time. If that happens before
+    // any part of the response arrived, the request is replayed once on a fresh connection.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        std::shared_ptr<HttpsConnection> conn =
+            attempt == 0 ? pool_->Acquire(host_, port_, use_proxy_, &request, deadline, cancel_fd_)
+                         : pool_->Connect(host_, port_, use_proxy_, &request, deadline, cancel_fd_);
+        // Over HTTP/2 requests of other callers may be running on it
+        const bool reused = conn->StartRequest();
 
-        std::string request = "POST " + full_path + " HTTP/1.1\r\n" + "Host: " + host_ + "\r\n" +
-                              "Content-Type: application/json\r\n" + auth_header +
-                              "Content-Length: " + std::to_string(payload.size()) + "\r\n" +
-                              "Connection: close\r\n" + "User-Agent: C++-Client/1.0\r\n" + "\r\n" + payload;
+        // A fresh connection brings the timings of opening it
+        RequestTimings timings = reused ? RequestTimings() : conn->setup_timings();
+        timings.reused = reused;
+
+        // The socket of a shared HTTP/2 connection is not shut down, only the stream is reset
+        ActiveConnection active(this, conn->http2() ? -1 : conn->fd());
+        if (cancelled_)
+            throw LlmError(LlmError::CANCELLED, "Request cancelled");
 
         // --- Send HTTPS Request over SSL ---
-        int bytes = SSL_write(ssl.get(), request.c_str(), request.length());
-        if (bytes <= 0) {
-            int ssl_error = SSL_get_error(ssl.get(), bytes);
-            close(sockfd);
-            throw std::runtime_error("Error sending HTTPS request via SSL. SSL_ERROR code: " +
-                                     std::to_string(ssl_error));
+        // Time to first byte counts from here, a slow upload uses up the same budget
+        const Deadline first_byte = DeadlineIn(timeouts_.first_byte_ms, deadline);
+        parser.Reset();
+        std::chrono::steady_clock::time_point write_start = std::chrono::steady_clock::now();
+        int32_t stream_id = -1;
+        int ssl_error = WriteRequest(*conn, request, stream_id, first_byte);
+        timings.ms[RequestTimings::WRITE] = MillisecondsSince(write_start);
+        if (stream_id >= 0) {
+            active.http2_conn = conn;
+            active.stream_id = stream_id;
+            SetActiveConnection(-1, conn->http2(), stream_id);
+            // A Cancel() during the write had no stream to reset yet
+            if (cancelled_)
+                throw LlmError(LlmError::CANCELLED, "Request cancelled");
+        }
+        if (ssl_error == HttpsConnection::TIMED_OUT && !cancelled_)
+            throw LlmError(LlmError::FIRST_BYTE_TIMEOUT, "Timed out sending the request to " + host_);
+        if (ssl_error != 0) {
+            if (reused && !cancelled_)
+                continue;
+            if (cancelled_)
+                throw LlmError(LlmError::CANCELLED, "Request cancelled");
+            throw LlmError(LlmError::SEND_FAILED,
+                           "Error sending HTTPS request via SSL. SSL_ERROR code: " + std::to_string(ssl_error));
         }
 
         // --- Receive HTTPS Response over SSL ---
-        std::string response_buffer;
-        response_buffer.reserve(BUFFER_SIZE);
-        std::vector<char> read_chunk(BUFFER_SIZE);
-
-        while ((bytes = SSL_read(ssl.get(), read_chunk.data(), read_chunk.size() - 1)) > 0) {
-            read_chunk[bytes] = '\0';
-            response_buffer.append(read_chunk.data(), bytes);
+        bool responded = ReadResponse(*conn, stream_id, parser, first_byte, deadline, timings);
+        if (cancelled_)
+            throw LlmError(LlmError::CANCELLED, "Request cancelled");
+        if (!responded) {
+            if (reused)
+                continue;
+            throw LlmError(LlmError::CONNECTION_CLOSED, "Connection closed before receiving a response");
         }
 
-        if (bytes < 0) {
-            int ssl_error = SSL_get_error(ssl.get(), bytes);
-            if (ssl_error != SSL_ERROR_ZERO_RETURN) {  // Ignore clean closure
-                close(sockfd);
-                throw std::runtime_error("Error receiving HTTPS response via SSL. SSL_ERROR code: " +
-                                         std::to_string(ssl_error));
-            }
+        if (!parser.done()) {
+            throw LlmError(parser.failed() ? LlmError::BAD_RESPONSE : LlmError::CONNECTION_CLOSED,
+                           "Error receiving HTTPS response: incomplete or malformed response");
         }
 
-        // Close socket manually since we're not using a RAII wrapper for it
-        close(sockfd);
+        // The pool decides whether an HTTP/2 connection stays shared
+        if (conn->http2() || parser.keep_alive())
+            pool_->Release(std::move(conn));
+
+        last_transfer_.request_raw = body_.size();
+        last_transfer_.request_sent = body_compressed_ ? compressor_.output().size() : body_.size();
+        last_transfer_.response_received = parser.body_bytes();
+        last_transfer_.response_decoded = parser.decoded_body_bytes();
+        std::cout << "[LLM] " << name_ << ": sent " << last_transfer_.request_sent << " of "
+                  << last_transfer_.request_raw << " body bytes, received " << last_transfer_.response_received
+                  << " for " << last_transfer_.response_decoded << std::endl;
+
+        timings.bytes_sent = header.size() + last_transfer_.request_sent;
+        timings.ms[RequestTimings::TOTAL] = MillisecondsSince(start);
+        RequestMetrics::Instance().Record(name_, timings);
+        return;
+    }
 
-        return ParseResponse(response_buffer);
+    throw LlmError(LlmError::CONNECTION_CLOSED, "Error sending HTTPS request: connection closed by server");
+}
 
-    } catch (const std::exception& e) {
-        std::cerr << "Error in LLM::SendRequest: " << e.what() << std::endl;
-        return "";
+int LLM::WriteRequest(HttpsConnection& conn,
+                      const std::vector<struct iovec>& request,
+                      int32_t& stream_id,
+                      Deadline deadline) {
+    if (Http2Session* http2 = conn.http2()) {
+        std::vector<struct iovec> body(request.begin() + 1, request.end());
+        Http2Session::BodySource image_source;
+        if (!body_compressed_ && !body_.image_path.empty()) {
+            // nghttp2 pulls the body as flow control allows, the image is encoded a chunk at a
+            // time as it is taken and followed by the rest of the payload
+            std::shared_ptr<ImageEncoder> image = std::make_shared<ImageEncoder>(body_.image_path, body_.image_size);
+            const PayloadWriter& payload = body_.payload;
+            size_t tail = body_.image_offset;
+            image_source = [image, &payload, tail](char* buf, size_t len) mutable -> ssize_t {
+                try {
+                    size_t copied = image->Read(buf, len);
+                    if (copied > 0)
+                        return copied;
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "ERROR [LLM]: " << e.what() << std::endl;
+                    return -1;
+                }
+                size_t copied = std::min(len, payload.size() - tail);
+                memcpy(buf, payload.data() + tail, copied);
+                tail += copied;
+                return copied;
+            };
+        }
+        const std::string head(static_cast<const char*>(request[0].iov_base), request[0].iov_len);
+        int error;
+        stream_id = http2->SubmitRequest(head, body, image_source, deadline, error);
+        return error;
     }
+
+    // Whatever the server already accepted as early data is not sent again
+    int ssl_error = conn.WriteV(request.data(), request.size(), deadline, conn.early_data());
+    if (ssl_error != 0 || body_compressed_ || body_.image_path.empty())
+        return ssl_error;
+
+    // The image is encoded straight into the connection, only a single chunk of it is ever
+    // held in memory
+    EncodeImage([&](const char* data, size_t len) {
+        return (ssl_error = conn.WriteAll(data, len, deadline)) == 0;
+    });
+    if (ssl_error != 0)
+        return ssl_error;
+
+    const PayloadWriter& payload = body_.payload;
+    return conn.WriteAll(payload.data() + body_.image_offset, payload.size() - body_.image_offset, deadline);
 }
 
-char* LLM::Base64Encode(const unsigned char* input, int length) {
-    BIO *bio, *b64;
-    BUF_MEM* bufferPtr;
+bool LLM::EncodeImage(const std::function<bool(const char* data, size_t len)>& sink) {
+    ImageEncoder image(body_.image_path, body_.image_size);
+    while (size_t len = image.Next()) {
+        if (!sink(image.data(), len))
+            return false;
+    }
+    return true;
+}
 
-    b64 = BIO_new(BIO_f_base64());
-    bio = BIO_new(BIO_s_mem());
-    bio = BIO_push(b64, bio);
+void LLM::SetActiveConnection(int fd, Http2Session* http2, int32_t stream_id) {
+    std::lock_guard<std::mutex> lock(active_mutex_);
+    active_fd_ = fd;
+    active_http2_ = http2;
+    active_stream_ = stream_id;
+}
 
-    BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-    BIO_write(bio, input, length);
-    BIO_flush(bio);
-    BIO_get_mem_ptr(bio, &bufferPtr);
+void LLM::Cancel() {
+    cancelled_ = true;
+
+    // Wakes a connection being opened, whether it waits for DNS or on its socket
+    uint64_t one = 1;
+    if (cancel_fd_ >= 0 && write(cancel_fd_, &one, sizeof(one)) < 0)
+        perror("eventfd write failed");
+    DnsResolver::Instance().Interrupt();
+
+    // Unblocks a pending read or write; the socket itself is closed by its owner
+    std::lock_guard<std::mutex> lock(active_mutex_);
+    if (active_http2_)
+        active_http2_->CancelStream(active_stream_);
+    else if (active_fd_ >= 0)
+        shutdown(active_fd_, SHUT_RDWR);
+}
 
-    char* output = (char*)malloc(bufferPtr->length + 1);
-    memcpy(output, bufferPtr->data, bufferPtr->length);
-    output[bufferPtr->length] = '\0';
+void LLM::ResetCancel() {
+    cancelled_ = false;
+    uint64_t count;
+    if (cancel_fd_ >= 0 && read(cancel_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("eventfd read failed");
+}
 
-    BIO_free_all(bio);
-    return output;
+bool LLM::ReadResponse(HttpsConnection& conn,
+                       int32_t stream_id,
+                       HttpResponseParser& parser,
+                       Deadline first_byte,
+                       Deadline deadline,
+                       RequestTimings& timings) {
+    Http2Session* http2 = conn.http2();
+    std::vector<char> read_chunk(BUFFER_SIZE);
+    size_t received = 0;
+    bool responding = false;
+    Deadline next_byte = first_byte;
+    std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point first_byte_at;
+    double parse_ms = 0;
+
+    // Reading stops as soon as the parser has the whole Content-Length or chunked body, only a
+    // close-delimited body waits for the server to close the connection. An HTTP/2 stream is
+    // read to its end, which can follow a complete body in a frame of its own, so that it is
+    // not reset.
+    while (!parser.done() || http2) {
+        int bytes = http2 ? http2->Read(stream_id, read_chunk.data(), read_chunk.size(), next_byte)
+                          : conn.Read(read_chunk.data(), read_chunk.size(), next_byte);
+        if (bytes == HttpsConnection::TIMED_OUT) {
+            if (!responding)
+                throw LlmError(LlmError::FIRST_BYTE_TIMEOUT, "No response from " + host_ + " in time");
+            throw LlmError(LlmError::BODY_TIMEOUT, "Response from " + host_ + " stalled after " +
+                                                       std::to_string(received) + " bytes");
+        }
+        if (bytes <= 0) {
+            if (received == 0)
+                return false;
+            // Completes a close-delimited body, or one that the HTTP/2 stream end delimits. Only
+            // a close_notify or a clean stream end reads as 0, a connection dropped without one
+            // may have cut the body
+            if (bytes == 0)
+                parser.FeedEof();
+            break;
+        }
+        received += bytes;
+
+        std::chrono::steady_clock::time_point parse_start = std::chrono::steady_clock::now();
+        long fed = parser.Feed(read_chunk.data(), bytes);
+        parse_ms += MillisecondsSince(parse_start);
+
+        if (!responding) {
+            responding = true;
+            first_byte_at = parse_start;
+            timings.ms[RequestTimings::FIRST_BYTE] =
+                std::chrono::duration<double, std::milli>(first_byte_at - wait_start).count();
+        }
+        if (fed < 0)
+            break;
+        if (responding)
+            next_byte = DeadlineIn(timeouts_.body_ms, deadline);
+    }
+
+    if (responding)
+        timings.ms[RequestTimings::BODY] = MillisecondsSince(first_byte_at);
+    timings.ms[RequestTimings::PARSE] = parse_ms;
+    timings.bytes_received = received;
+    return true;
 }
 
-std::string LLM::GeneratePayload(std::vector<ConversationMessage>& conversation_data) {
-    std::string payload;
+void LLM::GeneratePayload(std::vector<ConversationMessage>& conversation_data, bool stream, int conversation_id) {
+    body_.Clear();
 
-    if (name_ == "Gemini") {
-        payload = "{ \"contents\": [";
+    size_t first = 0;
+    if (conversation_id >= 0 && conversation_data.size() > 1) {
+        body_.history = CachedHistory(conversation_id, conversation_data);
+        first = conversation_data.size() - 1;
+    }
 
-        for (size_t i = 0; i < conversation_data.size(); i++) {
-            std::string escaped_content = JsonEscapeString(conversation_data[i].content);
+    WriteRequestBody(*provider_, model_name_, conversation_data, first, stream, body_);
+}
 
+std::shared_ptr<const std::string> LLM::CachedHistory(int conversation_id,
+                                                      const std::vector<ConversationMessage>& conversation_data) {
+    const size_t count = conversation_data.size() - 1;
+
+    std::lock_guard<std::mutex> lock(history_mutex_);
+    HistoryPrefix& prefix = history_[conversation_id];
+
+    // History only grows at the end, anything else means the entry is stale
+    if (!prefix.json || prefix.messages > count ||
+        (prefix.messages > 0 && conversation_data[prefix.messages - 1].content.size() != prefix.last_size)) {
+        prefix.json = std::make_shared<std::string>();
+        prefix.messages = 0;
+    } else if (prefix.json.use_count() > 1) {
+        // Still referenced by a request being written, do not append underneath it
+        prefix.json = std::make_shared<std::string>(*prefix.json);
+    }
+
+    if (prefix.messages < count) {
+        history_scratch_.Clear();
+        for (size_t i = prefix.messages; i < count; i++) {
             if (i > 0)
-                payload += ", ";
-            payload += "{\"role\": \"" + std::string(conversation_data[i].role) +
-                       "\", \"parts\": [{\"text\": \"" + escaped_content + "\"}]}";
+                history_scratch_.payload.AppendLiteral(", ");
+            provider_->write_message(history_scratch_, conversation_data[i], false);
         }
+        prefix.json->append(history_scratch_.payload.data(), history_scratch_.payload.size());
+        prefix.messages = count;
+        prefix.last_size = conversation_data[count - 1].content.size();
+    }
+    prefix.last_used = ++history_clock_;
 
-        payload += "]}";
-    } else if (name_ == "DeepSeek") {
-        payload = "{\"model\": \"" + model_name_ + "\", \"messages\": [";
-
-        for (size_t i = 0; i < conversation_data.size(); i++) {
-            std::string escaped_content = JsonEscapeString(conversation_data[i].content);
+    std::shared_ptr<const std::string> json = prefix.json;
 
-            if (i > 0)
-                payload += ", ";
-            payload += "{\"role\": \"" + std::string(conversation_data[i].role) + "\", \"content\": \"" +
-                       escaped_content + "\"}";
+    // Keep only the conversations used most recently
+    while (history_.size() > MAX_HISTORY_CONVERSATIONS) {
+        std::map<int, HistoryPrefix>::iterator oldest = history_.begin();
+        for (std::map<int, HistoryPrefix>::iterator it = history_.begin(); it != history_.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used)
+                oldest = it;
         }
+        history_.erase(oldest);
+    }
+    return json;
+}
 
-        payload += "], \"stream\": false}";
+void LLM::InvalidateHistory(int conversation_id) {
+    std::lock_guard<std::mutex> lock(history_mutex_);
+    history_.erase(conversation_id);
+}
 
-    } else if (name_ == "Qwen") {
-        payload = "{\"model\": \"" + model_name_ + "\", \"messages\": [";
+std::string LLM::role() {
+    return role_;
+}
 
-        for (size_t i = 0; i < conversation_data.size(); i++) {
-            std::string escaped_content = JsonEscapeString(conversation_data[i].content);
+std::string LLM::name() {
+    return name_;
+}
 
-            if (i > 0)
-                payload += ", ";
-
-            if (i == conversation_data.size() - 1 && conversation_data[i].has_image) {
-                const char* image_path = "./image.jpg";
-                std::ifstream file(image_path, std::ios::binary | std::ios::ate);
-                if (file.is_open()) {
-                    std::streamsize fsize = file.tellg();
-                    file.seekg(0, std::ios::beg);
-
-                    std::vector<unsigned char> data(fsize);
-                    if (file.read(reinterpret_cast<char*>(data.data()), fsize)) {
-                        std::unique_ptr<char, decltype(&free)> b64(Base64Encode(data.data(), fsize), free);
-
-                        payload +=
-                            "{\"role\":\"user\", \"content\":["
-                            "{\"type\":\"text\",\"text\":\"" +
-                            escaped_content +
-                            "\"},"
-                            "{\"type\":\"image_url\", \"image_url\":{\"url\":\"data:image/jpeg;base64," +
-                            std::string(b64.get()) +
-                            "\"}}"
-                            "]}";
-                        continue;
-                    }
-                }
-            }
+std::string LLM::model_name() {
+    return model_name_;
+}
 
-            payload += "{\"role\": \"" + std::string(conversation_data[i].role) +
-                       "\", \"content\": [{\"type\": \"text\", \"text\": \"" + escaped_content + "\"}]}";
-        }
+void LLM::set_session_cache_file(const std::string& path) {
+    pool_->session_cache().SetPersistPath(path);
+}
 
-        payload += "]}";
+void LLM::FlushSessionCache() {
+    pool_->session_cache().Flush();
+}
+
+void LLM::set_early_data(bool enabled) {
+    pool_->set_early_data(enabled);
+}
 
-        // std::cout << "Payload: " << payload << std::endl;
+bool LLM::Prewarm() {
+    try {
+        pool_->Prewarm(host_, port_, use_proxy_);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "ERROR [Prewarm]: " << e.what() << std::endl;
+        return false;
     }
+}
 
-    return payload;
+void LLM::ShareConnections(const LLM& other) {
+    pool_ = other.pool_;
 }
 
-std::string LLM::ParseResponse(const std::string& response) {
-    size_t start_pos = response.find(response_search_key_);
-    if (start_pos == std::string::npos) {
-        std::cerr << "ERROR [Parse]: Could not find '" << response_search_key_ << "' in response body."
-                  << std::endl;
-        return "";
-    }
+void LLM::set_http2(bool enabled) {
+    pool_->set_http2(enabled);
+}
 
-    start_pos += response_search_key_.length();
+void LLM::set_request_compression(int level) {
+    compression_level_ = std::max(0, std::min(level, 9));
+}
 
-    // Find the closing quote that's not escaped
-    size_t end_pos = start_pos;
-    while (true) {
-        end_pos = response.find('"', end_pos);
-        if (end_pos == std::string::npos) {
-            std::cerr << "ERROR [Parse]: Could not find closing quote for text field." << std::endl;
-            return "";
-        }
+void LLM::set_timeouts(const RequestTimeouts& timeouts) {
+    timeouts_ = timeouts;
+    pool_->set_timeouts(timeouts);
+}
 
-        // Check if the quote is escaped
-        if (end_pos > 0 && response[end_pos - 1] != '\\') {
-            break;
-        }
-        end_pos++;  // Move past this quote to find the next one
-    }
+size_t LLM::handshake_count() const {
+    return pool_->handshake_count();
+}
 
-    std::string result = response.substr(start_pos, end_pos - start_pos);
-    return JsonUnescapeString(result);
-}
-
-std::string LLM::JsonEscapeString(const std::string& input) {
-    std::string output;
-    output.reserve(input.size() * 2);  // 预分配空间优化性能
-
-    for (unsigned char c : input) {
-        switch (c) {
-            case '\"':
-                output += "\\\"";
-                break;
-            case '\\':
-                output += "\\\\";
-                break;
-            case '\b':
-                output += "\\b";
-                break;
-            case '\f':
-                output += "\\f";
-                break;
-            case '\n':
-                output += "\\n";
-                break;
-            case '\r':
-                output += "\\r";
-                break;
-            case '\t':
-                output += "\\t";
-                break;
-            default:
-                if (c < ' ') {  // 处理其他控制字符 (0x00-0x1F)
-                    char buffer[7];
-                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
-                    output += buffer;
-                } else {
-                    output += static_cast<char>(c);
-                }
-                break;
-        }
-    }
+size_t LLM::full_handshake_count() const {
+    return pool_->full_handshake_count();
+}
 
-    return output;
-}
-
-std::string LLM::JsonUnescapeString(const std::string& input) {
-    std::string output;
-    size_t i = 0;
-    const size_t length = input.length();
-
-    while (i < length) {
-        if (input[i] == '\\' && (i + 1 < length)) {
-            const char esc_char = input[++i];  // 跳过反斜杠并获取转义字符
-            switch (esc_char) {
-                case 'n':
-                    output += '\n';
-                    break;
-                case 't':
-                    output += '\t';
-                    break;
-                case 'r':
-                    output += '\r';
-                    break;
-                case 'b':
-                    output += '\b';
-                    break;
-                case 'f':
-                    output += '\f';
-                    break;
-                case '"':
-                    output += '"';
-                    break;
-                case '\\':
-                    output += '\\';
-                    break;
-                case '/':
-                    output += '/';
-                    break;
-                case 'u':                  // 处理Unicode转义（简化版）
-                    if (i + 4 < length) {  // 检查后续4个字符是否存在
-                        output += '?';     // 使用问号代替实际解码
-                        i += 4;            // 跳过4个十六进制字符
-                    } else {
-                        output += "\\u";  // 保留不完整的转义序列
-                    }
-                    break;
-                default:  // 保留无法识别的转义序列
-                    output += '\\';
-                    output += esc_char;
-                    break;
-            }
-            i++;  // 移动到下一个字符
-        } else {
-            output += input[i++];  // 直接复制普通字符
-        }
-    }
-    return output;
+size_t LLM::resumed_handshake_count() const {
+    return pool_->resumed_handshake_count();
 }
 
-std::string LLM::role() {
-    return role_;
+size_t LLM::tunnel_count() const {
+    return pool_->tunnel_count();
 }
 
-std::string LLM::name() {
-    return name_;
-}
\ No newline at end of file
+size_t LLM::tunnel_reuse_count() const {
+    return pool_->tunnel_reuse_count();
+}
+
+double LLM::handshake_cpu_ms() const {
+    return pool_->handshake_cpu_ms();
+}
+
+size_t LLM::prewarm_count() const {
+    return pool_->prewarm_count();
+}
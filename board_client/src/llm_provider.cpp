@@ -0,0 +1,87 @@
+#include <sys/stat.h>
+
+#include "base64.h"
+#include "llm_provider.h"
+
+bool RequestBody::AttachImage(const char* path) {
+    struct stat image_stat;
+    if (stat(path, &image_stat) != 0 || !S_ISREG(image_stat.st_mode))
+        return false;
+
+    image_path = path;
+    image_offset = payload.size();
+    image_size = image_stat.st_size;
+    return true;
+}
+
+size_t RequestBody::size() const {
+    size_t size = payload.size();
+    if (history)
+        size += history->size();
+    if (!image_path.empty())
+        size += Base64EncodedSize(image_size);
+    return size;
+}
+
+static void AddBuffer(std::vector<struct iovec>& buffers, const char* data, size_t len) {
+    if (len == 0)
+        return;
+    struct iovec buffer;
+    buffer.iov_base = const_cast<char*>(data);
+    buffer.iov_len = len;
+    buffers.push_back(buffer);
+}
+
+void RequestBody::HeadBuffers(std::vector<struct iovec>& buffers) const {
+    const size_t end = image_path.empty() ? payload.size() : image_offset;
+    if (!history) {
+        AddBuffer(buffers, payload.data(), end);
+        return;
+    }
+
+    AddBuffer(buffers, payload.data(), history_offset);
+    AddBuffer(buffers, history->data(), history->size());
+    AddBuffer(buffers, payload.data() + history_offset, end - history_offset);
+}
+
+void WriteRequestBody(const ProviderOps& provider,
+                      const std::string& model_name,
+                      const std::vector<ConversationMessage>& messages,
+                      size_t first,
+                      bool stream,
+                      RequestBody& body) {
+    PayloadWriter& payload = body.payload;
+
+    // Size the buffer once for what is escaped here, escaping never needs to grow it again
+    size_t estimate = 128 + model_name.size();
+    for (size_t i = first; i < messages.size(); i++) {
+        const ConversationMessage& message = messages[i];
+        estimate += 80 + message.role.size() +
+                    PayloadWriter::EscapedSize(message.content.data(), message.content.size());
+    }
+    payload.Reserve(estimate);
+
+    provider.write_head(payload, model_name);
+    body.history_offset = payload.size();
+    for (size_t i = first; i < messages.size(); i++) {
+        if (i > 0)
+            payload.AppendLiteral(", ");
+        provider.write_message(body, messages[i], i == messages.size() - 1);
+    }
+    provider.write_tail(payload, stream);
+}
+
+const ProviderOps* FindProvider(const std::string& name) {
+    static const ProviderOps* const providers[] = {
+        ProviderOpsFor<GeminiProvider>(),
+        ProviderOpsFor<DeepSeekProvider>(),
+        ProviderOpsFor<QwenProvider>(),
+        ProviderOpsFor<OpenAiProvider>(),
+    };
+
+    for (const ProviderOps* provider : providers) {
+        if (name == provider->name)
+            return provider;
+    }
+    return nullptr;
+}
@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+
+#include "llm_router.h"
+
+// std::chrono and std::max bind these to references, so they need a definition
+constexpr int LlmRouter::DEFAULT_HEDGE_DELAY_MS;
+constexpr int LlmRouter::MIN_HEDGE_DELAY_MS;
+constexpr int LlmRouter::OPEN_CIRCUIT_SEC;
+
+struct LlmRouter::Turn {
+    Turn(const std::vector<ConversationMessage>& data,
+         LLM::TokenCallback token_callback,
+         ReplyCallback done_callback,
+         const std::string& preferred_provider,
+         int conversation)
+        : conversation_data(data),
+          on_token(token_callback),
+          on_done(done_callback),
+          preferred(preferred_provider),
+          conversation_id(conversation),
+          next(0),
+          running(0),
+          winner(NONE),
+          hedge_at(Clock::time_point::max()),
+          waiting(false),
+          done(false) {}
+
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    const std::vector<ConversationMessage> conversation_data;
+    const LLM::TokenCallback on_token;
+    const ReplyCallback on_done;
+    const std::string preferred;
+    const int conversation_id;
+
+    std::vector<size_t> order;    // Providers to try, best first
+    size_t next;                  // Into order
+    size_t running;               // Started providers that have not finished yet
+    std::vector<size_t> started;  // In the order they were started
+    size_t winner;                // First provider that streamed a token
+    std::string answered_by;      // Name of winner once the turn has a reply
+    Clock::time_point hedge_at;   // When to start the next provider, max() for never
+    bool waiting;                 // Every provider was busy when it started
+    bool done;
+    std::promise<std::string> reply;
+};
+
+LlmRouter::LlmRouter() : hedging_(true), stopping_(false) {
+    loop_ = std::thread(&LlmRouter::Loop, this);
+}
+
+LlmRouter::~LlmRouter() {
+    {
+        std::lock_guard<std::mutex> lock(loop_mutex_);
+        stopping_ = true;
+    }
+    loop_wake_.notify_all();
+    loop_.join();
+
+    for (std::unique_ptr<Provider>& provider : providers_) {
+        provider->llm->Cancel();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            provider->wake.notify_all();
+        }
+        provider->worker.join();
+    }
+}
+
+void LlmRouter::AddProvider(LLM* llm) {
+    std::unique_ptr<Provider> provider(new Provider());
+    provider->llm.reset(llm);
+    provider->prewarm = false;
+    provider->latency_ewma_ms = 0;
+    provider->error_ewma = 0;
+    provider->next_sample = 0;
+    provider->requests = 0;
+    provider->circuit = CIRCUIT_CLOSED;
+    provider->consecutive_failures = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    providers_.push_back(std::move(provider));
+    providers_.back()->worker = std::thread(&LlmRouter::Work, this, providers_.size() - 1);
+}
+
+std::shared_ptr<PendingReply> LlmRouter::SendStreamRequestAsync(
+    const std::vector<ConversationMessage>& conversation_data,
+    LLM::TokenCallback on_token,
+    ReplyCallback on_done,
+    const std::string& preferred,
+    int conversation_id) {
+    std::shared_ptr<Turn> turn = std::make_shared<Turn>(conversation_data, on_token, on_done, preferred, conversation_id);
+    std::shared_ptr<PendingReply> pending(new PendingReply(this, turn, turn->reply.get_future().share()));
+    Post({Event::START, turn, 0, ""});
+    return pending;
+}
+
+std::string PendingReply::provider() const {
+    // Written before the promise is set, reading it after the future is ready is safe
+    if (!future_.valid() || future_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return "";
+    return turn_->answered_by;
+}
+
+std::string LlmRouter::SendStreamRequest(const std::vector<ConversationMessage>& conversation_data,
+                                         LLM::TokenCallback on_token,
+                                         const std::string& preferred,
+                                         int conversation_id) {
+    return SendStreamRequestAsync(conversation_data, on_token, nullptr, preferred, conversation_id)->Get();
+}
+
+void LlmRouter::Cancel(const std::shared_ptr<Turn>& turn) {
+    Post({Event::CANCEL, turn, 0, ""});
+}
+
+void LlmRouter::Post(Event event) {
+    std::lock_guard<std::mutex> lock(loop_mutex_);
+    events_.push_back(std::move(event));
+    loop_wake_.notify_all();
+}
+
+std::vector<size_t> LlmRouter::Rank(const std::string& preferred) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+
+    std::vector<size_t> closed;
+    std::vector<size_t> half_open;
+    for (size_t i = 0; i < providers_.size(); i++) {
+        Provider& provider = *providers_[i];
+        if (provider.job)
+            continue;  // Busy with another turn, or winding down a cancelled request
+
+        if (provider.circuit == CIRCUIT_OPEN && now >= provider.open_until)
+            provider.circuit = CIRCUIT_HALF_OPEN;
+
+        if (provider.circuit == CIRCUIT_CLOSED)
+            closed.push_back(i);
+        else if (provider.circuit == CIRCUIT_HALF_OPEN)
+            half_open.push_back(i);
+    }
+
+    // Fastest first, with errors making a provider look slower. Providers without samples
+    // have no latency so that they get measured, the added error term still ranks one that
+    // has only failed behind the others.
+    auto score = [this](size_t i) {
+        const Provider& provider = *providers_[i];
+        return provider.latency_ewma_ms * (1 + 4 * provider.error_ewma) + ERROR_PENALTY_MS * provider.error_ewma;
+    };
+    auto by_score = [&](size_t a, size_t b) { return score(a) < score(b); };
+    std::stable_sort(closed.begin(), closed.end(), by_score);
+
+    // The conversation's own provider goes first while it is healthy
+    for (size_t i = 0; i < closed.size(); i++) {
+        if (providers_[closed[i]]->llm->name() == preferred) {
+            std::rotate(closed.begin(), closed.begin() + i, closed.begin() + i + 1);
+            break;
+        }
+    }
+
+    // A provider whose circuit is half open gets one probe, after the healthy ones
+    closed.insert(closed.end(), half_open.begin(), half_open.end());
+    return closed;
+}
+
+void LlmRouter::Prewarm(const std::string& preferred) {
+    std::vector<size_t> order = Rank(preferred);
+    order.resize(std::min(order.size(), static_cast<size_t>(hedging_ ? 2 : 1)));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t index : order) {
+        Provider& provider = *providers_[index];
+        provider.prewarm = true;
+        provider.wake.notify_all();
+    }
+}
+
+std::string LlmRouter::ModelName(const std::string& provider) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::unique_ptr<Provider>& candidate : providers_) {
+        if (candidate->llm->name() == provider)
+            return candidate->llm->model_name();
+    }
+    return "";
+}
+
+void LlmRouter::InvalidateHistory(int conversation_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::unique_ptr<Provider>& provider : providers_)
+        provider->llm->InvalidateHistory(conversation_id);
+}
+
+void LlmRouter::Loop() {
+    std::unique_lock<std::mutex> lock(loop_mutex_);
+    while (!stopping_) {
+        Clock::time_point wake_at = Clock::time_point::max();
+        for (const std::shared_ptr<Turn>& turn : turns_)
+            wake_at = std::min(wake_at, turn->hedge_at);
+
+        auto has_event = [this]() { return stopping_ || !events_.empty(); };
+        if (wake_at == Clock::time_point::max())
+            loop_wake_.wait(lock, has_event);
+        else
+            loop_wake_.wait_until(lock, wake_at, has_event);
+        if (stopping_)
+            break;
+
+        std::deque<Event> events;
+        events.swap(events_);
+        lock.unlock();
+
+        for (Event& event : events)
+            Handle(event);
+
+        // Nothing streamed within the p90 of the current provider, ask another one too
+        Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < turns_.size(); i++) {
+            if (!turns_[i]->done && turns_[i]->hedge_at <= now)
+                StartNext(turns_[i]);
+        }
+
+        turns_.erase(std::remove_if(turns_.begin(), turns_.end(),
+                                    [](const std::shared_ptr<Turn>& turn) { return turn->done; }),
+                     turns_.end());
+        lock.lock();
+    }
+
+    // Nothing is answered anymore, callers waiting for a reply get an empty one
+    for (Event& event : events_) {
+        if (event.kind == Event::START)
+            turns_.push_back(event.turn);
+    }
+    events_.clear();
+    lock.unlock();
+    for (const std::shared_ptr<Turn>& turn : turns_) {
+        if (!turn->done)
+            Finish(turn, "");
+    }
+    turns_.clear();
+}
+
+void LlmRouter::Handle(Event& event) {
+    const std::shared_ptr<Turn>& turn = event.turn;
+
+    switch (event.kind) {
+        case Event::START:
+            turns_.push_back(turn);
+            Begin(turn);
+            break;
+
+        case Event::PROVIDER_FREE:
+            // Oldest first
+            for (size_t i = 0; i < turns_.size(); i++) {
+                if (turns_[i]->waiting)
+                    Begin(turns_[i]);
+            }
+            break;
+
+        case Event::TOKEN:
+            if (turn->done)
+                break;
+            if (turn->winner == Turn::NONE) {
+                // First token decides the race
+                turn->winner = event.provider;
+                turn->hedge_at = Clock::time_point::max();
+                for (size_t index : turn->started) {
+                    if (index != turn->winner)
+                        CancelProvider(index, turn);
+                }
+            }
+            if (event.provider == turn->winner && turn->on_token)
+                turn->on_token(event.text);
+            break;
+
+        case Event::FINISHED:
+            if (turn->done)
+                break;
+            turn->running--;
+            if (event.provider == turn->winner || (turn->winner == Turn::NONE && !event.text.empty())) {
+                turn->winner = event.provider;
+                Finish(turn, std::move(event.text));
+                break;
+            }
+            if (turn->winner != Turn::NONE || turn->running > 0)
+                break;  // A cancelled loser, or another provider is still working
+
+            // Every provider started so far failed without a token, fall back to the next one
+            StartNext(turn);
+            break;
+
+        case Event::CANCEL:
+            if (!turn->done)
+                Finish(turn, "");
+            break;
+    }
+}
+
+void LlmRouter::Begin(const std::shared_ptr<Turn>& turn) {
+    turn->order = Rank(turn->preferred);
+    turn->next = 0;
+    if (!turn->order.empty()) {
+        turn->waiting = false;
+        StartNext(turn);
+        return;
+    }
+
+    bool any_busy = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::unique_ptr<Provider>& provider : providers_)
+            any_busy = any_busy || provider->job;
+    }
+    if (any_busy) {
+        turn->waiting = true;  // Until a provider becomes free
+        return;
+    }
+
+    std::cerr << "ERROR [Router]: No LLM provider available" << std::endl;
+    Finish(turn, "");
+}
+
+void LlmRouter::StartNext(const std::shared_ptr<Turn>& turn) {
+    turn->hedge_at = Clock::time_point::max();
+    while (turn->next < turn->order.size()) {
+        size_t index = turn->order[turn->next++];
+        if (!Start(turn, index))
+            continue;  // Taken by another turn since it was ranked
+
+        turn->started.push_back(index);
+        turn->running++;
+        if (hedging_ && turn->next < turn->order.size())
+            turn->hedge_at = Clock::now() + HedgeDelay(index);
+        return;
+    }
+
+    if (turn->running == 0 && turn->started.empty())
+        turn->waiting = true;  // Every provider it ranked went to other turns meanwhile
+    else if (turn->running == 0)
+        Finish(turn, "");
+}
+
+bool LlmRouter::Start(const std::shared_ptr<Turn>& turn, size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Provider& provider = *providers_[index];
+    if (provider.job)
+        return false;
+
+    provider.job = turn;
+    provider.llm->ResetCancel();
+    provider.wake.notify_all();
+    return true;
+}
+
+void LlmRouter::CancelProvider(size_t index, const std::shared_ptr<Turn>& turn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Provider& provider = *providers_[index];
+    if (provider.job == turn)
+        provider.llm->Cancel();
+}
+
+void LlmRouter::Finish(const std::shared_ptr<Turn>& turn, std::string reply) {
+    turn->done = true;
+    turn->waiting = false;
+    turn->hedge_at = Clock::time_point::max();
+
+    for (size_t index : turn->started) {
+        if (index != turn->winner || reply.empty())
+            CancelProvider(index, turn);
+    }
+
+    if (!reply.empty() && turn->started.size() > 1)
+        std::cout << "[Router] " << providers_[turn->winner]->llm->name() << " answered after "
+                  << turn->started.size() << " attempts" << std::endl;
+    else if (reply.empty() && !turn->started.empty() && turn->running == 0)
+        std::cerr << "ERROR [Router]: All LLM providers failed" << std::endl;
+
+    if (!reply.empty())
+        turn->answered_by = providers_[turn->winner]->llm->name();
+    turn->reply.set_value(reply);
+    if (turn->on_done)
+        turn->on_done(reply);
+}
+
+void LlmRouter::Work(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Provider& provider = *providers_[index];
+
+    while (true) {
+        provider.wake.wait(lock, [&]() { return stopping_ || provider.job || provider.prewarm; });
+        if (stopping_)
+            return;
+
+        // A job connects by itself
+        bool prewarm = provider.prewarm && !provider.job;
+        provider.prewarm = false;
+        if (prewarm) {
+            lock.unlock();
+            provider.llm->Prewarm();
+            provider.llm->FlushSessionCache();
+            lock.lock();
+            continue;
+        }
+
+        std::shared_ptr<Turn> turn = provider.job;
+        lock.unlock();
+
+        std::vector<ConversationMessage> conversation_data = turn->conversation_data;
+        Clock::time_point start = Clock::now();
+        double first_token_ms = -1;
+
+        auto on_token = [&](const std::string& delta) {
+            if (first_token_ms < 0)
+                first_token_ms = MillisecondsSince(start);
+            Post({Event::TOKEN, turn, index, delta});
+        };
+        std::string reply = provider.llm->SendStreamRequest(conversation_data, on_token, turn->conversation_id);
+
+        // Losing a race says nothing about the provider
+        if (!provider.llm->cancelled())
+            RecordResult(index, !reply.empty(), first_token_ms < 0 ? MillisecondsSince(start) : first_token_ms);
+        Post({Event::FINISHED, turn, index, std::move(reply)});
+        // The session file is written once the reply is on its way, not during the handshake
+        provider.llm->FlushSessionCache();
+
+        lock.lock();
+        provider.job.reset();
+        Post({Event::PROVIDER_FREE, nullptr, index, ""});
+    }
+}
+
+void LlmRouter::RecordResult(size_t index, bool success, double first_token_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Provider& provider = *providers_[index];
+
+    provider.requests++;
+    provider.error_ewma = EWMA_ALPHA * (success ? 0 : 1) + (1 - EWMA_ALPHA) * provider.error_ewma;
+
+    if (success) {
+        if (provider.latency_samples.empty())
+            provider.latency_ewma_ms = first_token_ms;
+        else
+            provider.latency_ewma_ms = EWMA_ALPHA * first_token_ms + (1 - EWMA_ALPHA) * provider.latency_ewma_ms;
+
+        if (provider.latency_samples.size() < LATENCY_WINDOW)
+            provider.latency_samples.push_back(first_token_ms);
+        else
+            provider.latency_samples[provider.next_sample] = first_token_ms;
+        provider.next_sample = (provider.next_sample + 1) % LATENCY_WINDOW;
+
+        provider.consecutive_failures = 0;
+        provider.circuit = CIRCUIT_CLOSED;
+        return;
+    }
+
+    provider.consecutive_failures++;
+    if (provider.circuit == CIRCUIT_HALF_OPEN || provider.consecutive_failures >= FAILURE_THRESHOLD) {
+        provider.circuit = CIRCUIT_OPEN;
+        provider.open_until = Clock::now() + std::chrono::seconds(OPEN_CIRCUIT_SEC);
+        std::cerr << "[Router] " << provider.llm->name() << " failed " << provider.consecutive_failures
+                  << " times in a row, skipping it for " << OPEN_CIRCUIT_SEC << " s" << std::endl;
+    }
+}
+
+std::chrono::milliseconds LlmRouter::HedgeDelay(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<double> samples = providers_[index]->latency_samples;
+    if (samples.size() < MIN_HEDGE_SAMPLES)
+        return std::chrono::milliseconds(DEFAULT_HEDGE_DELAY_MS);
+
+    size_t p90 = (samples.size() * 9 + 9) / 10 - 1;
+    std::nth_element(samples.begin(), samples.begin() + p90, samples.end());
+    return std::chrono::milliseconds(std::max(MIN_HEDGE_DELAY_MS, static_cast<int>(samples[p90])));
+}
+
+void LlmRouter::DumpStats() {
+    static const char* const kCircuitNames[] = {"closed", "open", "half open"};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<Provider>& provider : providers_) {
+        std::cout << "[Router] " << provider->llm->name() << ": first token " << provider->latency_ewma_ms
+                  << " ms, errors " << static_cast<int>(provider->error_ewma * 100) << "%, circuit "
+                  << kCircuitNames[provider->circuit] << ", " << provider->requests << " requests, "
+                  << provider->llm->handshake_count() << " handshakes";
+        if (provider->llm->handshake_count() > 0)
+            std::cout << " (" << provider->llm->handshake_cpu_ms() / provider->llm->handshake_count()
+                      << " ms CPU each)";
+        if (provider->llm->prewarm_count() > 0)
+            std::cout << ", " << provider->llm->prewarm_count() << " opened ahead";
+        if (provider->llm->tunnel_count() > 0)
+            std::cout << ", " << provider->llm->tunnel_count() << " proxy tunnels reused "
+                      << provider->llm->tunnel_reuse_count() << " times";
+        std::cout << std::endl;
+    }
+}
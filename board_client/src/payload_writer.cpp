@@ -0,0 +1,38 @@
+#include <string.h>
+
+#include "json_string.h"
+#include "payload_writer.h"
+
+void PayloadWriter::Reserve(size_t capacity) {
+    if (capacity <= capacity_)
+        return;
+
+    size_t new_capacity = capacity_ ? capacity_ : INITIAL_CAPACITY;
+    while (new_capacity < capacity)
+        new_capacity *= 2;
+
+    std::unique_ptr<char[]> buffer(new char[new_capacity]);
+    if (size_ > 0)
+        memcpy(buffer.get(), buffer_.get(), size_);
+    buffer_.swap(buffer);
+    capacity_ = new_capacity;
+}
+
+char* PayloadWriter::Prepare(size_t len) {
+    Reserve(size_ + len);
+    return buffer_.get() + size_;
+}
+
+void PayloadWriter::Append(const char* data, size_t len) {
+    memcpy(Prepare(len), data, len);
+    size_ += len;
+}
+
+size_t PayloadWriter::EscapedSize(const char* data, size_t len) {
+    return JsonEscapedSize(data, len);
+}
+
+void PayloadWriter::AppendEscaped(const char* data, size_t len) {
+    char* out = Prepare(JsonEscapedSize(data, len));
+    size_ = JsonEscape(data, len, out) - buffer_.get();
+}
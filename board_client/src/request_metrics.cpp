@@ -0,0 +1,122 @@
+#include <fstream>
+#include <iomanip>
+
+#include "request_metrics.h"
+
+const double LatencyHistogram::BUCKET_BOUNDS_MS[BUCKET_COUNT - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000};
+
+const char* RequestTimings::PhaseName(Phase phase) {
+    static const char* const kNames[PHASE_COUNT] = {
+        "dns", "connect", "proxy", "handshake", "write", "first byte", "body", "parse", "total"};
+    return kNames[phase];
+}
+
+void LatencyHistogram::Record(double ms) {
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && ms > BUCKET_BOUNDS_MS[bucket])
+        bucket++;
+    buckets_[bucket]++;
+    count_++;
+    sum_ms_ += ms;
+    if (ms > max_ms_)
+        max_ms_ = ms;
+}
+
+double LatencyHistogram::Percentile(double q) const {
+    if (count_ == 0)
+        return 0;
+
+    size_t rank = static_cast<size_t>(q * count_ + 0.5);
+    if (rank == 0)
+        rank = 1;
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT - 1; bucket++) {
+        seen += buckets_[bucket];
+        if (seen >= rank)
+            return BUCKET_BOUNDS_MS[bucket];
+    }
+    return max_ms_;
+}
+
+void LatencyHistogram::DumpBuckets(std::ostream& out) const {
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+        if (buckets_[bucket] == 0)
+            continue;
+        if (bucket < BUCKET_COUNT - 1)
+            out << " <=" << BUCKET_BOUNDS_MS[bucket] << ":" << buckets_[bucket];
+        else
+            out << " >" << BUCKET_BOUNDS_MS[BUCKET_COUNT - 2] << ":" << buckets_[bucket];
+    }
+}
+
+RequestMetrics& RequestMetrics::Instance() {
+    static RequestMetrics instance;
+    return instance;
+}
+
+void RequestMetrics::Record(const std::string& provider, const RequestTimings& timings) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ProviderMetrics& metrics = providers_[provider];
+
+    metrics.requests++;
+    if (timings.reused)
+        metrics.reused++;
+    metrics.bytes_sent += timings.bytes_sent;
+    metrics.bytes_received += timings.bytes_received;
+    for (int phase = 0; phase < RequestTimings::PHASE_COUNT; phase++) {
+        if (timings.ms[phase] >= 0)
+            metrics.phases[phase].Record(timings.ms[phase]);
+    }
+
+    if (log_path_.empty())
+        return;
+    time_t now = time(nullptr);
+    if (now - last_log_ < log_interval_sec_)
+        return;
+    last_log_ = now;
+
+    std::ofstream log(log_path_, std::ios::app);
+    if (!log.is_open())
+        return;
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    log << "=== " << stamp << std::endl;
+    DumpLocked(log);
+}
+
+void RequestMetrics::Dump(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DumpLocked(out);
+}
+
+void RequestMetrics::DumpLocked(std::ostream& out) {
+    const std::streamsize precision = out.precision();
+    for (const auto& entry : providers_) {
+        const ProviderMetrics& metrics = entry.second;
+        out << "[Metrics] " << entry.first << ": " << metrics.requests << " requests, " << metrics.reused
+            << " on reused connections, " << metrics.bytes_sent << " bytes sent, " << metrics.bytes_received
+            << " received" << std::endl;
+
+        for (int phase = 0; phase < RequestTimings::PHASE_COUNT; phase++) {
+            const LatencyHistogram& histogram = metrics.phases[phase];
+            if (histogram.count() == 0)
+                continue;
+            out << "  " << std::left << std::setw(11) << RequestTimings::PhaseName(RequestTimings::Phase(phase))
+                << std::right << std::fixed << std::setprecision(1) << " n=" << histogram.count()
+                << " mean=" << histogram.mean() << " p50<=" << histogram.Percentile(0.5)
+                << " p90<=" << histogram.Percentile(0.9) << " p99<=" << histogram.Percentile(0.99)
+                << " max=" << histogram.max() << " ms |";
+            out.unsetf(std::ios::fixed);
+            out.precision(precision);
+            histogram.DumpBuckets(out);
+            out << std::endl;
+        }
+    }
+}
+
+void RequestMetrics::set_log_file(const std::string& path, int interval_sec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    log_path_ = path;
+    log_interval_sec_ = interval_sec;
+}
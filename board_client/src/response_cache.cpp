@@ -0,0 +1,236 @@
+#include <ctype.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "response_cache.h"
+
+// Stripped from the end of a question, ASCII and full-width forms
+static const char* const kTrailingPunctuation[] = {" ", "?", "!", ".", ",", "~", "？", "！", "。", "，", "～", "…"};
+
+// Lower-cases ASCII letters, collapses runs of whitespace (including the ideographic space) to
+// a single space and drops trailing punctuation.
+static std::string Normalize(const std::string& text) {
+    static const char kIdeographicSpace[] = "\xE3\x80\x80";
+
+    std::string out;
+    out.reserve(text.size());
+    bool space = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x80 && isspace(c)) {
+            space = !out.empty();
+            continue;
+        }
+        if (text.compare(i, sizeof(kIdeographicSpace) - 1, kIdeographicSpace) == 0) {
+            space = !out.empty();
+            i += sizeof(kIdeographicSpace) - 2;
+            continue;
+        }
+        if (space) {
+            out += ' ';
+            space = false;
+        }
+        out += c < 0x80 ? static_cast<char>(tolower(c)) : static_cast<char>(c);
+    }
+
+    bool stripped = true;
+    while (stripped) {
+        stripped = false;
+        for (const char* punctuation : kTrailingPunctuation) {
+            size_t len = strlen(punctuation);
+            if (out.size() >= len && out.compare(out.size() - len, len, punctuation) == 0) {
+                out.resize(out.size() - len);
+                stripped = true;
+            }
+        }
+    }
+    return out;
+}
+
+ResponseCache::ResponseCache(std::string db_path)
+    : db_(nullptr),
+      db_path_(db_path),
+      enabled_(true),
+      ttl_sec_(DEFAULT_TTL_SEC),
+      max_entries_(DEFAULT_MAX_ENTRIES),
+      hits_(0),
+      misses_(0) {}
+
+ResponseCache::~ResponseCache() {
+    if (db_)
+        sqlite3_close(db_);
+}
+
+int ResponseCache::InitDatabase() {
+    int rc = sqlite3_open(db_path_.c_str(), &db_);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Cannot open response cache database: %s\n", sqlite3_errmsg(db_));
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return rc;
+    }
+
+    // The chat record connection of the window writes to the same file
+    sqlite3_busy_timeout(db_, 1000);
+
+    const char* create_cache_sql =
+        "CREATE TABLE IF NOT EXISTS response_cache ("
+        "key TEXT PRIMARY KEY, "
+        "response TEXT NOT NULL, "
+        "created_at INTEGER NOT NULL, "
+        "last_used INTEGER NOT NULL, "
+        "hits INTEGER DEFAULT 0);"
+        "CREATE INDEX IF NOT EXISTS response_cache_last_used ON response_cache (last_used);";
+
+    char* err_msg = NULL;
+    rc = sqlite3_exec(db_, create_cache_sql, 0, 0, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Response cache table creation error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_close(db_);
+        db_ = nullptr;
+        return rc;
+    }
+
+    return SQLITE_OK;
+}
+
+std::string ResponseCache::MakeKey(const std::string& provider,
+                                   const std::string& model,
+                                   const std::vector<ConversationMessage>& conversation_data) {
+    if (conversation_data.empty() || conversation_data.back().has_image)
+        return "";
+
+    // Fields are separated by a control character that normalized text never ends with
+    std::string material = Normalize(provider) + '\x1f' + Normalize(model);
+    size_t first = 0;
+    if (conversation_data.size() > CONTEXT_MESSAGES + 1)
+        first = conversation_data.size() - CONTEXT_MESSAGES - 1;
+    for (size_t i = first; i < conversation_data.size(); i++) {
+        material += '\x1f';
+        material += conversation_data[i].role;
+        material += '\x1f';
+        material += Normalize(conversation_data[i].content);
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (EVP_Digest(material.data(), material.size(), digest, &digest_len, EVP_sha256(), nullptr) != 1)
+        return "";
+
+    static const char kHex[] = "0123456789abcdef";
+    std::string key;
+    key.reserve(digest_len * 2);
+    for (unsigned int i = 0; i < digest_len; i++) {
+        key += kHex[digest[i] >> 4];
+        key += kHex[digest[i] & 0xf];
+    }
+    return key;
+}
+
+bool ResponseCache::Lookup(const std::string& provider,
+                           const std::string& model,
+                           const std::vector<ConversationMessage>& conversation_data,
+                           std::string& response) {
+    if (!enabled_ || !db_)
+        return false;
+
+    // Image turns bypass the cache, they count as neither hit nor miss
+    std::string key = MakeKey(provider, model, conversation_data);
+    if (key.empty())
+        return false;
+
+    time_t now = time(nullptr);
+    const char* sql = "SELECT response FROM response_cache WHERE key = ? AND created_at > ?;";
+    sqlite3_stmt* stmt;
+
+    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Prepare response cache lookup failed: %s\n", sqlite3_errmsg(db_));
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, now - ttl_sec_);
+
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        response.assign(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), sqlite3_column_bytes(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+
+    if (!found) {
+        misses_++;
+        return false;
+    }
+    hits_++;
+
+    const char* update_sql = "UPDATE response_cache SET last_used = ?, hits = hits + 1 WHERE key = ?;";
+    sqlite3_stmt* update_stmt;
+
+    rc = sqlite3_prepare_v2(db_, update_sql, -1, &update_stmt, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int64(update_stmt, 1, now);
+        sqlite3_bind_text(update_stmt, 2, key.c_str(), -1, SQLITE_STATIC);
+        sqlite3_step(update_stmt);
+        sqlite3_finalize(update_stmt);
+    }
+    return true;
+}
+
+void ResponseCache::Store(const std::string& provider,
+                          const std::string& model,
+                          const std::vector<ConversationMessage>& conversation_data,
+                          const std::string& response) {
+    // Failed requests return an empty reply
+    if (!enabled_ || !db_ || response.empty())
+        return;
+
+    std::string key = MakeKey(provider, model, conversation_data);
+    if (key.empty())
+        return;
+
+    time_t now = time(nullptr);
+    const char* sql =
+        "INSERT OR REPLACE INTO response_cache (key, response, created_at, last_used) VALUES (?, ?, ?, ?);";
+    sqlite3_stmt* stmt;
+
+    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Prepare response cache store failed: %s\n", sqlite3_errmsg(db_));
+        return;
+    }
+
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, response.c_str(), response.size(), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, now);
+    sqlite3_bind_int64(stmt, 4, now);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+        fprintf(stderr, "Response cache store failed: %s\n", sqlite3_errmsg(db_));
+    sqlite3_finalize(stmt);
+
+    Evict(now);
+}
+
+void ResponseCache::Evict(time_t now) {
+    const char* expired_sql = "DELETE FROM response_cache WHERE created_at <= ?;";
+    const char* oldest_sql =
+        "DELETE FROM response_cache WHERE key IN (SELECT key FROM response_cache ORDER BY last_used ASC "
+        "LIMIT max(0, (SELECT COUNT(*) FROM response_cache) - ?));";
+    sqlite3_stmt* stmt;
+
+    if (sqlite3_prepare_v2(db_, expired_sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, now - ttl_sec_);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+
+    if (sqlite3_prepare_v2(db_, oldest_sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(max_entries_));
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+}
@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "sse_decoder.h"
+
+SseDecoder::SseDecoder(EventCallback callback) : callback_(callback) {
+    Reset();
+}
+
+void SseDecoder::Reset() {
+    line_.clear();
+    event_.clear();
+    data_.clear();
+    has_data_ = false;
+    skip_lf_ = false;
+}
+
+bool SseDecoder::Feed(const char* data, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        if (skip_lf_) {
+            skip_lf_ = false;
+            if (data[pos] == '\n') {
+                pos++;
+                continue;
+            }
+        }
+
+        // Lines end with "\r\n", "\n" or a lone "\r"
+        size_t end = pos;
+        while (end < len && data[end] != '\n' && data[end] != '\r')
+            end++;
+
+        line_.append(data + pos, end - pos);
+        if (line_.size() + data_.size() > MAX_EVENT_SIZE)
+            return false;
+
+        if (end == len)
+            break;
+
+        skip_lf_ = data[end] == '\r';
+        pos = end + 1;
+        ProcessLine();
+    }
+    return true;
+}
+
+void SseDecoder::ProcessLine() {
+    if (line_.empty()) {
+        Dispatch();
+        return;
+    }
+
+    if (line_[0] == ':') {  // Comment, used by servers as keep-alive
+        line_.clear();
+        return;
+    }
+
+    // Field and value are used in place, a data line can be large
+    size_t colon = line_.find(':');
+    size_t field_size = colon == std::string::npos ? line_.size() : colon;
+    size_t value_start = line_.size();
+    if (colon != std::string::npos) {
+        value_start = colon + 1;
+        if (value_start < line_.size() && line_[value_start] == ' ')
+            value_start++;
+    }
+
+    if (line_.compare(0, field_size, "data") == 0) {
+        if (has_data_)
+            data_ += '\n';
+        data_.append(line_, value_start, std::string::npos);
+        has_data_ = true;
+    } else if (line_.compare(0, field_size, "event") == 0) {
+        event_.assign(line_, value_start, std::string::npos);
+    }
+    line_.clear();
+}
+
+void SseDecoder::Dispatch() {
+    if (has_data_ && callback_)
+        callback_(event_.empty() ? "message" : event_, data_);
+
+    event_.clear();
+    data_.clear();
+    has_data_ = false;
+}
+
+void SseDecoder::Finish() {
+    if (!line_.empty())
+        ProcessLine();
+    Dispatch();
+}
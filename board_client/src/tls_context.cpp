@@ -0,0 +1,52 @@
+#include <openssl/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tls_context.h"
+#include "tls_session_cache.h"
+
+// Both lists put ChaCha20-Poly1305 first, it is several times faster than AES-GCM in software
+static const char kTls13CipherSuites[] = "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+static const char kTls12CipherList[] =
+    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+static const char kGroups[] = "X25519:P-256";
+
+TlsContext& TlsContext::Instance() {
+    static TlsContext context;
+    return context;
+}
+
+TlsContext::TlsContext() : ctx_(nullptr), has_trust_store_(false) {
+    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr);
+    OPENSSL_init_crypto(OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, nullptr);
+
+    ctx_ = SSL_CTX_new(TLS_client_method());
+    if (!ctx_)
+        return;
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    if (SSL_CTX_set_ciphersuites(ctx_, kTls13CipherSuites) != 1 ||
+        SSL_CTX_set_cipher_list(ctx_, kTls12CipherList) != 1 || SSL_CTX_set1_groups_list(ctx_, kGroups) != 1) {
+        fprintf(stderr, "TLS cipher preferences not supported, using OpenSSL defaults\n");
+        ERR_clear_error();
+    }
+
+    const char* ca_file = getenv("SSL_CERT_FILE");
+    if (!ca_file || !*ca_file)
+        ca_file = CA_BUNDLE_FILE;
+    has_trust_store_ = SSL_CTX_load_verify_locations(ctx_, ca_file, nullptr) == 1;
+    if (!has_trust_store_) {
+        fprintf(stderr, "Cannot load CA bundle %s, server certificates cannot be verified\n", ca_file);
+        ERR_clear_error();
+    }
+    SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+
+    TlsSessionCache::Install(ctx_);
+}
+
+TlsContext::~TlsContext() {
+    if (ctx_)
+        SSL_CTX_free(ctx_);
+}
@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tls_session_cache.h"
+
+TlsSessionCache::~TlsSessionCache() {
+    Clear();
+}
+
+void TlsSessionCache::Install(SSL_CTX* ctx) {
+    // Sessions are only kept here, keyed by host; OpenSSL's internal client cache is not
+    // keyed by host and would just hold extra references.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, NewSessionCallback);
+}
+
+void TlsSessionCache::Attach(SSL* ssl) {
+    SSL_set_app_data(ssl, this);
+}
+
+int TlsSessionCache::NewSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    TlsSessionCache* cache = static_cast<TlsSessionCache*>(SSL_get_app_data(ssl));
+    const char* host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!cache || !host || !SSL_SESSION_is_resumable(session))
+        return 0;
+
+    cache->Store(host, session);
+    return 1;  // The cache keeps the reference
+}
+
+void TlsSessionCache::Store(const std::string& host, SSL_SESSION* session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<SSL_SESSION*>& list = sessions_[host];
+    if (list.size() >= MAX_SESSIONS_PER_HOST) {
+        SSL_SESSION_free(list.front());
+        list.erase(list.begin());
+    }
+    list.push_back(session);
+    dirty_ = true;
+}
+
+long TlsSessionCache::Apply(SSL* ssl, const std::string& host) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropExpiredLocked();
+
+    auto it = sessions_.find(host);
+    if (it == sessions_.end() || it->second.empty())
+        return -1;
+
+    SSL_SESSION* session = it->second.back();
+    if (!SSL_set_session(ssl, session))
+        return -1;
+
+    long max_early_data = SSL_SESSION_get_max_early_data(session);
+
+    // TLS 1.3 tickets are single use (the server sends fresh ones after resumption, and
+    // reusing one would get early data rejected as a replay); TLS 1.2 sessions can be reused.
+    if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) {
+        SSL_SESSION_free(session);
+        it->second.pop_back();
+        dirty_ = true;
+    }
+
+    return max_early_data;
+}
+
+void TlsSessionCache::DropExpiredLocked() {
+    const time_t now = time(nullptr);
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+        std::vector<SSL_SESSION*>& list = it->second;
+        for (auto session = list.begin(); session != list.end();) {
+            if (SSL_SESSION_get_time(*session) + SSL_SESSION_get_timeout(*session) <= now) {
+                SSL_SESSION_free(*session);
+                session = list.erase(session);
+            } else {
+                ++session;
+            }
+        }
+
+        if (list.empty())
+            it = sessions_.erase(it);
+        else
+            ++it;
+    }
+}
+
+void TlsSessionCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : sessions_) {
+        for (SSL_SESSION* session : entry.second)
+            SSL_SESSION_free(session);
+    }
+    sessions_.clear();
+}
+
+void TlsSessionCache::SetPersistPath(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        persist_path_ = path;
+    }
+    Load();
+}
+
+// File layout, repeated per session:
+//   uint16 host length | host | uint32 DER length | DER encoded SSL_SESSION
+void TlsSessionCache::Load() {
+    FILE* fp = fopen(persist_path_.c_str(), "rb");
+    if (!fp)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (true) {
+        uint16_t host_len;
+        uint32_t der_len;
+        if (fread(&host_len, sizeof(host_len), 1, fp) != 1)
+            break;
+
+        std::string host(host_len, '\0');
+        if (fread(&host[0], 1, host_len, fp) != host_len || fread(&der_len, sizeof(der_len), 1, fp) != 1 ||
+            der_len > 64 * 1024)
+            break;
+
+        std::vector<unsigned char> der(der_len);
+        if (fread(der.data(), 1, der_len, fp) != der_len)
+            break;
+
+        const unsigned char* p = der.data();
+        SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &p, der_len);
+        if (!session)
+            continue;
+
+        std::vector<SSL_SESSION*>& list = sessions_[host];
+        if (list.size() >= MAX_SESSIONS_PER_HOST) {
+            SSL_SESSION_free(list.front());
+            list.erase(list.begin());
+        }
+        list.push_back(session);
+    }
+    fclose(fp);
+
+    DropExpiredLocked();
+}
+
+std::string TlsSessionCache::SerializeLocked() const {
+    std::string data;
+    for (const auto& entry : sessions_) {
+        for (SSL_SESSION* session : entry.second) {
+            int der_len = i2d_SSL_SESSION(session, nullptr);
+            if (der_len <= 0)
+                continue;
+
+            std::vector<unsigned char> der(der_len);
+            unsigned char* p = der.data();
+            i2d_SSL_SESSION(session, &p);
+
+            uint16_t host_len = static_cast<uint16_t>(entry.first.size());
+            uint32_t len = static_cast<uint32_t>(der_len);
+            data.append(reinterpret_cast<const char*>(&host_len), sizeof(host_len));
+            data.append(entry.first, 0, host_len);
+            data.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            data.append(reinterpret_cast<const char*>(der.data()), der_len);
+        }
+    }
+    return data;
+}
+
+void TlsSessionCache::Flush() {
+    std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+    std::string path;
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dirty_ || persist_path_.empty())
+            return;
+        dirty_ = false;
+        path = persist_path_;
+        data = SerializeLocked();
+    }
+
+    // Write to a temporary file first so a power cut never leaves a truncated cache. The
+    // tickets hold resumption secrets, which would let anyone send early data as us, so the
+    // file is created for the owner only; a leftover one may have other permissions.
+    std::string tmp_path = path + ".tmp";
+    remove(tmp_path.c_str());
+    int fd = open(tmp_path.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    FILE* fp = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (!fp) {
+        if (fd >= 0)
+            close(fd);
+        perror("Session cache write failed");
+        return;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    if (fclose(fp) != 0 || !ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = true;  // Tried again on the next flush
+    }
+}
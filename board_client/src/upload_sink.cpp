@@ -0,0 +1,43 @@
+#include <string.h>
+
+#include "upload_sink.h"
+
+BufferSink::BufferSink(size_t capacity)
+    : buffer_(new char[capacity]), capacity_(capacity), size_(0), state_(FREE) {}
+
+bool BufferSink::Begin(long size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != FREE || size > static_cast<long>(capacity_))
+        return false;
+    state_ = FILLING;
+    size_ = 0;
+    return true;
+}
+
+bool BufferSink::Write(const char* data, size_t len) {
+    // Only the receiver touches the buffer while it fills
+    if (len > capacity_ - size_)
+        return false;
+    memcpy(buffer_.get() + size_, data, len);
+    size_ += len;
+    return true;
+}
+
+void BufferSink::Finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = HELD;
+}
+
+void BufferSink::Abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = FREE;
+    size_ = 0;
+}
+
+void BufferSink::Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == HELD) {
+        state_ = FREE;
+        size_ = 0;
+    }
+}